@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_ADMXRC2_DEVICE_H_
+#define FILTER_CORE_ADMXRC2_DEVICE_H_
+
+#include "filter_core/device.h"
+
+#include <admxrc2.h>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace filter_core {
+/*!
+ * \class ADMXRC2Device
+ * \brief ADMXRC2 SDKを用いて実際のボードへアクセスする
+ */
+class ADMXRC2Device : public Device {
+ private:
+  /*!
+   * \brief DMA転送のためにロックされたバッファ
+   */
+  struct Region {
+    const uint8_t* base;
+    size_t size;
+    std::weak_ptr<ADMXRC2_DMADESC> descriptor;
+  };
+
+ private:
+  std::shared_ptr<ADMXRC2_HANDLE> handle_;
+  ADMXRC2_CARD_INFO info_;
+  filter_core::fpga_space_t space_;
+  filter_core::BankInfo bank_info_;
+  uint32_t dma_mode_;
+
+  std::mutex regions_mutex_;
+  std::vector<Region> regions_;
+
+ public:
+  ADMXRC2Device(int card,
+                double local_clock_rate,
+                const std::string& bitstream_filename);
+
+ public:
+  ADMXRC2_CARD_INFO info() const { return info_; }
+  filter_core::BankInfo bank_info() const { return bank_info_; }
+  uint32_t get(size_t i) { return space_[i]; }
+  void set(size_t i, uint32_t v) { space_[i] = v; space_[i]; }
+  std::shared_ptr<uint8_t> allocate(size_t size);
+  void transfer(uint8_t* buffer,
+                unsigned long length,
+                unsigned long local_address,
+                filter_core::DMADirection direction);
+};
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_ADMXRC2_DEVICE_H_
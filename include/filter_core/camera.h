@@ -7,10 +7,22 @@
 #ifndef FILTER_CORE_CAMERA_H_
 #define FILTER_CORE_CAMERA_H_
 
+#include "filter_core/frame_queue.h"
+#include "filter_core/frame_source.h"
+#include "filter_core/fused_resize.h"
+#include "filter_core/worker_pool.h"
+
 #include <boost/iterator/iterator_facade.hpp>
 #include <opencv2/opencv.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
 #include <iterator>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 
 namespace filter_core {
@@ -24,16 +36,46 @@ namespace filter_core {
 /*!
  * \class Converter
  * \brief コンバータのためのインターフェース
+ *
+ * parallelizeでスレッドを渡すと、対応するコンバータは出力を行の帯に分け
+ * て並列に変換する.
  */
 class Converter {
+ private:
+  std::shared_ptr<filter_core::WorkerPool> pool_;
  public:
-  ~Converter() {}
+  virtual ~Converter() {}
  public:
+  /*!
+   * \brief 並列に変換するスレッドを指定する
+   * \param pool スレッド.nullptrの場合は呼び出したスレッドだけで変換する
+   */
+  void parallelize(std::shared_ptr<filter_core::WorkerPool> pool)
+    { pool_ = std::move(pool); }
   virtual cv::Mat convert(cv::Mat src) = 0;
+  virtual void convert(cv::Mat src, cv::Mat dst) = 0;
+  /*!
+   * \brief 出力画像のサイズを返す
+   * \return サイズ
+   */
+  virtual cv::Size size() const = 0;
+  /*!
+   * \brief 出力画像の型を返す
+   * \return 型
+   */
+  virtual int type() const = 0;
+ protected:
+  /*!
+   * \brief 並列に変換するスレッドを返す
+   * \return スレッド.指定されていない場合はnullptr
+   */
+  filter_core::WorkerPool* pool() const { return pool_.get(); }
 };
 /*!
  * \class Grayscaler
  * \brief グレースケール変換
+ *
+ * 縮小で補間が最近傍か線形の場合は、変換と縮小を1回の走査で行う.
  */
 class Grayscaler : public Converter {
  private:
@@ -41,61 +83,128 @@ class Grayscaler : public Converter {
   const int interpolation_;
   cv::Mat output_;
   cv::Mat color_converted_;
+  filter_core::FusedResizer fused_;
  public:
   Grayscaler(cv::Size size = {800, 600},
              int interpolation = cv::INTER_LINEAR)
     : size_(size),
       interpolation_(interpolation),
       output_(size, CV_8UC1),
-      color_converted_() {}
+      color_converted_(),
+      fused_(size, interpolation, true) {}
+  /*!
+   * \brief 出力先を指定するコンストラクタ
+   * \param output 出力先.DMAバッファを参照する画像を渡すことができる
+   * \param interpolation 補間方法
+   */
+  Grayscaler(cv::Mat output, int interpolation)
+    : size_(output.size()),
+      interpolation_(interpolation),
+      output_(output),
+      color_converted_(),
+      fused_(output.size(), interpolation, true) {}
  public:
   cv::Mat convert(cv::Mat src);
+  void convert(cv::Mat src, cv::Mat dst);
+  cv::Size size() const { return size_; }
+  int type() const { return CV_8UC1; }
 };
 /*!
  * \class Resize
  * \brief リサイズ
+ *
+ * 並列に変換する場合、縮小で補間が最近傍か線形であれば行の帯に分けて縮小
+ * する.
  */
 class Resizer : public Converter {
  private:
   const cv::Size size_;
   const int interpolation_;
   cv::Mat output_;
+  filter_core::FusedResizer fused_;
  public:
   Resizer(cv::Size size = {800, 600},
           int interpolation = cv::INTER_LINEAR)
     : size_(size),
       interpolation_(interpolation),
-      output_(size, CV_8UC1) {}
+      output_(size, CV_8UC3),
+      fused_(size, interpolation, false) {}
+  /*!
+   * \brief 出力先を指定するコンストラクタ
+   * \param output 出力先.DMAバッファを参照する画像を渡すことができる
+   * \param interpolation 補間方法
+   */
+  Resizer(cv::Mat output, int interpolation)
+    : size_(output.size()),
+      interpolation_(interpolation),
+      output_(output),
+      fused_(output.size(), interpolation, false) {}
  public:
   cv::Mat convert(cv::Mat src);
+  void convert(cv::Mat src, cv::Mat dst);
+  cv::Size size() const { return size_; }
+  int type() const { return CV_8UC3; }
 };
 /*!
  * \class Camera
  * \brief カメラ画像を取得するキャプチャクラス
+ *
+ * 入力はカメラのほか、動画ファイルや画像ファイルの連番でもよい.先読みする
+ * 場合は専用のスレッドが読み込みと変換を行い、構築時に確保した画像へ書き
+ * 込む.実時間で再生する場合、ファイルからの入力は記録されたフレームレート
+ * を超えないように待つ.
  */
 class Camera {
  private:
   using iterator_type = filter_core::camera_detail::FrameIterator;
+  static constexpr size_t NO_SLOT = ~static_cast<size_t>(0);
  private:
-  cv::VideoCapture capture_;
+  std::unique_ptr<filter_core::FrameSource> source_;
   cv::Mat frame_;
   std::unique_ptr<Converter> converter_;
+  bool has_pending_;
+  // 実時間で再生する場合の1フレームの間隔.0の場合は待たない
+  const std::chrono::steady_clock::duration period_;
+  std::chrono::steady_clock::time_point start_;
+  uint64_t delivered_;
+  // 先読みした変換済みの画像とその名前、それを書き込むスレッド
+  std::vector<cv::Mat> slots_;
+  std::vector<std::string> slot_names_;
+  filter_core::BoundedQueue<size_t> free_;
+  filter_core::BoundedQueue<size_t> filled_;
+  size_t pending_;
+  cv::Mat current_;
+  std::string name_;
+  std::exception_ptr error_;
+  std::thread decoder_;
 
  public:
-  Camera(std::unique_ptr<Converter>&& converter)
-    : capture_(0),
-      frame_(),
-      converter_(std::move(converter)) {}
+  explicit Camera(std::unique_ptr<Converter>&& converter);
+  Camera(std::unique_ptr<Converter>&& converter,
+         std::unique_ptr<filter_core::FrameSource>&& source,
+         size_t prefetch_depth,
+         bool is_paced);
+  ~Camera();
+ private:
+  Camera(const Camera&) = delete;
+  Camera& operator=(const Camera&) = delete;
+
  public:
-  /*!
-   * \brief キャプチャ可能である場合、真を返す
-   * \returns キャプチャ可能である場合、真
-   */
-  bool isReady() const { return capture_.isOpened(); }
+  bool isReady();
  public:
   iterator_type begin();
   iterator_type end();
   cv::Mat get();
+  void get(cv::Mat dst);
+  /*!
+   * \brief 直前に取得した画像の名前を返す
+   * \return 名前.名前のない入力では空
+   */
+  const std::string& name() const { return name_; }
+ private:
+  bool fetch();
+  void next();
+  void decode();
 };
 }  // namespace filter_core
 
@@ -135,6 +244,8 @@ namespace filter_core {
 
 std::unique_ptr<filter_core::Converter> MakeConveter(
     bool is_colored, cv::Size size, int interpolation);
+std::unique_ptr<filter_core::Converter> MakeConveter(
+    bool is_colored, cv::Mat output, int interpolation);
 }  // namespace filter_core
 
 #endif
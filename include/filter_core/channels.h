@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_CHANNELS_H_
+#define FILTER_CORE_CHANNELS_H_
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define FILTER_CORE_HAS_SSSE3_KERNELS
+#endif
+
+
+namespace filter_core {
+
+void SplitChannels(cv::Mat src, std::vector<cv::Mat>& planes);
+void MergeChannels(const std::vector<cv::Mat>& planes, cv::Mat dst);
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace channels {
+
+/*!
+ * \var CHANNEL
+ * 扱うチャネル数.BGRのみ
+ */
+constexpr int CHANNEL = 3;
+/*!
+ * \var VECTOR_WIDTH
+ * SSSE3で一度に処理する画素数
+ */
+constexpr int VECTOR_WIDTH = 16;
+
+#ifdef FILTER_CORE_HAS_SSSE3_KERNELS
+/*!
+ * \class ShuffleMasks
+ * \brief 16画素(48バイト)の分解と合成に使うpshufbのマスク
+ *
+ * split[c][q]は48バイトのうちq番目の16バイトからチャネルcの画素を集め、
+ * merge[q][c]はチャネルcの16画素からq番目の16バイトへ入る画素を集める.
+ * 該当しない位置は0x80で0になるため、3つの結果の論理和が求める値になる.
+ */
+class ShuffleMasks {
+ public:
+  __m128i split[CHANNEL][CHANNEL];
+  __m128i merge[CHANNEL][CHANNEL];
+ public:
+  ShuffleMasks();
+};
+
+const ShuffleMasks& GetShuffleMasks();
+bool HasSSSE3();
+bool HasAVX2();
+#endif
+}  // namespace channels
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_CHANNELS_H_
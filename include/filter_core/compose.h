@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_COMPOSE_H_
+#define FILTER_CORE_COMPOSE_H_
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+
+namespace filter_core {
+/*!
+ * \enum ComposeLayout
+ * \brief 表示する画像の構成
+ */
+enum class ComposeLayout {
+  FILTERED,       //!< フィルタ画像だけ
+  SIDE_BY_SIDE,   //!< 左にフィルタ画像、右に元画像
+  STACKED,        //!< 上にフィルタ画像、下に元画像
+  DIFFERENCE      //!< フィルタ画像と元画像の差の絶対値
+};
+
+/*!
+ * \class Canvas
+ * \brief 表示する画像と、その中のフィルタ画像と元画像の領域
+ *
+ * 各領域は1枚の画像を参照するため、フィルタ画像と元画像を直接書き込めば
+ * 結合のためのコピーが要らない.縦に並べる構成では各領域が連続する.
+ */
+class Canvas {
+ public:
+  cv::Mat image;        //!< 全体
+  cv::Mat filtered;     //!< フィルタ画像の領域
+  cv::Mat original;     //!< 元画像の領域
+  cv::Mat difference;   //!< 差の領域.DIFFERENCE以外では空
+  cv::Mat shown;        //!< 表示する領域
+};
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+cv::Size GetCanvasSize(filter_core::ComposeLayout layout, cv::Size size);
+cv::Size GetShownSize(filter_core::ComposeLayout layout, cv::Size size);
+filter_core::Canvas MakeCanvas(cv::Mat image,
+                               filter_core::ComposeLayout layout,
+                               cv::Size size);
+bool IsContinuous(const filter_core::Canvas& canvas);
+void Compose(filter_core::Canvas& canvas, filter_core::ComposeLayout layout);
+void Compose(filter_core::Canvas& canvas, filter_core::ComposeLayout layout,
+             cv::Mat filtered, cv::Mat original);
+filter_core::ComposeLayout GetComposeLayout(const std::string& s);
+std::string ToString(filter_core::ComposeLayout layout);
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_COMPOSE_H_
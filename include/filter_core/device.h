@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_DEVICE_H_
+#define FILTER_CORE_DEVICE_H_
+
+#include <admxrc2.h>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+
+namespace filter_core {
+
+constexpr size_t MAX_BANK = 16;
+
+// バンクのうちホストから見える範囲(ページ)と、そのローカルアドレス
+constexpr size_t PAGE_REG_PAGEMASK = 0x7ffU;
+constexpr unsigned long PAGE_SIZE = 0x200000U;
+constexpr unsigned long PAGE_SHIFT = 21;
+
+constexpr unsigned long MEMORY_WINDOW_ADDRESS = 0x200000U;   /* In bytes */
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+using fpga_space_t = volatile uint32_t*;
+using BankInfo = std::array<ADMXRC2_BANK_INFO, filter_core::MAX_BANK>;
+
+/*!
+ * \enum DMADirection
+ * \brief DMA転送の方向
+ */
+enum class DMADirection { TO_LOCAL, TO_HOST };
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \class Device
+ * \brief FPGAボードへのアクセス手段のインターフェース
+ *
+ * FPGACommunicatorはこのインターフェースを通してのみボードへアクセスする.
+ * 実際のボードを使う実装とソフトウェアで模擬する実装がある.
+ */
+class Device {
+ public:
+  virtual ~Device() {}
+ public:
+  virtual ADMXRC2_CARD_INFO info() const = 0;
+  virtual filter_core::BankInfo bank_info() const = 0;
+  /*!
+   * \brief レジスタを読み込む
+   * \param i インデックス
+   * \return レジスタの値
+   */
+  virtual uint32_t get(size_t i) = 0;
+  /*!
+   * \brief レジスタへ書き込み、書き込みが完了するまで待つ
+   * \param i インデックス
+   * \param v 書き込む値
+   */
+  virtual void set(size_t i, uint32_t v) = 0;
+  /*!
+   * \brief DMA転送に使えるバッファを確保する
+   * \param size バイト数
+   * \return バッファ.このデバイスより先に破棄すること
+   */
+  virtual std::shared_ptr<uint8_t> allocate(size_t size) = 0;
+  /*!
+   * \brief allocateで確保したバッファとローカルアドレス間でDMA転送する
+   * \param buffer バッファ内の転送元または転送先
+   * \param length バイト数
+   * \param local_address ローカルアドレス
+   * \param direction 転送方向
+   */
+  virtual void transfer(uint8_t* buffer,
+                        unsigned long length,
+                        unsigned long local_address,
+                        filter_core::DMADirection direction) = 0;
+  /*!
+   * \brief finish信号による割り込みを待てるかを返す
+   * \return 待てる場合は真
+   */
+  virtual bool supports_interrupt() const { return false; }
+  /*!
+   * \brief finish信号による割り込みを待つ
+   * supports_interruptが真を返すデバイスでのみ呼び出す
+   *
+   * \param timeout 最大待ち時間
+   * \return タイムアウトまでにfinish信号が有効になれば真
+   */
+  virtual bool wait_interrupt(std::chrono::microseconds timeout)
+    { return false; }
+};
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_DEVICE_H_
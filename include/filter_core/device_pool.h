@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_DEVICE_POOL_H_
+#define FILTER_CORE_DEVICE_POOL_H_
+
+#include "filter_core/device.h"
+#include "filter_core/fpga_communicator.h"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+
+namespace filter_core {
+/*!
+ * \class DevicePool
+ * \brief 複数のFPGAボードと、それぞれとのコミュニケータ
+ *
+ * ボードはカードの番号順に並ぶ.ビットストリームの書き込みには時間がかか
+ * るため、各ボードは別のスレッドで並行に開く.
+ */
+class DevicePool {
+ public:
+  /*!
+   * \brief カードの番号からデバイスを開く関数
+   */
+  using factory_t =
+    std::function<std::shared_ptr<filter_core::Device> (size_t)>;
+ private:
+  std::vector<std::unique_ptr<filter_core::FPGACommunicator>> communicators_;
+ public:
+  DevicePool(size_t count, factory_t factory, size_t buffer_size);
+ private:
+  DevicePool(const DevicePool&) = delete;
+  DevicePool& operator=(const DevicePool&) = delete;
+
+ public:
+  /*!
+   * \brief ボードの数を返す
+   * \return ボードの数
+   */
+  size_t size() const { return communicators_.size(); }
+  /*!
+   * \brief ボードとのコミュニケータを返す
+   * \param i カードの番号
+   * \return コミュニケータ
+   */
+  filter_core::FPGACommunicator& operator[](size_t i)
+    { return *communicators_[i]; }
+};
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_DEVICE_POOL_H_
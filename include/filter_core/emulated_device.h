@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_EMULATED_DEVICE_H_
+#define FILTER_CORE_EMULATED_DEVICE_H_
+
+#include "filter_core/device.h"
+#include "filter_core/reference_filter.h"
+
+#include <admxrc2.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace filter_core {
+/*!
+ * \class EmulatedDevice
+ * \brief ボードとSDKをソフトウェアで模擬するデバイス
+ *
+ * SRAMバンク、BANK_REG、PAGE_REGとユーザレジスタを持つ.enable信号が有効に
+ * なると、専用のスレッドが入力バンクの画像に参照用のフィルタをかけて出力
+ * バンクへ書き込み、finish信号を有効にする.finish信号は割り込みとして
+ * も通知される.フィルタの処理時間とDMA転送の帯域は設定できる.ボードの無い
+ * 環境でホスト側の処理を動かし、性能を測るために使う.
+ */
+class EmulatedDevice : public Device {
+ private:
+  static constexpr size_t REGISTER_COUNT = 0x80;
+
+ private:
+  ADMXRC2_CARD_INFO info_;
+  const filter_core::ReferenceFilter filter_;
+  const std::chrono::microseconds latency_;
+  const double bandwidth_;
+  std::array<std::atomic<uint32_t>, REGISTER_COUNT> registers_;
+
+  std::mutex memory_mutex_;
+  std::vector<std::vector<uint8_t>> banks_;
+
+  // フィルタを実行するスレッドへの要求と、finish信号の通知
+  std::mutex state_mutex_;
+  std::condition_variable state_changed_;
+  uint64_t requested_;
+  uint64_t completed_;
+  bool is_closed_;
+  std::vector<uint8_t> input_, previous_, output_;
+  std::thread worker_;
+
+ public:
+  EmulatedDevice(
+      filter_core::ReferenceFilter filter = filter_core::ReferenceFilter::COPY,
+      std::chrono::microseconds latency = std::chrono::microseconds::zero(),
+      double bandwidth = 0.0,
+      size_t bank_count = 6,
+      size_t bank_size = 2 * PAGE_SIZE);
+  ~EmulatedDevice();
+
+ public:
+  ADMXRC2_CARD_INFO info() const { return info_; }
+  filter_core::BankInfo bank_info() const;
+  uint32_t get(size_t i);
+  void set(size_t i, uint32_t v);
+  std::shared_ptr<uint8_t> allocate(size_t size);
+  void transfer(uint8_t* buffer,
+                unsigned long length,
+                unsigned long local_address,
+                filter_core::DMADirection direction);
+  bool supports_interrupt() const { return true; }
+  bool wait_interrupt(std::chrono::microseconds timeout);
+
+ private:
+  void work();
+  void run();
+};
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_EMULATED_DEVICE_H_
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_FILTER_H_
+#define FILTER_CORE_FILTER_H_
+
+#include "filter_core/fpga_communicator.h"
+#include "filter_core/handshake.h"
+#include "filter_core/program_options.h"
+#include "filter_core/reference_filter.h"
+#include "filter_core/worker_pool.h"
+
+#include <boost/optional.hpp>
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+
+namespace filter_core {
+
+/*!
+ * \brief フィルタ.出力画像へ入力画像の結果を書き込んだ場合は真を返す
+ *
+ * 結果を1フレーム遅らせるフィルタは、最初の呼び出しで偽を返し、以降は
+ * 入力画像を1フレーム前の入力画像を保持する画像と入れ替えて、その結果を
+ * 書き込む.
+ */
+using filter_t =
+  std::function<bool (filter_core::FPGACommunicator&, cv::Mat&, cv::Mat)>;
+
+/*!
+ * \class FilterStage
+ * \brief ボード毎のフィルタと、終了時に残った結果を取り出す手順
+ *
+ * finishは結果を遅らせるフィルタだけが持ち、入力画像を最後の入力画像と入
+ * れ替えて結果を書き込んだ場合は真を返す.それ以外のフィルタではnullptr.
+ */
+class FilterStage {
+ public:
+  filter_core::filter_t filter;
+  filter_core::filter_t finish;
+};
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \class PingPongFilter
+ * \brief 入出力バンクの対を交互に切り替えて空間フィルタをかける
+ *
+ * バンク0、1の対とバンク2、3の対をフレーム毎に切り替え、使用する対の番号
+ * をBANK_PAIR_REGで通知する.カラー画像は画素順の配置のまま転送する.FPGA
+ * がフレームNをフィルタしている間にフレームN+1を送信するため、結果は1フ
+ * レーム遅れる.
+ *
+ * 送信した入力画像は、DMAバッファ上に確保した画像と入れ替えて1フレーム
+ * 分保持する.入力画像には結果と対になる1フレーム前の入力画像を返すため、
+ * ホスト側でコピーしない.最後のフレームの結果はfinishで取得する.
+ */
+class PingPongFilter {
+ private:
+  const filter_core::ImageOptions& options_;
+  filter_core::Handshake& handshake_;
+  uint32_t pair_;
+  bool is_pending_;
+  cv::Mat held_;    //!< FPGAがフィルタしている入力画像.最初は空き
+ public:
+  PingPongFilter(filter_core::FPGACommunicator& com,
+                 const filter_core::ImageOptions& options,
+                 filter_core::Handshake& handshake,
+                 size_t buffer_offset);
+ public:
+  bool operator()(filter_core::FPGACommunicator& com,
+                  cv::Mat& src, cv::Mat dst);
+  bool finish(filter_core::FPGACommunicator& com, cv::Mat& src, cv::Mat dst);
+};
+
+/*!
+ * \class RoiFilter
+ * \brief 画像の一部の矩形領域だけに空間フィルタをかける
+ *
+ * 領域はクリックした座標を中心に移動するか、固定される.クリックはユーザ
+ * レジスタを読まず、ホスト側で共有する座標から得る.領域の画素だけを詰め
+ * て1回のDMA転送で送受信し、FPGAには領域の大きさを画像サイズとして、左
+ * 上の座標をROI_X_REG、ROI_Y_REGで通知する.領域の外側は入力画像のまま表
+ * 示する.
+ */
+class RoiFilter {
+ private:
+  const filter_core::ImageOptions& options_;
+  const filter_core::ImageOptions roi_options_;
+  filter_core::Handshake& handshake_;
+  const filter_core::ColorLayout layout_;
+  const bool is_following_click_;
+  const filter_core::MousePosition& mouse_;
+  uint32_t clicks_;   //!< 最後に領域へ反映したクリックの回数
+  cv::Point center_;
+  cv::Rect previous_;
+  cv::Mat upload_, download_;
+ public:
+  RoiFilter(filter_core::FPGACommunicator& com,
+            const filter_core::ImageOptions& options,
+            filter_core::Handshake& handshake,
+            filter_core::ColorLayout layout,
+            cv::Size size,
+            boost::optional<cv::Point> origin,
+            const filter_core::MousePosition& mouse,
+            size_t buffer_offset);
+ public:
+  void operator()(filter_core::FPGACommunicator& com,
+                  cv::Mat src, cv::Mat dst);
+ private:
+  cv::Rect region() const;
+};
+
+/*!
+ * \class HistoryFilter
+ * \brief 過去のフレームをSRAMに残し、時間方向のフィルタに使わせる
+ *
+ * バンク0、1以外の空いているバンクをフレームの置き場所のリングとし、各
+ * フレームは次の置き場所へ1回だけ送信する.過去のフレームは上書きされる
+ * まで置いたままにし、新しい順の位置をHISTORY_FRAMEx_REGで、有効なフレー
+ * ムの数をHISTORY_LENGTH_REGで通知する.出力はバンク1から取得する.
+ */
+class HistoryFilter {
+ private:
+  const filter_core::ImageOptions& options_;
+  filter_core::Handshake& handshake_;
+  const filter_core::ColorLayout layout_;
+  std::vector<std::pair<uint32_t, uint64_t>> slots_;   //!< バンクとオフセット
+  size_t next_;       //!< 次のフレームを置くslots_のインデックス
+  size_t length_;     //!< 有効なフレームの数
+ public:
+  HistoryFilter(filter_core::FPGACommunicator& com,
+                const filter_core::ImageOptions& options,
+                filter_core::Handshake& handshake,
+                filter_core::ColorLayout layout,
+                size_t length);
+ public:
+  void operator()(filter_core::FPGACommunicator& com,
+                  cv::Mat src, cv::Mat dst);
+};
+
+/*!
+ * \class HybridFilter
+ * \brief 画像を上下の帯に分け、FPGAとCPUで並行に空間フィルタをかける
+ *
+ * 上の帯はFPGAへ送り、FPGAには帯の大きさを画像サイズとして通知する.下の
+ * 帯はビットストリームと同じ参照用のフィルタを、FPGAとの転送を行うスレッ
+ * ド以外のスレッドでかける.帯の境界の行にも正しい結果を得るため、FPGAへ
+ * は下の隣の1行を加えて送る.
+ *
+ * 各フレームでFPGAとCPUのそれぞれが1行にかけた時間を測り、両者が同時に
+ * 終わるように次のフレームの分け方を調整する.画素順に転送する画像だけ
+ * に対応する.
+ */
+class HybridFilter {
+ private:
+  const filter_core::ImageOptions& options_;
+  filter_core::Handshake& handshake_;
+  const filter_core::ReferenceFilter reference_;
+  std::shared_ptr<filter_core::WorkerPool> pool_;
+  double ratio_;      //!< FPGAへ送る行の割合
+  int sent_rows_;     //!< FPGAへ通知した行数.0は未通知
+ public:
+  HybridFilter(const filter_core::ImageOptions& options,
+               filter_core::Handshake& handshake,
+               filter_core::ReferenceFilter reference,
+               size_t thread_count);
+ public:
+  void operator()(filter_core::FPGACommunicator& com,
+                  cv::Mat src, cv::Mat dst);
+};
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+void Filter(filter_core::FPGACommunicator& com,
+            cv::Mat src, cv::Mat dst,
+            const filter_core::ImageOptions& options,
+            filter_core::Handshake& handshake);
+void FilterColored(filter_core::FPGACommunicator& com,
+                   cv::Mat src, cv::Mat dst,
+                   const filter_core::ImageOptions& options,
+                   filter_core::Handshake& handshake,
+                   filter_core::ColorLayout layout);
+void FilterChain(filter_core::FPGACommunicator& com,
+                 cv::Mat src, cv::Mat dst,
+                 const filter_core::ImageOptions& options,
+                 filter_core::Handshake& handshake,
+                 filter_core::ColorLayout layout,
+                 size_t passes);
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_FILTER_H_
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_FINISH_WAITER_H_
+#define FILTER_CORE_FINISH_WAITER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+
+namespace filter_core {
+class FPGACommunicator;
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \enum WaitStrategy
+ * \brief finish信号の待ち方
+ */
+enum class WaitStrategy {
+  SLEEP,      //!< 250us毎に確認する(従来の方法)
+  ADAPTIVE,   //!< しばらくビジーウェイトし、その後間隔を指数的に延ばす
+  SPIN,       //!< ビジーウェイトで確認し続ける
+  INTERRUPT   //!< デバイスの割り込みを待つ.未対応のデバイスではADAPTIVE
+};
+
+/*!
+ * \class WaitStatistics
+ * \brief finish信号の待ち時間の統計
+ */
+class WaitStatistics {
+ public:
+  using duration_type = std::chrono::microseconds;
+ public:
+  uint64_t count;
+  uint64_t timeouts;
+  duration_type total;
+  duration_type min;
+  duration_type max;
+ public:
+  WaitStatistics()
+    : count(0), timeouts(0),
+      total(duration_type::zero()),
+      min(duration_type::max()),
+      max(duration_type::zero()) {}
+ public:
+  void add(duration_type d, bool is_timed_out);
+};
+
+/*!
+ * \class FinishWaiter
+ * \brief finish信号を待ち、待ち時間を記録する
+ */
+class FinishWaiter {
+ private:
+  const filter_core::WaitStrategy strategy_;
+  const std::chrono::microseconds timeout_;
+
+  mutable std::mutex mutex_;
+  filter_core::WaitStatistics statistics_;
+ public:
+  FinishWaiter(filter_core::WaitStrategy strategy,
+               std::chrono::microseconds timeout)
+    : strategy_(strategy), timeout_(timeout), mutex_(), statistics_() {}
+ private:
+  FinishWaiter(const FinishWaiter&) = delete;
+  FinishWaiter& operator=(const FinishWaiter&) = delete;
+
+ public:
+  bool wait(filter_core::FPGACommunicator& com);
+  filter_core::WaitStatistics statistics() const;
+};
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+bool WaitRegister(filter_core::FPGACommunicator& com,
+                  size_t i,
+                  bool is_set,
+                  filter_core::WaitStrategy strategy,
+                  std::chrono::microseconds timeout);
+std::ostream& operator<<(std::ostream& os,
+                         const filter_core::WaitStatistics& s);
+std::string ToString(filter_core::WaitStrategy strategy);
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_FINISH_WAITER_H_
@@ -7,25 +7,33 @@
 #ifndef FILTER_CORE_FPGA_COMMUNICATOR_H_
 #define FILTER_CORE_FPGA_COMMUNICATOR_H_
 
+#include "filter_core/device.h"
+#include "filter_core/frame_queue.h"
+
 #include <admxrc2.h>
 #include <opencv2/opencv.hpp>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 
 namespace filter_core {
 
-constexpr size_t MAX_BANK = 16;
-
 constexpr size_t BANK_REG = 0x0;
 constexpr size_t PAGE_REG = 0x1;
 constexpr size_t MEMCTL_REG = 0x2;
 constexpr size_t STATUS_REG = 0x4;
 constexpr size_t MEMSTAT_REG = 0x6;
 
-auto MODEx_REG = [](size_t n) { return 0x10 + n; };
+constexpr size_t MODEx_REG(size_t n) { return 0x10 + n; }
 
 // ユーザレジスタのインデックス
 constexpr size_t REFRESH_REG = 0x40;
@@ -35,44 +43,141 @@ constexpr size_t IMAGE_WIDTH_REG = 0x43;
 constexpr size_t LEFT_BUTTON_CLICK_FLAG_REG = 0x44;
 constexpr size_t LEFT_BUTTON_CLICK_X_REG = 0x45;
 constexpr size_t LEFT_BUTTON_CLICK_Y_REG = 0x46;
+constexpr size_t BANK_PAIR_REG = 0x47;
+constexpr size_t COLOR_LAYOUT_REG = 0x48;
+constexpr size_t ROI_X_REG = 0x49;
+constexpr size_t ROI_Y_REG = 0x4A;
+// 1の場合、BANK_PAIR_REGで選択した対の出力バンクを入力、入力バンクを出力とする
+constexpr size_t BANK_SWAP_REG = 0x4B;
+// 履歴のフレーム数.0の場合は履歴を使わず、バンク0を入力とする
+constexpr size_t HISTORY_LENGTH_REG = 0x4C;
+// 新しい順にn番目のフレームのSRAM上の位置.上位8ビットがバンク、下位24ビッ
+// トがバイトオフセット.0番目が今回のフレーム
+constexpr size_t HISTORY_FRAMEx_REG(size_t n) { return 0x50 + n; }
 
 constexpr size_t FINISH_REG = 0x60;
+constexpr size_t REFRESH_ACK_REG = 0x61;
 
 constexpr size_t DEBUG0_REG = 0x7C;
 constexpr size_t DEBUG1_REG = 0x7D;
 constexpr size_t DEBUG2_REG = 0x7E;
 constexpr size_t DEBUG3_REG = 0x7F;
-}  // namespace filter_core
 
+/*!
+ * \var MAX_HISTORY_LENGTH
+ * HISTORY_FRAMEx_REGで通知できるフレームの最大数
+ */
+constexpr size_t MAX_HISTORY_LENGTH = 16;
 
-namespace filter_core {
-
-using fpga_space_t = volatile uint32_t*;
-using BankInfo = std::array<ADMXRC2_BANK_INFO, filter_core::MAX_BANK>;
+/*!
+ * \enum ColorLayout
+ * \brief SRAM上の画像の配置.COLOR_LAYOUT_REGで通知する
+ */
+enum class ColorLayout : uint32_t {
+  MONOCHROME = 0,   //!< グレースケール.IMAGE_SIZE_REGバイト
+  PLANAR = 1,       //!< B、G、Rの各平面をIMAGE_SIZE_REGバイト毎に連続して配置
+  INTERLEAVED = 2   //!< BGRの画素を順に配置
+};
 }  // namespace filter_core
 
 
 namespace filter_core {
+/*!
+ * \class TransferStatistics
+ * \brief DMA転送とレジスタへの書き込みの回数
+ */
+class TransferStatistics {
+ public:
+  uint64_t transfers;         //!< DMA転送の回数.分割した単位毎に1回
+  uint64_t bytes;             //!< DMA転送したバイト数
+  std::chrono::microseconds transfer_time;  //!< DMA転送にかかった時間
+  uint64_t register_writes;   //!< レジスタへの書き込み回数
+  uint64_t elided_writes;     //!< 値が変わらないため省略した書き込み回数
+ public:
+  TransferStatistics()
+    : transfers(0), bytes(0),
+      transfer_time(std::chrono::microseconds::zero()),
+      register_writes(0), elided_writes(0) {}
+};
+
+/*!
+ * \class PageWindow
+ * \brief BANK_REGとPAGE_REGの値を保持し、値が変わる場合だけ書き込む
+ *
+ * ボードのレジスタへの書き込みは読み返しによるフラッシュを伴うため、同じ
+ * バンクの同じページへの転送が続く場合に省略できる分を省略する.
+ */
+class PageWindow {
+ private:
+  static constexpr uint32_t UNKNOWN = ~0U;
+ private:
+  filter_core::Device& device_;
+  uint32_t bank_;
+  uint32_t page_;
+  filter_core::TransferStatistics& statistics_;
+ public:
+  PageWindow(filter_core::Device& device,
+             filter_core::TransferStatistics& statistics)
+    : device_(device), bank_(UNKNOWN), page_(UNKNOWN),
+      statistics_(statistics) {}
+ public:
+  void select_bank(uint32_t bank) { set(BANK_REG, bank & 0xfU, bank_); }
+  void select_page(uint32_t page)
+    { set(PAGE_REG, page & PAGE_REG_PAGEMASK, page_); }
+  /*!
+   * \brief 保持している値を捨て、次回は必ず書き込む
+   */
+  void invalidate() { bank_ = page_ = UNKNOWN; }
+ private:
+  void set(size_t i, uint32_t v, uint32_t& current) {
+    if (v == current) {
+      ++statistics_.elided_writes;
+    } else {
+      device_.set(i, v);
+      current = v;
+      ++statistics_.register_writes;
+    }
+  }
+};
+
 /*!
  * \class FPGACommunicator
  * \brief FPGAボードとの通信クラス
  */
 class FPGACommunicator {
  public:
-  std::shared_ptr<ADMXRC2_HANDLE> handle_;
+  std::shared_ptr<filter_core::Device> device_;
   ADMXRC2_CARD_INFO info_;
-  filter_core::fpga_space_t space_;
   filter_core::BankInfo bank_info_;
 
   std::shared_ptr<uint8_t> read_buffer_, write_buffer_;
-  std::shared_ptr<ADMXRC2_DMADESC> read_descriptor_, write_descriptor_;
-  uint32_t dma_mode_;
+  size_t buffer_size_;
+
+ private:
+  // BANK_REGとPAGE_REGを共有するため、DMA転送は同時に1つだけ行う
+  std::mutex dma_mutex_;
+  // allocateで確保した、直接転送できる領域と大きさ
+  std::vector<std::pair<std::shared_ptr<uint8_t>, size_t>> regions_;
+  unsigned long chunk_size_;
+  filter_core::TransferStatistics statistics_;
+  filter_core::PageWindow window_;
+  std::atomic<uint64_t> register_writes_;
+  // 非同期転送の要求と、それを処理するスレッド
+  filter_core::BoundedQueue<std::packaged_task<void ()>> transfers_;
+  std::once_flag transfer_thread_flag_;
+  std::thread transfer_thread_;
 
  public:
   FPGACommunicator(
       double local_clock_rate,
       const std::string& bitstream_filename,
       size_t buffer_size);
+  FPGACommunicator(std::shared_ptr<filter_core::Device> device,
+                   size_t buffer_size);
+  ~FPGACommunicator();
+ private:
+  FPGACommunicator(const FPGACommunicator&) = delete;
+  FPGACommunicator& operator=(const FPGACommunicator&) = delete;
 
  public:
   /*!
@@ -82,7 +187,11 @@ class FPGACommunicator {
    * \param i インデックス
    * \return インデックスで指定したユーザレジスタの値
    */
-  uint32_t operator[](size_t i) const noexcept { return space_[i]; }
+  uint32_t operator[](size_t i) const noexcept { return device_->get(i); }
+ public:
+  cv::Mat read_buffer(cv::Size size, int type, size_t offset = 0);
+  cv::Mat write_buffer(cv::Size size, int type, size_t offset = 0);
+  cv::Mat allocate(cv::Size size, int type);
  public:
   void read(void* buffer,
             uint64_t offset,
@@ -93,35 +202,70 @@ class FPGACommunicator {
              uint64_t offset,
              unsigned long length,
              uint32_t bank);
+ public:
+  std::future<void> read_async(void* buffer,
+                               uint64_t offset,
+                               unsigned long length,
+                               uint32_t bank);
+  std::future<void> write_async(void* buffer,
+                                uint64_t offset,
+                                unsigned long length,
+                                uint32_t bank);
+ public:
+  void set_chunk_size(unsigned long chunk_size);
+  filter_core::TransferStatistics statistics();
+ private:
+  std::future<void> enqueue(std::packaged_task<void ()>&& task);
+};
+
+/*!
+ * \class MousePosition
+ * \brief 最後にクリックした座標とクリックの回数.全てのボードとフィルタで
+ *        共有する
+ *
+ * 座標を書き込んでから回数を増やすため、回数が変われば新しい座標を読める.
+ */
+class MousePosition {
+ public:
+  std::atomic<uint32_t> x;
+  std::atomic<uint32_t> y;
+  std::atomic<uint32_t> clicks;
+ public:
+  MousePosition() : x(0), y(0), clicks(0) {}
 };
 
 class MouseEvent {
  private:
   FPGACommunicator& com_;
 
-  std::atomic<uint32_t>& x_;
-  std::atomic<uint32_t>& y_;
+  filter_core::MousePosition& position_;
   cv::Size image_size_;
 
   std::atomic<uint32_t> is_clicked_;
  public:
   MouseEvent(filter_core::FPGACommunicator& com,
-             std::atomic<uint32_t>& x,
-             std::atomic<uint32_t>& y,
+             filter_core::MousePosition& position,
              cv::Size image_size)
-    : com_(com), x_(x), y_(y), image_size_(image_size), is_clicked_(0) {}
-  ~MouseEvent() {
+    : com_(com), position_(position), image_size_(image_size),
+      is_clicked_(0) {}
+  ~MouseEvent() { send(); }
+ public:
+  /*!
+   * \brief クリックの有無と座標をユーザレジスタへ書き込む
+   * クリックの有無はリセットされる
+   */
+  void send() {
     com_.write(filter_core::LEFT_BUTTON_CLICK_FLAG_REG,
-               is_clicked_.load(std::memory_order::memory_order_relaxed) > 0);
-    com_.write(filter_core::LEFT_BUTTON_CLICK_X_REG, x_.load());
-    com_.write(filter_core::LEFT_BUTTON_CLICK_Y_REG, y_.load());
+               is_clicked_.exchange(0, std::memory_order_relaxed) > 0);
+    com_.write(filter_core::LEFT_BUTTON_CLICK_X_REG, position_.x.load());
+    com_.write(filter_core::LEFT_BUTTON_CLICK_Y_REG, position_.y.load());
   }
- public:
   void set(int x, int y) {
     if (x >= 0 && x < image_size_.width && y >= 0 && y < image_size_.height) {
       is_clicked_.fetch_add(1);
-      x_ = x;
-      y_ = y;
+      position_.x = x;
+      position_.y = y;
+      position_.clicks.fetch_add(1);
     }
   }
 };
@@ -135,6 +279,9 @@ filter_core::FPGACommunicator& OutputUserRegisters(
 filter_core::FPGACommunicator& SendImageSize(filter_core::FPGACommunicator& com,
                                              uint32_t total_size,
                                              uint32_t width);
+filter_core::FPGACommunicator& SendColorLayout(
+    filter_core::FPGACommunicator& com,
+    filter_core::ColorLayout layout);
 filter_core::FPGACommunicator& SendRefresh(filter_core::FPGACommunicator& com);
 }  // namespace filter_core
 
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_FRAME_MAILBOX_H_
+#define FILTER_CORE_FRAME_MAILBOX_H_
+
+#include <opencv2/opencv.hpp>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+
+namespace filter_core {
+/*!
+ * \class FrameMailbox
+ * \brief 最新の1フレームだけを受け渡す、ロックを取らない郵便受け
+ *
+ * 3枚の画像を書き込み側、受け渡し用、読み込み側で交換する.書き込み側は
+ * 読み込み側を待たずに次々と画像を渡し、読まれなかった古い画像は捨てられ
+ * る.書き込み側と読み込み側はそれぞれ1つのスレッドに限る.
+ */
+class FrameMailbox {
+ private:
+  static constexpr unsigned int FRESH = 0x4;
+  static constexpr unsigned int INDEX_MASK = 0x3;
+ private:
+  std::array<cv::Mat, 3> buffers_;
+  std::atomic<unsigned int> middle_;
+  unsigned int back_;
+  unsigned int front_;
+  std::atomic<uint64_t> dropped_;
+ public:
+  /*!
+   * \brief コンストラクタ.黒で塗りつぶした画像を確保する
+   * \param size 画像サイズ
+   * \param type 画像の型
+   */
+  FrameMailbox(cv::Size size, int type)
+    : buffers_(), middle_(1), back_(0), front_(2), dropped_(0) {
+    for (auto& buffer : buffers_) { buffer = cv::Mat::zeros(size, type); }
+  }
+  /*!
+   * \brief コンストラクタ.確保済みの画像を使う
+   *
+   * DMA転送できる領域など、特定のメモリ上の画像を受け渡す場合に使う.
+   *
+   * \param buffers 同じサイズと型の画像
+   */
+  explicit FrameMailbox(const std::array<cv::Mat, 3>& buffers)
+    : buffers_(buffers), middle_(1), back_(0), front_(2), dropped_(0) {}
+ private:
+  FrameMailbox(const FrameMailbox&) = delete;
+  FrameMailbox& operator=(const FrameMailbox&) = delete;
+
+ public:
+  /*!
+   * \brief 書き込み側の画像を返す.publishするまで読み込み側からは見えない
+   * \return 画像
+   */
+  cv::Mat back() { return buffers_[back_]; }
+  /*!
+   * \brief 書き込み側の画像を渡す.読まれていない前の画像は捨てられる
+   */
+  void publish() {
+    const unsigned int old =
+      middle_.exchange(back_ | FRESH, std::memory_order_acq_rel);
+    if ((old & FRESH) != 0) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    back_ = old & INDEX_MASK;
+  }
+  /*!
+   * \brief 新しい画像が渡されていれば、読み込み側の画像と交換する
+   * \return 新しい画像を受け取った場合は真
+   */
+  bool fetch() {
+    if ((middle_.load(std::memory_order_relaxed) & FRESH) == 0)
+      { return false; }
+
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX_MASK;
+    return true;
+  }
+  /*!
+   * \brief 読み込み側の画像を返す.次のfetchまで書き換えられない
+   * \return 画像
+   */
+  cv::Mat front() { return buffers_[front_]; }
+  /*!
+   * \brief 読まれずに捨てられた画像の数を返す
+   * \return 画像の数
+   */
+  uint64_t dropped() const
+    { return dropped_.load(std::memory_order_relaxed); }
+};
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_FRAME_MAILBOX_H_
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_FRAME_QUEUE_H_
+#define FILTER_CORE_FRAME_QUEUE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+
+namespace filter_core {
+/*!
+ * \class BoundedQueue
+ * \brief スレッド間で要素を受け渡す容量固定のキュー
+ *
+ * 要素の格納領域は構築時に確保され、以降は確保されない.キューが満杯であ
+ * ればpushが、空であればpopがブロックする.closeされたキューへのpushは失
+ * 敗し、popは残った要素を取り出し終えると失敗する.
+ */
+template <typename T>
+class BoundedQueue {
+ private:
+  std::vector<T> ring_;
+  size_t head_;
+  size_t size_;
+  bool is_closed_;
+
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+
+ public:
+  /*!
+   * \brief コンストラクタ
+   * \param capacity 最大要素数
+   */
+  explicit BoundedQueue(size_t capacity)
+    : ring_(capacity), head_(0), size_(0), is_closed_(false) {}
+ private:
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+ public:
+  /*!
+   * \brief 要素を追加する.満杯である間はブロックする
+   * \param v 追加する要素
+   * \return 追加できた場合、真.closeされている場合、偽
+   */
+  bool push(T v) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock,
+                   [this] { return is_closed_ || size_ < ring_.size(); });
+    if (is_closed_) { return false; }
+
+    ring_[(head_ + size_) % ring_.size()] = std::move(v);
+    ++size_;
+    not_empty_.notify_one();
+
+    return true;
+  }
+  /*!
+   * \brief 要素を取り出す.空である間はブロックする
+   * \param v 取り出した要素の格納先
+   * \return 取り出せた場合、真.closeされ、かつ空である場合、偽
+   */
+  bool pop(T& v) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return is_closed_ || size_ > 0; });
+    if (size_ == 0) { return false; }
+
+    v = std::move(ring_[head_]);
+    head_ = (head_ + 1) % ring_.size();
+    --size_;
+    not_full_.notify_one();
+
+    return true;
+  }
+  /*!
+   * \brief 要素があれば取り出す.ブロックしない
+   * \param v 取り出した要素の格納先
+   * \return 取り出せた場合、真.空である場合、偽
+   */
+  bool try_pop(T& v) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (size_ == 0) { return false; }
+
+    v = std::move(ring_[head_]);
+    head_ = (head_ + 1) % ring_.size();
+    --size_;
+    not_full_.notify_one();
+
+    return true;
+  }
+  /*!
+   * \brief キューを閉じ、待機しているスレッドを起こす
+   */
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+};
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_FRAME_QUEUE_H_
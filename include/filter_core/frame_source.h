@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_FRAME_SOURCE_H_
+#define FILTER_CORE_FRAME_SOURCE_H_
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace filter_core {
+/*!
+ * \class FrameSource
+ * \brief Cameraへ画像を供給する入力のインターフェース
+ */
+class FrameSource {
+ public:
+  virtual ~FrameSource() {}
+ public:
+  /*!
+   * \brief 次の画像を読み込む
+   * \param frame 読み込み先
+   * \return 読み込めた場合は真.終端に達した場合や失敗した場合は偽
+   */
+  virtual bool read(cv::Mat& frame) = 0;
+  /*!
+   * \brief 入力を開けたかを返す
+   * \return 開けた場合は真
+   */
+  virtual bool isOpened() const = 0;
+  /*!
+   * \brief 記録された画像の毎秒のフレーム数を返す
+   * \return フレーム数.不明な場合は0
+   */
+  virtual double fps() const = 0;
+  /*!
+   * \brief カメラのように実時間で画像が得られる入力かを返す
+   * \return 実時間の入力であれば真
+   */
+  virtual bool isLive() const = 0;
+  /*!
+   * \brief 直前に読み込んだ画像の名前を返す
+   * \return ファイル名から拡張子を除いた名前.名前のない入力では空
+   */
+  virtual std::string name() const { return std::string(); }
+};
+
+/*!
+ * \class VideoSource
+ * \brief カメラ、または動画ファイルからの入力
+ */
+class VideoSource : public FrameSource {
+ private:
+  cv::VideoCapture capture_;
+  const bool is_live_;
+  const double fps_;
+ public:
+  /*!
+   * \brief カメラを開くコンストラクタ
+   * \param index カメラの番号
+   */
+  explicit VideoSource(int index)
+    : capture_(index), is_live_(true), fps_(0.0) {}
+  /*!
+   * \brief 動画ファイルを開くコンストラクタ
+   * \param filename ファイル名.OpenCVが解釈する連番の書式も指定できる
+   */
+  explicit VideoSource(const std::string& filename)
+    : capture_(filename), is_live_(false),
+      fps_(std::max(capture_.get(CV_CAP_PROP_FPS), 0.0)) {}
+ public:
+  bool read(cv::Mat& frame) { return capture_.read(frame); }
+  bool isOpened() const { return capture_.isOpened(); }
+  double fps() const { return fps_; }
+  bool isLive() const { return is_live_; }
+};
+
+/*!
+ * \class ImageSequenceSource
+ * \brief パターンに一致する画像ファイルを名前順に読み込む入力
+ */
+class ImageSequenceSource : public FrameSource {
+ private:
+  std::vector<cv::String> filenames_;
+  size_t next_;
+  std::string name_;
+  const double fps_;
+ public:
+  ImageSequenceSource(const std::string& pattern, double fps);
+ public:
+  bool read(cv::Mat& frame);
+  bool isOpened() const { return !filenames_.empty(); }
+  double fps() const { return fps_; }
+  bool isLive() const { return false; }
+  std::string name() const { return name_; }
+};
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+std::unique_ptr<filter_core::FrameSource> MakeSource(const std::string& input);
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_FRAME_SOURCE_H_
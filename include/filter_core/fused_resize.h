@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_FUSED_RESIZE_H_
+#define FILTER_CORE_FUSED_RESIZE_H_
+
+#include "filter_core/worker_pool.h"
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace filter_core {
+namespace fused_resize {
+/*!
+ * \class Tap
+ * \brief 出力の1列(1行)が参照する入力の2列(2行)と、11ビット固定小数点の重み
+ */
+class Tap {
+ public:
+  int offset[2];
+  int weight[2];
+};
+}  // namespace fused_resize
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \class FusedResizer
+ * \brief BGR画像の縮小を1回の走査で行う.グレースケール変換も同時に行える
+ *
+ * 出力の各行が参照する入力の行だけを読み、グレースケールへ変換する場合は
+ * その場で変換して縮小する.cvtColorとresizeを続けて呼ぶ場合と異なり、入
+ * 力全体のグレースケール画像を経由しない.補間は最近傍と線形のみで、結果
+ * はcvtColorとresizeの場合と最大1しか違わない.
+ *
+ * 出力を行の帯に分け、WorkerPoolで並列に処理することもできる.帯の高さは
+ * 参照する入力がキャッシュに収まるように決める.参照表は入力のサイズが変
+ * わった場合に作り直す.
+ */
+class FusedResizer {
+ private:
+  using Tap = filter_core::fused_resize::Tap;
+  /*!
+   * \class Scratch
+   * \brief 1スレッドが使う作業領域.入力1行のグレースケールと、横方向に補
+   *        間した最近の2行
+   */
+  class Scratch {
+   public:
+    std::vector<uint8_t> gray;
+    std::vector<int> interpolated[2];
+    int interpolated_row[2];
+  };
+ private:
+  const cv::Size size_;
+  const int interpolation_;
+  const bool is_gray_;
+  const int channels_;
+  cv::Size src_size_;
+  std::vector<Tap> columns_;
+  std::vector<Tap> rows_;
+  std::vector<Scratch> scratches_;
+ public:
+  FusedResizer(cv::Size size, int interpolation, bool is_gray);
+ private:
+  FusedResizer(const FusedResizer&) = delete;
+  FusedResizer& operator=(const FusedResizer&) = delete;
+
+ public:
+  void resize(cv::Mat src, cv::Mat dst);
+  void resize(cv::Mat src, cv::Mat dst, filter_core::WorkerPool& pool);
+ private:
+  void prepare(cv::Size src_size, size_t scratch_count);
+  int getBandHeight(cv::Mat src, size_t thread_count) const;
+  void resize(cv::Mat src, cv::Mat dst, int begin, int end,
+              Scratch& scratch) const;
+  const uint8_t* load(cv::Mat src, int y, Scratch& scratch) const;
+  const int* interpolate(cv::Mat src, int y, const int* keep,
+                         Scratch& scratch) const;
+};
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+bool CanFuseResize(cv::Mat src, cv::Size size, int interpolation);
+void ConvertGrayRow(const uint8_t* src, uint8_t* dst, int width);
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_FUSED_RESIZE_H_
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_HANDSHAKE_H_
+#define FILTER_CORE_HANDSHAKE_H_
+
+#include "filter_core/finish_waiter.h"
+#include "filter_core/fpga_communicator.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+
+namespace filter_core {
+/*!
+ * \class Handshake
+ * \brief FPGAの起動(refresh、enable)と完了待ち(finish)の手順
+ *
+ * refresh信号は、応答を使う場合はREFRESH_ACK_REGで完了を確認し、使わない
+ * 場合は従来通り一定時間待つ.応答が返らないビットストリームでは、最初の
+ * タイムアウトの後は一定時間待つ方法に切り替える.
+ */
+class Handshake {
+ private:
+  filter_core::FinishWaiter finish_waiter_;
+  const filter_core::WaitStrategy strategy_;
+  std::atomic<bool> is_acknowledged_;
+
+  mutable std::mutex mutex_;
+  filter_core::WaitStatistics refresh_statistics_;
+ public:
+  Handshake(filter_core::WaitStrategy strategy,
+            std::chrono::microseconds timeout,
+            bool is_acknowledged);
+ private:
+  Handshake(const Handshake&) = delete;
+  Handshake& operator=(const Handshake&) = delete;
+
+ public:
+  void start(filter_core::FPGACommunicator& com);
+  void stop(filter_core::FPGACommunicator& com);
+ public:
+  /*!
+   * \brief refresh信号の応答を使っているかを返す
+   * \return 使っている場合は真
+   */
+  bool is_acknowledged() const { return is_acknowledged_.load(); }
+  filter_core::WaitStatistics refresh_statistics() const;
+  /*!
+   * \brief finish信号の待ち時間の統計を返す
+   * \return 統計
+   */
+  filter_core::WaitStatistics finish_statistics() const
+    { return finish_waiter_.statistics(); }
+
+ private:
+  void refresh(filter_core::FPGACommunicator& com);
+};
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_HANDSHAKE_H_
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_IMAGE_WRITER_H_
+#define FILTER_CORE_IMAGE_WRITER_H_
+
+#include "filter_core/frame_queue.h"
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace filter_core {
+/*!
+ * \class ImageWriter
+ * \brief 画像を複数のスレッドで符号化し、ファイルへ書き込む
+ *
+ * writeは画像を構築時に確保した領域へ複製して直ちに戻る.全ての領域が書
+ * き込み待ちである間はブロックする.try_writeはブロックせず、その画像を捨
+ * てる.
+ *
+ * 符号化を置き換えることもできる.スレッドが1つの場合、画像は依頼した順
+ * に符号化される.
+ */
+class ImageWriter {
+ public:
+  /*!
+   * \brief 符号化.画像とファイル名を受け取り、失敗した場合は例外を送出する
+   */
+  using encoder_t = std::function<void (const cv::Mat&, const std::string&)>;
+ private:
+  using job_type = std::pair<size_t, std::string>;
+ private:
+  std::vector<cv::Mat> slots_;
+  filter_core::BoundedQueue<size_t> free_;
+  filter_core::BoundedQueue<job_type> jobs_;
+  encoder_t encoder_;
+  std::atomic<uint64_t> written_;
+  std::atomic<uint64_t> skipped_;
+
+  std::mutex error_mutex_;
+  std::exception_ptr error_;
+  std::vector<std::thread> threads_;
+
+ public:
+  ImageWriter(size_t thread_count, size_t depth, cv::Size size, int type,
+              const std::vector<int>& parameters = std::vector<int>());
+  ImageWriter(size_t thread_count, size_t depth, cv::Size size, int type,
+              encoder_t encoder);
+  ~ImageWriter();
+ private:
+  ImageWriter(const ImageWriter&) = delete;
+  ImageWriter& operator=(const ImageWriter&) = delete;
+
+ public:
+  void write(cv::Mat image, const std::string& filename);
+  bool try_write(cv::Mat image, const std::string& filename);
+  void close();
+  /*!
+   * \brief 書き込み終えた画像の数を返す
+   * \return 画像の数
+   */
+  uint64_t written() const { return written_.load(); }
+  /*!
+   * \brief 領域が空いていないためtry_writeで捨てた画像の数を返す
+   * \return 画像の数
+   */
+  uint64_t skipped() const { return skipped_.load(); }
+ private:
+  void run();
+  void enqueue(size_t slot, cv::Mat image, const std::string& filename);
+  void rethrow();
+};
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_IMAGE_WRITER_H_
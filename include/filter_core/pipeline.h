@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_PIPELINE_H_
+#define FILTER_CORE_PIPELINE_H_
+
+#include "filter_core/frame_queue.h"
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace filter_core {
+/*!
+ * \enum Dispatch
+ * \brief 複数のFPGA転送ステージへのフレームの割り当て方
+ */
+enum class Dispatch {
+  ROUND_ROBIN,    //!< 順番に割り当てる
+  LEAST_LOADED    //!< 処理待ちのフレームが最も少ないステージへ割り当てる
+};
+
+/*!
+ * \class Frame
+ * \brief パイプラインを流れるフレーム
+ *
+ * 入力画像と出力画像の領域はパイプラインの構築時に確保され、フレームは
+ * 各ステージの間を巡回して再利用される.
+ */
+class Frame {
+ public:
+  cv::Mat src;
+  cv::Mat dst;
+  uint64_t index;
+  size_t lane;    //!< フレームを処理するFPGA転送ステージ
+ public:
+  Frame(cv::Mat src, cv::Mat dst) : src(src), dst(dst), index(0), lane(0) {}
+};
+
+/*!
+ * \class Pipeline
+ * \brief キャプチャ、FPGA転送、出力の3ステージのパイプライン
+ *
+ * キャプチャとFPGA転送はそれぞれ専用のスレッドで、出力はrunを呼び出した
+ * スレッドで実行される.ステージ間は容量固定のキューで接続されるため、スルー
+ * プットは最も遅いステージで決まる.
+ *
+ * FPGA転送ステージは複数のボードに対応する複数のレーンに分けられる.各レー
+ * ンは自身のフレームと専用のスレッドを持ち、キャプチャしたフレームはいず
+ * れかのレーンへ割り当てられる.出力ステージはフレームをキャプチャした順
+ * に並べ直して受け取る.
+ *
+ * FPGA転送ステージは結果を遅らせてもよい.偽を返したフレームは空きフレー
+ * ムへ戻し、その番号は次に結果を書き込んだフレームが引き継ぐ.キャプチャ
+ * が終端に達すると、残った結果を終了ステージで取り出す.結果を遅らせる
+ * ステージは入力画像を別の画像と入れ替えてよく、フレームはその画像を引き
+ * 継ぐ.
+ */
+class Pipeline {
+ public:
+  /*!
+   * \brief キャプチャステージ.入力画像を書き込み、終端に達したら偽を返す
+   */
+  using capture_t = std::function<bool (cv::Mat)>;
+  /*!
+   * \brief FPGA転送ステージ.入力画像をフィルタし、出力画像へ書き込む.
+   *        結果を遅らせ、まだ書き込んでいない場合は偽を返す
+   */
+  using filter_t = std::function<bool (cv::Mat, cv::Mat)>;
+  /*!
+   * \brief 複数のレーンのFPGA転送ステージ.レーンの番号も受け取る.入力画
+   *        像を入れ替えてもよい
+   */
+  using lane_filter_t = std::function<bool (size_t, cv::Mat&, cv::Mat)>;
+  /*!
+   * \brief 出力ステージ.入力画像と出力画像を受け取り、停止する場合は偽を返す
+   */
+  using output_t = std::function<bool (cv::Mat, cv::Mat)>;
+
+ private:
+  /*!
+   * \class Lane
+   * \brief 1つのFPGA転送ステージの空きフレームと処理待ちのフレーム
+   */
+  class Lane {
+   public:
+    filter_core::BoundedQueue<filter_core::Frame*> free;
+    filter_core::BoundedQueue<filter_core::Frame*> captured;
+    size_t depth;                     //!< フレームの数
+    std::atomic<size_t> taken;        //!< 空きフレームへ戻っていない数
+    std::atomic<size_t> in_flight;    //!< 割り当てられ、フィルタしていない数
+    std::atomic<uint64_t> filtered;   //!< フィルタしたフレームの数
+    std::deque<uint64_t> held;        //!< 結果を待っているフレームの番号
+    std::atomic<size_t> holding;      //!< heldの要素の数
+   public:
+    explicit Lane(size_t depth)
+      : free(depth),
+        captured(depth),
+        depth(0),
+        taken(0),
+        in_flight(0),
+        filtered(0),
+        held(),
+        holding(0) {}
+  };
+
+ private:
+  std::vector<filter_core::Frame> frames_;
+  std::vector<std::unique_ptr<Lane>> lanes_;
+  const filter_core::Dispatch dispatch_;
+  filter_core::BoundedQueue<filter_core::Frame*> filtered_;
+  std::mutex free_mutex_;
+  std::condition_variable free_returned_;   //!< 空きフレームが戻った
+  bool is_closed_;
+
+ public:
+  Pipeline(size_t depth, cv::Size size, int type);
+  explicit Pipeline(std::vector<filter_core::Frame>&& frames);
+  Pipeline(std::vector<std::vector<filter_core::Frame>>&& lanes,
+           filter_core::Dispatch dispatch);
+ private:
+  Pipeline(const Pipeline&) = delete;
+  Pipeline& operator=(const Pipeline&) = delete;
+
+ public:
+  void run(capture_t capture, filter_t filter, output_t output);
+  void run(capture_t capture, lane_filter_t filter, output_t output);
+  void run(capture_t capture, lane_filter_t filter, lane_filter_t finish,
+           output_t output);
+  std::vector<uint64_t> filtered() const;
+
+ private:
+  void add_lane(std::vector<filter_core::Frame>&& frames);
+  size_t select(uint64_t index);
+  size_t choose(uint64_t index) const;
+  void release(Lane& lane, filter_core::Frame* frame);
+  void close();
+};
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+std::string ToString(filter_core::Dispatch dispatch);
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_PIPELINE_H_
@@ -7,9 +7,17 @@
 #ifndef FILTER_CORE_PROGRAM_OPTIONS_H_
 #define FILTER_CORE_PROGRAM_OPTIONS_H_
 
+#include "filter_core/compose.h"
+#include "filter_core/finish_waiter.h"
+#include "filter_core/fpga_communicator.h"
+#include "filter_core/pipeline.h"
+#include "filter_core/reference_filter.h"
+
 #include <boost/optional.hpp>
 #include <opencv2/opencv.hpp>
+#include <chrono>
 #include <string>
+#include <vector>
 
 
 namespace filter_core {
@@ -37,12 +45,47 @@ class ImageOptions {
 
   const uint32_t total_size;
   const uint32_t width;
-  const cv::Size combined_image_size;
 
  ImageOptions(cv::Size size, int type, int interpolation, int step)
    : size(size), step(step), type(type), interpolation(interpolation),
-     total_size(size.area()), width(size.width),
-     combined_image_size(size.width * 2, size.height) {}
+     total_size(size.area()), width(size.width) {}
+};
+
+/*!
+ * \class EmulatorOptions
+ * \brief エミュレータの設定
+ */
+class EmulatorOptions {
+ public:
+  const filter_core::ReferenceFilter filter;
+  const std::chrono::microseconds latency;
+  const double bandwidth;   //!< DMA転送の帯域(バイト/秒).0は無制限
+
+ EmulatorOptions(filter_core::ReferenceFilter filter,
+                 std::chrono::microseconds latency,
+                 double bandwidth)
+   : filter(filter), latency(latency), bandwidth(bandwidth) {}
+};
+
+/*!
+ * \class RecordOptions
+ * \brief スナップショットと録画の設定
+ */
+class RecordOptions {
+ public:
+  const std::string image_format;   //!< 画像ファイルの拡張子
+  const int compression;            //!< PNGの圧縮レベルかJPEGの品質.-1は既定値
+  const std::string path;           //!< 録画先.空の場合は録画しない
+  const std::string fourcc;         //!< 動画の符号化方式
+  const double fps;                 //!< 動画のフレームレート
+
+ RecordOptions(const std::string& image_format,
+               int compression,
+               const std::string& path,
+               const std::string& fourcc,
+               double fps)
+   : image_format(image_format), compression(compression), path(path),
+     fourcc(fourcc), fps(fps) {}
 };
 
 /*!
@@ -56,29 +99,114 @@ class Options {
   const double frequency;
   const bool is_colored;
   const filter_core::ImageOptions image_options;
-  const bool is_with_captured;
+  const filter_core::ComposeLayout compose_layout;
   const bool is_debug_mode;
+  const size_t pipeline_depth;
+  const bool is_ping_pong;
+  const bool is_emulated;
+  const filter_core::EmulatorOptions emulator_options;
+  const filter_core::WaitStrategy wait_strategy;
+  const std::chrono::milliseconds wait_timeout;
+  const filter_core::ColorLayout color_layout;
+  const bool is_refresh_acknowledged;
+  const cv::Size roi_size;
+  const boost::optional<cv::Point> roi_origin;
+  const std::string trace_filename;   //!< 空の場合はタイムラインを出力しない
+  const size_t trace_capacity;
+  const std::vector<std::string> inputs;   //!< 複数の場合は縦に詰めて処理する
+  const size_t prefetch_depth;
+  const bool is_paced;
+  const std::string batch_directory;  //!< 空の場合はバッチ処理しない
+  const size_t encoder_count;
+  const double display_fps;           //!< 0の場合は表示の頻度を制限しない
+  const size_t convert_thread_count;
+  const bool is_convert_pinned;
+  const filter_core::RecordOptions record_options;
+  const size_t board_count;
+  const filter_core::Dispatch dispatch;
+  //! 無効値の場合はFPGAだけでフィルタする
+  const boost::optional<filter_core::ReferenceFilter> hybrid_filter;
+  const size_t hybrid_thread_count;
+  const size_t pass_count;
+  const size_t history_length;        //!< 0の場合は過去のフレームを残さない
  public:
   Options(const std::string& filename,
           const std::string& output_directory,
           double frequency,
           bool is_colored,
           filter_core::ImageOptions&& image_options,
-          bool is_with_captured,
-          bool is_debug_mode)
+          filter_core::ComposeLayout compose_layout,
+          bool is_debug_mode,
+          size_t pipeline_depth,
+          bool is_ping_pong,
+          bool is_emulated,
+          filter_core::EmulatorOptions&& emulator_options,
+          filter_core::WaitStrategy wait_strategy,
+          std::chrono::milliseconds wait_timeout,
+          filter_core::ColorLayout color_layout,
+          bool is_refresh_acknowledged,
+          cv::Size roi_size,
+          boost::optional<cv::Point> roi_origin,
+          const std::string& trace_filename,
+          size_t trace_capacity,
+          const std::vector<std::string>& inputs,
+          size_t prefetch_depth,
+          bool is_paced,
+          const std::string& batch_directory,
+          size_t encoder_count,
+          double display_fps,
+          size_t convert_thread_count,
+          bool is_convert_pinned,
+          filter_core::RecordOptions&& record_options,
+          size_t board_count,
+          filter_core::Dispatch dispatch,
+          boost::optional<filter_core::ReferenceFilter> hybrid_filter,
+          size_t hybrid_thread_count,
+          size_t pass_count,
+          size_t history_length)
     : filename(filename),
       output_directory(output_directory),
       frequency(frequency),
       is_colored(is_colored),
       image_options(image_options),
-      is_with_captured(is_with_captured),
-      is_debug_mode(is_debug_mode) {}
+      compose_layout(compose_layout),
+      is_debug_mode(is_debug_mode),
+      pipeline_depth(pipeline_depth),
+      is_ping_pong(is_ping_pong),
+      is_emulated(is_emulated),
+      emulator_options(emulator_options),
+      wait_strategy(wait_strategy),
+      wait_timeout(wait_timeout),
+      color_layout(color_layout),
+      is_refresh_acknowledged(is_refresh_acknowledged),
+      roi_size(roi_size),
+      roi_origin(roi_origin),
+      trace_filename(trace_filename),
+      trace_capacity(trace_capacity),
+      inputs(inputs),
+      prefetch_depth(prefetch_depth),
+      is_paced(is_paced),
+      batch_directory(batch_directory),
+      encoder_count(encoder_count),
+      display_fps(display_fps),
+      convert_thread_count(convert_thread_count),
+      is_convert_pinned(is_convert_pinned),
+      record_options(record_options),
+      board_count(board_count),
+      dispatch(dispatch),
+      hybrid_filter(hybrid_filter),
+      hybrid_thread_count(hybrid_thread_count),
+      pass_count(pass_count),
+      history_length(history_length) {}
 };
 }  // namespace filter_core
 
 namespace filter_core {
 
 boost::optional<filter_core::Options> GetOptions(int argc, char** argv) noexcept;
+cv::Size GetImageSize(const std::string& size);
+filter_core::ColorLayout GetColorLayout(const std::string& layout);
+filter_core::WaitStrategy GetWaitStrategy(const std::string& s);
 void ShowOptions(const filter_core::Options& options);
 }  // namespace filter_core
 #endif
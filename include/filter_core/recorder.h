@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_RECORDER_H_
+#define FILTER_CORE_RECORDER_H_
+
+#include "filter_core/image_writer.h"
+#include "filter_core/program_options.h"
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace filter_core {
+/*!
+ * \class Recorder
+ * \brief 表示する画像のスナップショットと録画を、別のスレッドで書き込む
+ *
+ * 画像は構築時に確保した領域へ複製され、符号化と書き込みは呼び出し元を待
+ * たせない.録画は全ての領域が書き込み待ちであればその画像を捨て、処理の
+ * フレームレートを落とさない.スナップショットは表示するスレッドから、録
+ * 画は処理するスレッドから呼び出す.
+ */
+class Recorder {
+ private:
+  const std::string directory_;
+  const std::string image_format_;
+  std::unique_ptr<filter_core::ImageWriter> snapshots_;
+  std::unique_ptr<filter_core::ImageWriter> recording_;
+  std::string recording_directory_;   //!< 空の場合は動画へ録画する
+  std::atomic<bool> is_recording_;
+  uint64_t recorded_;
+ public:
+  Recorder(const filter_core::RecordOptions& options,
+           const std::string& directory,
+           cv::Size size, int type, size_t thread_count);
+ private:
+  Recorder(const Recorder&) = delete;
+  Recorder& operator=(const Recorder&) = delete;
+
+ public:
+  void snapshot(cv::Mat image);
+  void record(cv::Mat image);
+  bool toggle();
+  /*!
+   * \brief 録画先があるかを返す
+   * \return 録画先がある場合は真
+   */
+  bool is_recordable() const { return static_cast<bool>(recording_); }
+  void close();
+  std::string report() const;
+};
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+std::vector<int> GetImageParameters(const std::string& format,
+                                    int compression);
+bool IsVideoFile(const std::string& path);
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_RECORDER_H_
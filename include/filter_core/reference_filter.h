@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_REFERENCE_FILTER_H_
+#define FILTER_CORE_REFERENCE_FILTER_H_
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+
+namespace filter_core {
+/*!
+ * \enum ReferenceFilter
+ * \brief CPUで実行する参照用のフィルタ
+ *
+ * 3x3のフィルタは画像の端の画素を複製して外側を補う.DIFFERENCEだけは前
+ * 回のフレームを使う時間方向のフィルタ.
+ */
+enum class ReferenceFilter {
+  COPY,       //!< そのまま出力する
+  INVERT,     //!< 階調を反転する
+  BLUR,       //!< 3x3の平均
+  SOBEL,      //!< 3x3のSobelフィルタの水平、垂直方向の絶対値の和
+  DIFFERENCE  //!< 前回のフレームとの差の絶対値.前回がなければ0
+};
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+void ApplyReferenceFilter(filter_core::ReferenceFilter filter,
+                          cv::Mat src, cv::Mat dst);
+void ApplyReferenceFilter(filter_core::ReferenceFilter filter,
+                          cv::Mat src, cv::Mat dst, cv::Range rows);
+void ApplyTemporalReferenceFilter(filter_core::ReferenceFilter filter,
+                                  cv::Mat current, cv::Mat previous,
+                                  cv::Mat dst);
+filter_core::ReferenceFilter GetReferenceFilter(const std::string& name);
+std::string ToString(filter_core::ReferenceFilter filter);
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_REFERENCE_FILTER_H_
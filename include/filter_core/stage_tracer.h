@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_STAGE_TRACER_H_
+#define FILTER_CORE_STAGE_TRACER_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+namespace filter_core {
+/*!
+ * \enum Stage
+ * \brief 1フレームの処理の段階
+ */
+enum class Stage : uint8_t {
+  CAPTURE,      //!< カメラからの取得(Camera::get)
+  CONVERT,      //!< グレースケール変換とリサイズ(Converter::convert)
+  DMA_WRITE,    //!< FPGAボードへのDMA転送
+  REFRESH,      //!< refresh信号
+  FINISH_WAIT,  //!< finish信号の待ち
+  DMA_READ,     //!< FPGAボードからのDMA転送
+  CPU_FILTER,   //!< CPUでのフィルタ(ハイブリッド実行)
+  COMPOSE,      //!< 表示する画像の合成
+  DISPLAY,      //!< 画像の表示(imshow)
+  FRAME         //!< 前のフレームの出力からの経過時間
+};
+
+/*!
+ * \var STAGE_COUNT
+ * 段階の数
+ */
+constexpr size_t STAGE_COUNT = static_cast<size_t>(Stage::FRAME) + 1;
+
+/*!
+ * \class StageRing
+ * \brief 1つのスレッドが記録する所要時間のリングバッファ
+ *
+ * 書き込みは所有するスレッドだけが行い、ロックを取らない.満杯になると古い
+ * 記録から上書きする.段階と所要時間は1語に詰めて格納するため、読み込み側
+ * が書き込み途中の記録を読むことはない.
+ */
+class StageRing {
+ public:
+  static constexpr size_t CAPACITY = 4096;
+ private:
+  static constexpr unsigned int STAGE_SHIFT = 56;
+  static constexpr uint64_t DURATION_MASK = (1ULL << STAGE_SHIFT) - 1;
+ private:
+  std::array<std::atomic<uint64_t>, CAPACITY> samples_;
+  std::atomic<uint64_t> head_;
+ public:
+  StageRing();
+ private:
+  StageRing(const StageRing&) = delete;
+  StageRing& operator=(const StageRing&) = delete;
+
+ public:
+  /*!
+   * \brief 所要時間を記録する
+   * \param stage 段階
+   * \param nanoseconds 所要時間(ナノ秒)
+   */
+  void push(filter_core::Stage stage, uint64_t nanoseconds) noexcept {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    samples_[head % CAPACITY].store(
+        (static_cast<uint64_t>(stage) << STAGE_SHIFT) |
+          (nanoseconds & DURATION_MASK),
+        std::memory_order_relaxed);
+    head_.store(head + 1, std::memory_order_release);
+  }
+  void collect(
+      std::array<std::vector<uint64_t>, filter_core::STAGE_COUNT>& samples)
+    const;
+  /*!
+   * \brief 記録を全て捨てる.所有するスレッドが記録していない間に呼ぶこと
+   */
+  void clear() noexcept { head_.store(0, std::memory_order_release); }
+};
+
+/*!
+ * \class StageSummary
+ * \brief 1つの段階の所要時間の分布
+ */
+class StageSummary {
+ public:
+  using duration_type = std::chrono::nanoseconds;
+ public:
+  uint64_t count;
+  duration_type p50;
+  duration_type p95;
+  duration_type p99;
+  duration_type max;
+ public:
+  StageSummary()
+    : count(0),
+      p50(duration_type::zero()), p95(duration_type::zero()),
+      p99(duration_type::zero()), max(duration_type::zero()) {}
+};
+
+using StageReport = std::array<filter_core::StageSummary,
+                               filter_core::STAGE_COUNT>;
+
+/*!
+ * \class StageTracer
+ * \brief 段階毎の所要時間を記録し、分布を求める
+ *
+ * スレッド毎にStageRingを持ち、記録はロックを取らずに行う.分布は各スレッ
+ * ドの直近StageRing::CAPACITY件の記録から求める.Timelineが有効であれば、
+ * 同じ区間をTimelineへも記録する.プロセスに1つだけ存在する.
+ */
+class StageTracer {
+ public:
+  using clock_type = std::chrono::steady_clock;
+ private:
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<filter_core::StageRing>> rings_;
+ private:
+  StageTracer() : mutex_(), rings_() {}
+  StageTracer(const StageTracer&) = delete;
+  StageTracer& operator=(const StageTracer&) = delete;
+
+ public:
+  static StageTracer& instance();
+ public:
+  void record(filter_core::Stage stage,
+              clock_type::time_point start,
+              clock_type::time_point end) noexcept;
+  /*!
+   * \brief 開始時刻から現在までの時間を記録する
+   * \param stage 段階
+   * \param start 開始時刻
+   */
+  void record(filter_core::Stage stage, clock_type::time_point start) noexcept
+    { record(stage, start, clock_type::now()); }
+  filter_core::StageReport report() const;
+  void clear();
+ private:
+  filter_core::StageRing& ring();
+};
+
+/*!
+ * \class ScopedStage
+ * \brief 構築から破棄までの時間を段階の所要時間として記録する
+ */
+class ScopedStage {
+ private:
+  const filter_core::Stage stage_;
+  const filter_core::StageTracer::clock_type::time_point start_;
+ public:
+  explicit ScopedStage(filter_core::Stage stage)
+    : stage_(stage), start_(filter_core::StageTracer::clock_type::now()) {}
+  ~ScopedStage() { StageTracer::instance().record(stage_, start_); }
+ private:
+  ScopedStage(const ScopedStage&) = delete;
+  ScopedStage& operator=(const ScopedStage&) = delete;
+};
+
+/*!
+ * \class FrameMeter
+ * \brief フレームの出力間隔を計測し、Stage::FRAMEとして記録する
+ */
+class FrameMeter {
+ public:
+  using clock_type = filter_core::StageTracer::clock_type;
+ private:
+  clock_type::time_point previous_;
+ public:
+  FrameMeter() : previous_(clock_type::now()) {}
+ public:
+  clock_type::duration tick();
+};
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+filter_core::StageSummary Summarize(std::vector<uint64_t>& samples);
+void ShowFramerate(std::chrono::steady_clock::duration interval);
+std::ostream& operator<<(std::ostream& os,
+                         const filter_core::StageReport& report);
+const char* GetName(filter_core::Stage stage) noexcept;
+std::string ToString(filter_core::Stage stage);
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_STAGE_TRACER_H_
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_STREAM_SET_H_
+#define FILTER_CORE_STREAM_SET_H_
+
+#include "filter_core/camera.h"
+#include "filter_core/worker_pool.h"
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace filter_core {
+
+// 隣り合う入力の帯の間に、それぞれの帯の端を複製して置く行数.フィルタの
+// カーネル半径と同じにすると、窓が隣の入力の画素を含まない
+constexpr int STREAM_GUARD_ROWS = 1;
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \class StreamSet
+ * \brief 複数の入力を並行に取り込み、1枚の画像へ詰める
+ *
+ * 各入力の画像は同じ大きさで、i番目の入力は詰めた画像のi番目の行の帯へ
+ * 書き込まれる.帯は全幅のため連続している.FPGAは詰めた画像を1枚の画像
+ * として1回の起動でフィルタする.
+ *
+ * 帯の間には、上の帯の最後の行と下の帯の最初の行をSTREAM_GUARD_ROWS行ず
+ * つ複製して置く.帯の境界の行は、1つの入力だけを撮った場合と同じ結果に
+ * なる.
+ *
+ * いずれかの入力が終端に達した時点で、全体の終端とする.
+ */
+class StreamSet {
+ private:
+  std::vector<std::unique_ptr<filter_core::Camera>> cameras_;
+  // 入力が1つの場合はnullptr
+  std::unique_ptr<filter_core::WorkerPool> pool_;
+  std::vector<char> is_ready_;
+ public:
+  explicit StreamSet(
+      std::vector<std::unique_ptr<filter_core::Camera>>&& cameras);
+ private:
+  StreamSet(const StreamSet&) = delete;
+  StreamSet& operator=(const StreamSet&) = delete;
+
+ public:
+  bool isReady();
+  void get(cv::Mat packed);
+  /*!
+   * \brief 入力の数を返す
+   * \return 入力の数
+   */
+  size_t size() const { return cameras_.size(); }
+  /*!
+   * \brief 入力が直前に取得した画像の名前を返す
+   * \param i 入力の番号
+   * \return 名前.名前のない入力では空
+   */
+  const std::string& name(size_t i) const { return cameras_[i]->name(); }
+};
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+cv::Size GetPackedSize(cv::Size stream, size_t count);
+cv::Size GetStreamSize(cv::Size packed, size_t count);
+std::vector<cv::Mat> SplitStreams(cv::Mat packed, size_t count);
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_STREAM_SET_H_
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_TIMELINE_H_
+#define FILTER_CORE_TIMELINE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+namespace filter_core {
+/*!
+ * \class TimelineEvent
+ * \brief タイムライン上の区間
+ *
+ * 名前と引数名は文字列リテラルを指す.
+ */
+class TimelineEvent {
+ public:
+  const char* name;
+  const char* arg_name;   //!< 引数がない場合はnullptr
+  uint64_t arg;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::duration duration;
+};
+
+/*!
+ * \class TimelineBuffer
+ * \brief 1つのスレッドが記録する区間のリングバッファ
+ *
+ * 書き込みは所有するスレッドだけが行い、ロックを取らない.満杯になると古い
+ * 区間から上書きする.
+ */
+class TimelineBuffer {
+ private:
+  std::vector<filter_core::TimelineEvent> events_;
+  std::atomic<uint64_t> head_;
+  const uint32_t thread_id_;
+  std::atomic<const char*> thread_name_;
+ public:
+  TimelineBuffer(size_t capacity, uint32_t thread_id)
+    : events_(capacity), head_(0), thread_id_(thread_id),
+      thread_name_(nullptr) {}
+ private:
+  TimelineBuffer(const TimelineBuffer&) = delete;
+  TimelineBuffer& operator=(const TimelineBuffer&) = delete;
+
+ public:
+  /*!
+   * \brief 区間を記録する
+   * \param event 区間
+   */
+  void push(const filter_core::TimelineEvent& event) noexcept {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    events_[head % events_.size()] = event;
+    head_.store(head + 1, std::memory_order_release);
+  }
+  void name(const char* name) noexcept
+    { thread_name_.store(name, std::memory_order_relaxed); }
+  void write(std::ostream& os,
+             std::chrono::steady_clock::time_point origin,
+             bool& is_first) const;
+  /*!
+   * \brief 上書きされた区間の数を返す
+   * \return 上書きされた区間の数
+   */
+  uint64_t overwritten() const noexcept {
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    return (head > events_.size())? head - events_.size() : 0;
+  }
+};
+
+/*!
+ * \class Timeline
+ * \brief 各スレッドの処理の区間を記録し、Trace Event形式のJSONで出力する
+ *
+ * 出力はchrome://tracingやPerfettoで表示できる.enableを呼ぶまでは何も記録
+ * しない.スレッド毎にTimelineBufferを持ち、記録はロックを取らずに行う.
+ * writeは記録しているスレッドを止めてから呼ぶこと.プロセスに1つだけ存在
+ * する.
+ */
+class Timeline {
+ public:
+  using clock_type = std::chrono::steady_clock;
+ private:
+  std::atomic<bool> is_enabled_;
+  size_t capacity_;
+  clock_type::time_point origin_;
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<filter_core::TimelineBuffer>> buffers_;
+ private:
+  Timeline()
+    : is_enabled_(false), capacity_(0), origin_(), mutex_(), buffers_() {}
+  Timeline(const Timeline&) = delete;
+  Timeline& operator=(const Timeline&) = delete;
+
+ public:
+  static Timeline& instance();
+ public:
+  void enable(size_t capacity);
+  /*!
+   * \brief 記録しているかを返す
+   * \return 記録している場合は真
+   */
+  bool is_enabled() const noexcept
+    { return is_enabled_.load(std::memory_order_relaxed); }
+  /*!
+   * \brief 区間を記録する.記録していない場合は何もしない
+   * \param name 名前
+   * \param start 開始時刻
+   * \param end 終了時刻
+   * \param arg_name 引数名.引数がない場合はnullptr
+   * \param arg 引数
+   */
+  void add(const char* name,
+           clock_type::time_point start,
+           clock_type::time_point end,
+           const char* arg_name = nullptr,
+           uint64_t arg = 0) noexcept {
+    if (is_enabled()) {
+      buffer().push(TimelineEvent{name, arg_name, arg, start, end - start});
+    }
+  }
+  /*!
+   * \brief 呼び出したスレッドに名前を付ける.記録していない場合は何もしない
+   * \param name 名前
+   */
+  void name_thread(const char* name) noexcept
+    { if (is_enabled()) { buffer().name(name); } }
+  uint64_t write(std::ostream& os) const;
+ private:
+  filter_core::TimelineBuffer& buffer();
+};
+
+/*!
+ * \class ScopedSpan
+ * \brief 構築から破棄までを区間として記録する
+ */
+class ScopedSpan {
+ private:
+  const char* const name_;
+  const char* const arg_name_;
+  const uint64_t arg_;
+  const bool is_enabled_;
+  const filter_core::Timeline::clock_type::time_point start_;
+ public:
+  /*!
+   * \brief コンストラクタ.記録していない場合は時刻を取得しない
+   * \param name 名前
+   * \param arg_name 引数名.引数がない場合はnullptr
+   * \param arg 引数
+   */
+  explicit ScopedSpan(const char* name,
+                      const char* arg_name = nullptr,
+                      uint64_t arg = 0)
+    : name_(name),
+      arg_name_(arg_name),
+      arg_(arg),
+      is_enabled_(Timeline::instance().is_enabled()),
+      start_((is_enabled_)?
+               filter_core::Timeline::clock_type::now() :
+               filter_core::Timeline::clock_type::time_point()) {}
+  ~ScopedSpan() {
+    if (is_enabled_) {
+      Timeline::instance().add(
+          name_, start_, filter_core::Timeline::clock_type::now(),
+          arg_name_, arg_);
+    }
+  }
+ private:
+  ScopedSpan(const ScopedSpan&) = delete;
+  ScopedSpan& operator=(const ScopedSpan&) = delete;
+};
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+void WriteTimeline(const std::string& filename);
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_TIMELINE_H_
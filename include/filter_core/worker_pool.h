@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#ifndef FILTER_CORE_WORKER_POOL_H_
+#define FILTER_CORE_WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace filter_core {
+/*!
+ * \class WorkerPool
+ * \brief 1つの処理を小さなタスクに分けて複数のスレッドで実行する
+ *
+ * スレッドは構築時に起動し、破棄するまで待機し続ける.runを呼び出したス
+ * レッドもタスクを実行するため、並列度はスレッド数+1になる.タスクは実行
+ * し終えたスレッドから順に取るため、重さが揃っていなくても偏らない.
+ */
+class WorkerPool {
+ public:
+  /*!
+   * \brief タスク.タスクの番号と、実行するスレッドの番号(0はrunの呼び出し元)
+   *        を受け取る
+   */
+  using task_t = std::function<void (size_t, size_t)>;
+ private:
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable started_;
+  std::condition_variable finished_;
+  uint64_t generation_;
+  bool is_closed_;
+  size_t running_;
+
+  task_t task_;
+  size_t task_count_;
+  std::atomic<size_t> next_;
+  std::exception_ptr error_;
+
+ public:
+  WorkerPool(size_t thread_count, bool is_pinned);
+  ~WorkerPool();
+ private:
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+ public:
+  void run(size_t task_count, task_t task);
+  /*!
+   * \brief runの呼び出し元を含めたスレッド数を返す
+   * \return スレッド数
+   */
+  size_t size() const { return threads_.size() + 1; }
+ private:
+  void work(size_t worker);
+  void drain(size_t worker);
+};
+}  // namespace filter_core
+
+#endif  // FILTER_CORE_WORKER_POOL_H_
@@ -0,0 +1,511 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/admxrc2_device.h"
+#include "filter_core/camera.h"
+#include "filter_core/emulated_device.h"
+#include "filter_core/filter.h"
+#include "filter_core/finish_waiter.h"
+#include "filter_core/fpga_communicator.h"
+#include "filter_core/handshake.h"
+#include "filter_core/program_options.h"
+#include "filter_core/reference_filter.h"
+#include "filter_core/stage_tracer.h"
+#include "filter_core/worker_pool.h"
+
+#include <boost/program_options.hpp>
+#include <opencv2/opencv.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+using std::string;
+using std::vector;
+using std::chrono::duration_cast;
+using std::chrono::duration;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using boost::program_options::options_description;
+using boost::program_options::value;
+using boost::program_options::variables_map;
+
+
+namespace filter_core {
+namespace bench {
+/*!
+ * \class Case
+ * \brief 計測する条件の組み合わせ
+ */
+class Case {
+ public:
+  cv::Size size;
+  std::string layout_name;
+  filter_core::ColorLayout layout;
+  unsigned long chunk_size;
+  filter_core::WaitStrategy strategy;
+  size_t convert_threads;   //!< 0の場合は変換しない
+ public:
+  /*!
+   * \brief 1フレームのバイト数を返す
+   * \return バイト数
+   */
+  unsigned long length() const {
+    return size.area() * ((layout == ColorLayout::MONOCHROME)? 1 : 3);
+  }
+};
+
+/*!
+ * \class Result
+ * \brief 1つの条件の計測結果
+ */
+class Result {
+ public:
+  filter_core::bench::Case condition;
+  unsigned int frames;
+  std::chrono::nanoseconds elapsed;
+  filter_core::StageSummary total;
+  filter_core::StageSummary convert;
+  filter_core::StageSummary upload;
+  filter_core::StageSummary filter;
+  filter_core::StageSummary readback;
+  filter_core::TransferStatistics transfers;
+ public:
+  double fps() const;
+  double megabytes_per_second() const;
+};
+
+boost::program_options::options_description GetDescription();
+std::shared_ptr<filter_core::Device> MakeDevice(
+    const boost::program_options::variables_map& vm);
+std::vector<std::string> Split(const std::string& s);
+filter_core::ColorLayout GetColorLayout(const std::string& color);
+std::vector<filter_core::bench::Case> GetCases(
+    const boost::program_options::variables_map& vm);
+filter_core::bench::Result Run(std::shared_ptr<filter_core::Device> device,
+                               const filter_core::bench::Case& condition,
+                               cv::Mat camera_frame,
+                               bool is_pinned,
+                               unsigned int frames,
+                               unsigned int warmup);
+double GetConvertSpeedup(const std::vector<filter_core::bench::Result>& results,
+                         const filter_core::bench::Result& result);
+void WriteCsv(std::ostream& os,
+              const std::vector<filter_core::bench::Result>& results);
+void WriteJson(std::ostream& os,
+               const std::vector<filter_core::bench::Result>& results);
+}  // namespace bench
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace bench {
+
+options_description GetDescription() {
+  options_description description;
+  description.add_options()
+    ("help,h", "show this")
+    ("filename,i", value<string>(),
+     "bit filename. the emulator is used if omitted")
+    ("frequency", value<double>()->default_value(40.0),
+     "set circuit operating frequency")
+    ("image-size", value<string>()->default_value(string("small,middle,large")),
+     "comma separated image sizes: small, middle, large or WxH")
+    ("color", value<string>()->default_value(string("grey")),
+     "comma separated layouts: grey, planar or interleaved")
+    ("chunk", value<string>()->default_value(string("2048")),
+     "comma separated maximum DMA chunk sizes in KiB")
+    ("wait", value<string>()->default_value(string("adaptive")),
+     "comma separated wait strategies: adaptive, spin, sleep or interrupt")
+    ("convert-threads", value<string>(),
+     "comma separated numbers of threads converting a camera frame before "
+     "each upload. no conversion if omitted")
+    ("convert-pin", "pin the conversion threads to the allowed CPUs")
+    ("camera-size", value<string>()->default_value(string("1920x1080")),
+     "size of the random camera frame converted with --convert-threads")
+    ("frames", value<unsigned int>()->default_value(300),
+     "number of frames to measure for each case")
+    ("warmup", value<unsigned int>()->default_value(10),
+     "number of frames to run before measuring each case")
+    ("format", value<string>()->default_value(string("csv")),
+     "output format: csv or json")
+    ("output,o", value<string>(), "output file. the standard output if omitted")
+    ("emulator-filter", value<string>()->default_value(string("copy")),
+     "filter run by the emulator")
+    ("emulator-latency", value<unsigned int>()->default_value(0),
+     "minimum microseconds the emulator takes to filter a frame")
+    ("emulator-bandwidth", value<double>()->default_value(0.0),
+     "emulated DMA bandwidth in MB/s, 0 for unlimited");
+
+  return description;
+}
+
+std::shared_ptr<Device> MakeDevice(const variables_map& vm) {
+  if (vm.count("filename") > 0) {
+    return std::make_shared<ADMXRC2Device>(
+        0, vm["frequency"].as<double>(), vm["filename"].as<string>());
+  } else {
+    return std::make_shared<EmulatedDevice>(
+        GetReferenceFilter(vm["emulator-filter"].as<string>()),
+        microseconds(vm["emulator-latency"].as<unsigned int>()),
+        vm["emulator-bandwidth"].as<double>() * 1000.0 * 1000.0);
+  }
+}
+
+vector<string> Split(const string& s) {
+  vector<string> items;
+  std::istringstream is(s);
+  for (string item; std::getline(is, item, ',');)
+    { if (!item.empty()) { items.push_back(item); } }
+
+  if (items.empty()) { throw std::invalid_argument("empty list: " + s); }
+  return items;
+}
+
+ColorLayout GetColorLayout(const string& color) {
+  if (color == "grey") { return ColorLayout::MONOCHROME; }
+
+  return filter_core::GetColorLayout(color);
+}
+
+vector<Case> GetCases(const variables_map& vm) {
+  vector<Case> cases;
+  const auto thread_counts = (vm.count("convert-threads") > 0)?
+    Split(vm["convert-threads"].as<string>()) : vector<string>{"0"};
+
+  for (const auto& size : Split(vm["image-size"].as<string>())) {
+    for (const auto& layout : Split(vm["color"].as<string>())) {
+      for (const auto& chunk : Split(vm["chunk"].as<string>())) {
+        const unsigned long kib = std::stoul(chunk);
+        if (kib == 0)
+          { throw std::invalid_argument("invalid chunk size: " + chunk); }
+
+        for (const auto& wait : Split(vm["wait"].as<string>())) {
+          for (const auto& threads : thread_counts) {
+            const unsigned long n = std::stoul(threads);
+            if (vm.count("convert-threads") > 0 && n == 0) {
+              throw std::invalid_argument("invalid thread count: " +
+                                          threads);
+            }
+
+            cases.push_back(Case{GetImageSize(size), layout,
+                                 GetColorLayout(layout), kib * 1024,
+                                 GetWaitStrategy(wait), n});
+          }
+        }
+      }
+    }
+  }
+
+  return cases;
+}
+
+/*!
+ * \brief 1つの条件で変換とフィルタを繰り返し、時間を計測する.
+ *
+ * 各フレームはcoreと同じFilterかFilterColoredでフィルタするため、平面に
+ * 分解するカラー画像では分解と合成の時間もフレームの時間に含まれる.変換
+ * する場合はカメラ画像を変換した画像を、しない場合は乱数の画像を送信する.
+ * 送信、完了待ち、受信の時間は、計測中にStageTracerが記録した直近の分布
+ * から求める.
+ *
+ * \param device デバイス
+ * \param condition 条件
+ * \param camera_frame 変換するカメラ画像
+ * \param is_pinned 変換するスレッドをCPUへ固定する場合は真
+ * \param frames 計測するフレーム数
+ * \param warmup 計測前に実行するフレーム数
+ * \return 計測結果
+ */
+Result Run(std::shared_ptr<Device> device,
+           const Case& condition,
+           cv::Mat camera_frame,
+           bool is_pinned,
+           unsigned int frames,
+           unsigned int warmup) {
+  const bool is_colored = condition.layout != ColorLayout::MONOCHROME;
+  const int type = (is_colored)? CV_8UC3 : CV_8UC1;
+  const ImageOptions options(condition.size, type, cv::INTER_LINEAR,
+                             (is_colored)? 3 : 1);
+
+  FPGACommunicator com(device, condition.length());
+  com.set_chunk_size(condition.chunk_size);
+  Handshake handshake(condition.strategy, milliseconds(250), false);
+
+  // 平面に分解する場合、FilterColoredがホストの画像とDMAバッファの間で分
+  // 解と合成を行う
+  const bool is_planar = condition.layout == ColorLayout::PLANAR;
+  cv::Mat src = (is_planar)?
+    cv::Mat(condition.size, type) : com.write_buffer(condition.size, type);
+  cv::Mat dst = (is_planar)?
+    cv::Mat(condition.size, type) : com.read_buffer(condition.size, type);
+  cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+
+  std::unique_ptr<Converter> converter;
+  if (condition.convert_threads > 0) {
+    converter = MakeConveter(is_colored, condition.size, cv::INTER_LINEAR);
+    if (condition.convert_threads > 1) {
+      converter->parallelize(std::make_shared<WorkerPool>(
+          condition.convert_threads - 1, is_pinned));
+    }
+  }
+
+  SendImageSize(com, condition.size.area(), condition.size.width);
+  SendColorLayout(com, condition.layout);
+
+  vector<uint64_t> total, convert;
+  total.reserve(frames);
+  convert.reserve(frames);
+
+  TransferStatistics before = com.statistics();
+  steady_clock::time_point begin = steady_clock::now();
+  for (unsigned int i = 0; i < warmup + frames; ++i) {
+    if (i == warmup) {
+      StageTracer::instance().clear();
+      before = com.statistics();
+      begin = steady_clock::now();
+    }
+
+    const auto start = steady_clock::now();
+    if (converter) { converter->convert(camera_frame, src); }
+    const auto converted = steady_clock::now();
+    if (is_colored) {
+      FilterColored(com, src, dst, options, handshake, condition.layout);
+    } else {
+      Filter(com, src, dst, options, handshake);
+    }
+    const auto filtered = steady_clock::now();
+
+    if (i < warmup) { continue; }
+    total.push_back(duration_cast<nanoseconds>(filtered - start).count());
+    convert.push_back(duration_cast<nanoseconds>(converted - start).count());
+  }
+  const auto end = steady_clock::now();
+
+  const auto report = StageTracer::instance().report();
+  auto stage = [&report](Stage s) { return report[static_cast<size_t>(s)]; };
+
+  const auto after = com.statistics();
+  TransferStatistics transfers;
+  transfers.transfers = after.transfers - before.transfers;
+  transfers.bytes = after.bytes - before.bytes;
+  transfers.transfer_time = after.transfer_time - before.transfer_time;
+  transfers.register_writes = after.register_writes - before.register_writes;
+  transfers.elided_writes = after.elided_writes - before.elided_writes;
+
+  return Result{condition, frames,
+                duration_cast<nanoseconds>(end - begin),
+                Summarize(total), Summarize(convert),
+                stage(Stage::DMA_WRITE), stage(Stage::FINISH_WAIT),
+                stage(Stage::DMA_READ),
+                transfers};
+}
+
+/*!
+ * \brief 変換の速度向上率を返す.
+ *
+ * 変換するスレッドの数だけが異なる条件のうち、最も少ないスレッドで変換し
+ * た場合の時間(p50)との比.
+ *
+ * \param results 全ての計測結果
+ * \param result 計測結果
+ * \return 速度向上率.変換しない場合は0
+ */
+double GetConvertSpeedup(const vector<Result>& results, const Result& result) {
+  const Case& c = result.condition;
+  if (c.convert_threads == 0 || result.convert.p50.count() == 0) { return 0.0; }
+
+  const Result* baseline = &result;
+  for (const auto& r : results) {
+    const Case& b = r.condition;
+    if (b.size == c.size && b.layout_name == c.layout_name &&
+        b.chunk_size == c.chunk_size && b.strategy == c.strategy &&
+        b.convert_threads < baseline->condition.convert_threads)
+      { baseline = &r; }
+  }
+  return static_cast<double>(baseline->convert.p50.count()) /
+    result.convert.p50.count();
+}
+
+void WriteCsv(std::ostream& os, const vector<Result>& results) {
+  auto us = [](nanoseconds d) { return d.count() / 1000.0; };
+
+  os << "width,height,color,chunk_bytes,wait,convert_threads,frames,fps,"
+        "mb_per_s,p50_us,p95_us,p99_us,max_us,"
+        "convert_p50_us,convert_speedup,"
+        "upload_p50_us,filter_p50_us,readback_p50_us,"
+        "dma_transfers_per_frame,register_writes_per_frame,"
+        "elided_writes_per_frame" << std::endl;
+
+  os << std::fixed << std::setprecision(1);
+  for (const auto& r : results) {
+    const double n = (r.frames > 0)? r.frames : 1;
+    os << r.condition.size.width << "," << r.condition.size.height << "," <<
+      r.condition.layout_name << "," << r.condition.chunk_size << "," <<
+      ToString(r.condition.strategy) << "," <<
+      r.condition.convert_threads << "," << r.frames << "," <<
+      r.fps() << "," << r.megabytes_per_second() << "," <<
+      us(r.total.p50) << "," << us(r.total.p95) << "," <<
+      us(r.total.p99) << "," << us(r.total.max) << "," <<
+      us(r.convert.p50) << "," <<
+      std::setprecision(2) << GetConvertSpeedup(results, r) <<
+      std::setprecision(1) << "," <<
+      us(r.upload.p50) << "," << us(r.filter.p50) << "," <<
+      us(r.readback.p50) << "," <<
+      r.transfers.transfers / n << "," <<
+      r.transfers.register_writes / n << "," <<
+      r.transfers.elided_writes / n << std::endl;
+  }
+}
+
+void WriteJson(std::ostream& os, const vector<Result>& results) {
+  auto us = [](nanoseconds d) { return d.count() / 1000.0; };
+  auto summary = [&](const StageSummary& s) {
+    std::ostringstream o;
+    o << std::fixed << std::setprecision(1) <<
+      "{\"p50_us\":" << us(s.p50) << ",\"p95_us\":" << us(s.p95) <<
+      ",\"p99_us\":" << us(s.p99) << ",\"max_us\":" << us(s.max) << "}";
+    return o.str();
+  };
+
+  os << "[";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    const double n = (r.frames > 0)? r.frames : 1;
+
+    os << ((i == 0)? "\n" : ",\n") << std::fixed << std::setprecision(1) <<
+      "  {\"width\":" << r.condition.size.width <<
+      ",\"height\":" << r.condition.size.height <<
+      ",\"color\":\"" << r.condition.layout_name << "\"" <<
+      ",\"chunk_bytes\":" << r.condition.chunk_size <<
+      ",\"wait\":\"" << ToString(r.condition.strategy) << "\"" <<
+      ",\"convert_threads\":" << r.condition.convert_threads <<
+      ",\"frames\":" << r.frames <<
+      ",\"fps\":" << r.fps() <<
+      ",\"mb_per_s\":" << r.megabytes_per_second() <<
+      ",\"frame\":" << summary(r.total) <<
+      ",\"convert\":" << summary(r.convert) <<
+      ",\"convert_speedup\":" << std::setprecision(2) <<
+        GetConvertSpeedup(results, r) << std::setprecision(1) <<
+      ",\"upload\":" << summary(r.upload) <<
+      ",\"filter\":" << summary(r.filter) <<
+      ",\"readback\":" << summary(r.readback) <<
+      ",\"dma_transfers_per_frame\":" << r.transfers.transfers / n <<
+      ",\"register_writes_per_frame\":" << r.transfers.register_writes / n <<
+      ",\"elided_writes_per_frame\":" << r.transfers.elided_writes / n << "}";
+  }
+  os << "\n]" << std::endl;
+}
+
+/*!
+ * \brief 1秒当たりのフレーム数を返す
+ * \return フレーム数
+ */
+double Result::fps() const {
+  const double seconds = duration<double>(elapsed).count();
+  return (seconds > 0.0)? frames / seconds : 0.0;
+}
+/*!
+ * \brief 送受信の合計の転送速度を返す
+ * \return MB/s
+ */
+double Result::megabytes_per_second() const {
+  const double seconds = duration<double>(elapsed).count();
+  return (seconds > 0.0)? transfers.bytes / seconds / 1000.0 / 1000.0 : 0.0;
+}
+}  // namespace bench
+
+
+/*!
+ * \brief 画像サイズ、色、DMA転送の分割の大きさ、完了の待ち方、変換するスレッ
+ *        ドの数の全ての組み合わせについて、変換、送信、フィルタ、受信の時間
+ *        を計測する.
+ * \param vm プログラム引数
+ * \return 常にEXIT_SUCCESS
+ */
+int BenchImpl(const variables_map& vm) {
+  namespace detail = bench;
+
+  const auto cases = detail::GetCases(vm);
+  const unsigned int frames = vm["frames"].as<unsigned int>();
+  const unsigned int warmup = vm["warmup"].as<unsigned int>();
+  const string format = vm["format"].as<string>();
+  if (format != "csv" && format != "json")
+    { throw std::invalid_argument("unknown output format: " + format); }
+
+  auto device = detail::MakeDevice(vm);
+
+  // 変換する場合のカメラ画像
+  cv::Mat camera_frame;
+  if (vm.count("convert-threads") > 0) {
+    camera_frame.create(GetImageSize(vm["camera-size"].as<string>()),
+                        CV_8UC3);
+    cv::randu(camera_frame, cv::Scalar::all(0), cv::Scalar::all(256));
+  }
+
+  vector<detail::Result> results;
+  for (const auto& condition : cases) {
+    std::cerr << "\r" << results.size() + 1 << "/" << cases.size() <<
+      std::flush;
+    results.push_back(detail::Run(device, condition, camera_frame,
+                                  vm.count("convert-pin") > 0,
+                                  frames, warmup));
+  }
+  std::cerr << std::endl;
+
+  std::ofstream file;
+  if (vm.count("output") > 0) {
+    file.open(vm["output"].as<string>());
+    if (!file) {
+      throw std::runtime_error("failed to open " +
+                               vm["output"].as<string>());
+    }
+  }
+  std::ostream& os = (file.is_open())? file : std::cout;
+
+  if (format == "json") { detail::WriteJson(os, results); }
+  else { detail::WriteCsv(os, results); }
+
+  return EXIT_SUCCESS;
+}
+}  // namespace filter_core
+
+
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+
+  try {
+    const auto description = filter_core::bench::GetDescription();
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, description), vm);
+    po::notify(vm);
+
+    if (vm.count("help") > 0) {
+      std::cout << "bench [OPTION]..." << std::endl << description << std::endl;
+      std::exit(EXIT_SUCCESS);
+    }
+    std::exit(filter_core::BenchImpl(vm));
+  } catch(std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  } catch(...) {
+    std::cerr << "some exceptions were thrown" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  return 0;
+}
@@ -4,22 +4,42 @@
  *
  * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
  */
+#include "filter_core/admxrc2_device.h"
 #include "filter_core/camera.h"
+#include "filter_core/compose.h"
+#include "filter_core/device_pool.h"
+#include "filter_core/emulated_device.h"
+#include "filter_core/filter.h"
 #include "filter_core/fpga_communicator.h"
-#include "filter_core/framerate_checker.h"
+#include "filter_core/frame_mailbox.h"
+#include "filter_core/frame_source.h"
+#include "filter_core/handshake.h"
+#include "filter_core/image_writer.h"
+#include "filter_core/pipeline.h"
 #include "filter_core/program_options.h"
+#include "filter_core/recorder.h"
+#include "filter_core/stage_tracer.h"
+#include "filter_core/stream_set.h"
+#include "filter_core/timeline.h"
+#include "filter_core/worker_pool.h"
 
 #include <admxrc2.h>
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/core.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstdio>
 #include <cstdlib>
-#include <cstring>
+#include <deque>
 #include <exception>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -31,23 +51,15 @@ using std::string;
 using std::to_string;
 using std::vector;
 using std::chrono::microseconds;
-using std::chrono::system_clock;
+using std::chrono::steady_clock;
 using std::this_thread::sleep_for;
 using std::placeholders::_1;
 using std::placeholders::_2;
 using std::placeholders::_3;
-using cv::Rect;
 using cv::Mat;
 using cv::setMouseCallback;
 
 
-namespace filter_core {
-
-using filter_t =
-  std::function<void (filter_core::FPGACommunicator&, cv::Mat, cv::Mat)>;
-}  // namespace filter_core
-
-
 namespace filter_core {
 /*!
  * @var frame_title 
@@ -64,105 +76,645 @@ void test(filter_core::FPGACommunicator& com, cv::Size size, int inter);
 
 namespace filter_core {
 /*!
- * \brief 画像を結合する
- * \param dst 出力先
- * \param filtered フィルタ画像
- * \param original 元画像
- * \param width 画像幅
- * \param height 画像高さ
- * \return 出力
+ * \brief 通信に使うデバイスを生成する
+ * \param options プログラム引数の解析結果
+ * \param card カードの番号
+ * \return デバイス
  */
-cv::Mat Combine(cv::Mat dst, cv::Mat filtered, cv::Mat original,
-                cv::Size size) {
-  filtered.copyTo(Mat(dst, Rect(0, 0, size.width, size.height)));
-  original.copyTo(Mat(dst, Rect(size.width, 0, size.width, size.height)));
-
-  return dst;
+std::shared_ptr<filter_core::Device> MakeDevice(
+    const filter_core::Options& options, size_t card) {
+  if (options.is_emulated) {
+    const auto& emulator_options = options.emulator_options;
+    return std::make_shared<EmulatedDevice>(emulator_options.filter,
+                                            emulator_options.latency,
+                                            emulator_options.bandwidth);
+  } else {
+    return std::make_shared<ADMXRC2Device>(
+        static_cast<int>(card), options.frequency, options.filename);
+  }
 }
 /*!
- * \brief ハードウェアを用いて空間フィルタをかける.
- * \param com FPGAボードとのコミュニケータ
- * \param src 入力画像
- * \param dst 出力画像
- * \param total_size 入力画像サイズ.8ビット画素数=バイト数を指定
- * \param wait_limit finish信号を待つ最大回数.時間にして(250 x wait_limit)ms
+ * \brief 結果を遅らせないフィルタを、常に真を返すフィルタとする.
+ * \param filter 出力画像へ結果を書き込む関数オブジェクト
+ * \return フィルタ
  */
-void Filter(filter_core::FPGACommunicator& com,
-            cv::Mat src, cv::Mat dst,
-            const ImageOptions& options,
-            int wait_limit) {
-  // 画像を送信
-  com.write(src.data, 0, options.total_size, 0);
-  // refresh信号を送り、enable信号を有効にする
-  SendRefresh(com);
-  com.write(ENABLE_REG, 1);
-  // フィルタリング完了を待つ
-  for (int i = 0; i < wait_limit && com[FINISH_REG] == 0; ++i)
-    { sleep_for(microseconds(250)); }
-  // enableを無効にする
-  com.write(ENABLE_REG, 0);
-  // 画像を取得
-  com.read(dst.data, 0, options.total_size, 1);
+template <typename F>
+filter_core::FilterStage MakeStage(F filter) {
+  return FilterStage{
+    [filter](FPGACommunicator& com, Mat& src, Mat dst) mutable {
+      filter(com, src, dst);
+      return true;
+    },
+    nullptr};
 }
+/*!
+ * \brief 結果を1フレーム遅らせるフィルタと、その終了の手順を生成する.
+ * \param filter フィルタ.両方の手順で共有する
+ * \return フィルタ
+ */
+filter_core::FilterStage MakeStage(
+    std::shared_ptr<filter_core::PingPongFilter> filter) {
+  return FilterStage{
+    [filter](FPGACommunicator& com, Mat& src, Mat dst)
+      { return (*filter)(com, src, dst); },
+    [filter](FPGACommunicator& com, Mat& src, Mat dst)
+      { return filter->finish(com, src, dst); }};
+}
+/*!
+ * \brief ボード毎のフィルタを生成する
+ * \param communicator FPGAボードとのコミュニケータ
+ * \param handshake FPGAの起動と完了待ちの手順
+ * \param options プログラム引数の解析結果
+ * \param mouse クリックした座標
+ * \param frames_size 全てのフレームが使うDMAバッファの大きさ
+ * \return フィルタ
+ */
+filter_core::FilterStage MakeFilter(
+    filter_core::FPGACommunicator& communicator,
+    filter_core::Handshake& handshake,
+    const filter_core::Options& options,
+    const filter_core::MousePosition& mouse,
+    size_t frames_size) {
+  const auto& image_options = options.image_options;
 
-void FilterColored(filter_core::FPGACommunicator& com,
-                   cv::Mat src, cv::Mat dst,
-                   const ImageOptions& options,
-                   int wait_limit,
-                   int channel) {
-  vector<Mat> splitted(channel);
-  cv::split(src, splitted);
-
-  vector<Mat> filtered(channel);
-  for (auto& dst : filtered)
-    { dst = Mat(options.size, CV_8UC1); }
+  return (options.hybrid_filter)?
+    MakeStage(
+        HybridFilter(image_options, handshake, *options.hybrid_filter,
+                     options.hybrid_thread_count)):
+    (options.roi_size.area() > 0)?
+    MakeStage(
+        RoiFilter(communicator, image_options, handshake, options.color_layout,
+                  options.roi_size, options.roi_origin, mouse, frames_size)):
+    (options.is_ping_pong)?
+    MakeStage(
+        std::make_shared<PingPongFilter>(communicator, image_options,
+                                         handshake, frames_size)):
+    (options.history_length > 0)?
+    MakeStage(
+        HistoryFilter(communicator, image_options, handshake,
+                      options.color_layout, options.history_length)):
+    (options.pass_count > 1)?
+    MakeStage(
+        bind(FilterChain,
+             _1, _2, _3, cref(image_options), std::ref(handshake),
+             options.color_layout, options.pass_count)):
+    (options.is_colored)?
+    MakeStage(
+        bind(FilterColored,
+             _1, _2, _3, cref(image_options), std::ref(handshake),
+             options.color_layout)):
+    MakeStage(
+        bind(Filter, _1, _2, _3, cref(image_options), std::ref(handshake)));
+}
+/*!
+ * \brief 各ボードへのマウスイベントを生成する.クリックは全てのボードへ送る.
+ * \param boards FPGAボード
+ * \param mouse クリックした座標
+ * \param size 画像サイズ
+ * \return ボード毎のマウスイベント
+ */
+std::vector<std::unique_ptr<filter_core::MouseEvent>> MakeMouseEvents(
+    filter_core::DevicePool& boards,
+    filter_core::MousePosition& mouse, cv::Size size) {
+  std::vector<std::unique_ptr<MouseEvent>> events;
+  for (size_t i = 0; i < boards.size(); ++i)
+    { events.emplace_back(new MouseEvent(boards[i], mouse, size)); }
+  return events;
+}
+/*!
+ * \brief カメラ画像のコンバータを生成する.
+ *
+ * 複数のスレッドで変換する場合は、呼び出し元を含めてその数になるようにス
+ * レッドを起動して渡す.出力は入力1つ分の大きさ.
+ *
+ * \param options プログラム引数の解析結果
+ * \return コンバータ
+ */
+std::unique_ptr<filter_core::Converter> MakeCameraConverter(
+    const filter_core::Options& options) {
+  const auto& image_options = options.image_options;
 
-  for (uint32_t i = 0; i < channel; ++i) {
-    Filter(com, splitted[i], filtered[i], options, wait_limit);
+  auto converter = MakeConveter(
+      options.is_colored,
+      GetStreamSize(image_options.size, options.inputs.size()),
+      image_options.interpolation);
+  if (options.convert_thread_count > 1) {
+    converter->parallelize(std::make_shared<WorkerPool>(
+        options.convert_thread_count - 1, options.is_convert_pinned));
   }
-
-  cv::merge(filtered, dst);
-
-  dst = src;
+  return converter;
 }
 /*!
- * \brief 画像をファイルに出力する.
- * \param output 出力画像
- * \param dir 出力先ディレクトリ名
+ * \brief 全ての入力を開く.
+ * \param options プログラム引数の解析結果
+ * \param is_paced ファイルからの入力を記録されたフレームレートで再生する場
+ *        合は真
+ * \return 入力
+ */
+std::unique_ptr<filter_core::StreamSet> MakeStreams(
+    const filter_core::Options& options, bool is_paced) {
+  std::vector<std::unique_ptr<Camera>> cameras;
+  for (const auto& input : options.inputs) {
+    cameras.emplace_back(new Camera(
+        MakeCameraConverter(options),
+        MakeSource(input),
+        options.prefetch_depth,
+        is_paced));
+  }
+  return std::unique_ptr<StreamSet>(new StreamSet(std::move(cameras)));
+}
+/*!
+ * \brief 表示用の郵便受けで受け渡す画像を、DMA転送できる領域に確保する.
+ *
+ * 取り込みとフィルタの結果を画像の領域へ直接転送するために使う.
+ *
+ * \param communicator FPGAボードとのコミュニケータ
+ * \param options プログラム引数の解析結果
+ * \return 黒で塗りつぶした画像
  */
-void OutputImage(cv::Mat output, const char* const dir) {
-  // ファイル名を生成
-  // TODO: gcc 4.9ではstd::put_timeが使えないため、Cの関数を使用
-  char output_filename[1024] = "";
-
-  std::time_t timestamp = system_clock::to_time_t(system_clock::now());
-  std::strncat(std::strncpy(output_filename, dir, strlen(dir)), "/", 1);
-  std::strftime(output_filename + strlen(dir) + 1,
-                1024 - strlen(dir) - 1, "%F-%T",
-                std::localtime(&timestamp)),
-  std::strncat(output_filename, ".png", 4);
-
-  cv::imwrite(output_filename, output);
+std::array<cv::Mat, 3> AllocateCanvases(
+    filter_core::FPGACommunicator& communicator,
+    const filter_core::Options& options) {
+  const auto& image_options = options.image_options;
+
+  std::array<cv::Mat, 3> canvases;
+  for (auto& canvas : canvases) {
+    canvas = communicator.allocate(
+        GetCanvasSize(options.compose_layout, image_options.size),
+        image_options.type);
+    canvas = cv::Scalar::all(0);
+  }
+  return canvases;
 }
 /*!
  * \brief マウスイベントをセット.
  * \param x x座標
  * \param y y座標
- * \param event マウスイベントハンドラ
+ * \param events ボード毎のマウスイベントハンドラ
  */
-void SetMouseEvent(int x, int y, MouseEvent* event)
-  { event->set(x, y); }
+void SetMouseEvent(int x, int y,
+                   std::vector<std::unique_ptr<MouseEvent>>* events)
+  { for (auto& event : *events) { event->set(x, y); } }
 /*!
  * \brief マウスイベントをハンドルする.
  * \param event マウスイベント
  * \param x x座標
  * \param y y座標
  * \param flags メタフラグ
- * \param userdata マウスイベントハンドラ
+ * \param userdata ボード毎のマウスイベントハンドラ
  */
 void HandleMouseEvent(int event, int x, int y, int flags, void* userdata) {
-  if (event == cv::EVENT_LBUTTONUP)
-    { SetMouseEvent(x, y, static_cast<MouseEvent*>(userdata)); }
+  if (event == cv::EVENT_LBUTTONUP) {
+    SetMouseEvent(
+        x, y,
+        static_cast<std::vector<std::unique_ptr<MouseEvent>>*>(userdata));
+  }
+}
+/*!
+ * \brief 押されたキーに応じた処理を行う.
+ * \param key キー
+ * \param output 出力画像
+ * \param recorder スナップショットと録画
+ * \param com FPGAボードとのコミュニケータ
+ * \return 処理を続ける場合、真
+ */
+bool HandleKey(int key, cv::Mat output, filter_core::Recorder& recorder,
+               filter_core::FPGACommunicator& com) {
+  if (key == 'p' || key == 'P') {
+    recorder.snapshot(output);
+  } else if (key == 'r' || key == 'R') {
+    if (recorder.is_recordable()) {
+      std::cout << "\r" << "recording " <<
+        ((recorder.toggle())? "resumed" : "paused") << std::endl;
+    }
+  } else if (key == 'd' || key == 'D') {
+    std::cout << "\r";
+    OutputUserRegisters(com);
+    std::cout << std::endl;
+  } else if (key == 't' || key == 'T') {
+    std::cout << "\r" << StageTracer::instance().report() << std::endl;
+  } else if (key >= 0) {
+    return false;
+  }
+
+  return true;
+}
+/*!
+ * \brief 郵便受けの画像を、表示の構成に従って領域に分ける.
+ * \param image 郵便受けの画像
+ * \param options プログラム引数の解析結果
+ * \return 領域
+ */
+filter_core::Canvas GetCanvas(cv::Mat image,
+                              const filter_core::Options& options) {
+  return MakeCanvas(image, options.compose_layout, options.image_options.size);
+}
+/*!
+ * \brief 出力画像を表示用の郵便受けへ渡し、録画する.表示と録画を待たずに戻る.
+ *
+ * 郵便受けの画像の領域へ直接書き込まれた画像はコピーしない.
+ *
+ * \param mailbox 表示用の郵便受け
+ * \param recorder スナップショットと録画
+ * \param filtered フィルタ画像
+ * \param original 元画像
+ * \param options プログラム引数の解析結果
+ */
+void Publish(filter_core::FrameMailbox& mailbox,
+             filter_core::Recorder& recorder,
+             cv::Mat filtered, cv::Mat original,
+             const filter_core::Options& options) {
+  auto canvas = GetCanvas(mailbox.back(), options);
+  Compose(canvas, options.compose_layout, filtered, original);
+  recorder.record(canvas.shown);
+  mailbox.publish();
+}
+/*!
+ * \brief 表示する画像のスナップショットと録画を生成する.
+ * \param options プログラム引数の解析結果
+ * \return スナップショットと録画
+ */
+std::unique_ptr<filter_core::Recorder> MakeRecorder(
+    const filter_core::Options& options) {
+  const auto& image_options = options.image_options;
+
+  return std::unique_ptr<Recorder>(new Recorder(
+      options.record_options, options.output_directory,
+      GetShownSize(options.compose_layout, image_options.size),
+      image_options.type, options.encoder_count));
+}
+/*!
+ * \brief 処理を別のスレッドで実行し、郵便受けに届いた最新の画像を表示する.
+ *
+ * 表示とキー入力はHighGUIの制約により呼び出したスレッドで行う.処理は表示
+ * を待たず、表示が追いつかない画像は捨てられる.処理が終わるか、終了のキー
+ * が押されると表示を終え、is_stoppedを真にして処理が終わるまで待つ.
+ *
+ * 終了時は書き込み待ちのスナップショットと録画を全て書き込む.
+ *
+ * \param communicator FPGAボードとのコミュニケータ
+ * \param options プログラム引数の解析結果
+ * \param mailbox 表示用の郵便受け
+ * \param recorder スナップショットと録画
+ * \param is_stopped 処理に終了を伝えるフラグ
+ * \param process 処理
+ */
+void Display(filter_core::FPGACommunicator& communicator,
+             const filter_core::Options& options,
+             filter_core::FrameMailbox& mailbox,
+             filter_core::Recorder& recorder,
+             std::atomic<bool>& is_stopped,
+             std::function<void ()> process) {
+  std::atomic<bool> is_finished(false);
+  std::exception_ptr error;
+  std::thread worker([&] {
+    Timeline::instance().name_thread("process");
+    try {
+      process();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    is_finished.store(true);
+  });
+
+  // 表示の頻度を制限する場合の表示間隔
+  const auto period = (options.display_fps > 0.0)?
+    std::chrono::duration_cast<steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / options.display_fps)) :
+    steady_clock::duration::zero();
+  auto next = steady_clock::now();
+  uint64_t shown = 0;
+
+  try {
+    while (!is_finished.load()) {
+      const auto now = steady_clock::now();
+      if (now >= next && mailbox.fetch()) {
+        next = now + period;
+
+        ScopedStage stage(Stage::DISPLAY);
+        cv::imshow(frame_title, GetCanvas(mailbox.front(), options).shown);
+        ++shown;
+      }
+
+      if (!HandleKey(cv::waitKey(1), GetCanvas(mailbox.front(), options).shown,
+                     recorder, communicator))
+        { break; }
+    }
+  } catch (...) {
+    is_stopped.store(true);
+    worker.join();
+    throw;
+  }
+
+  is_stopped.store(true);
+  worker.join();
+  if (error) { std::rethrow_exception(error); }
+
+  recorder.close();
+
+  std::cout << std::endl << "display: " << shown << " shown, " <<
+    mailbox.dropped() << " dropped";
+  const auto recording = recorder.report();
+  if (!recording.empty()) { std::cout << std::endl << recording; }
+}
+/*!
+ * \brief キャプチャとFPGA転送を1フレームずつ順に実行し、別に表示する.
+ *
+ * 表示する画像はDMA転送できる領域に確保し、取り込みとフィルタの結果をそ
+ * の元画像とフィルタ画像の領域へ直接書き込む.ただし、横に並べる構成では
+ * 各領域の行が連続しないため、DMAバッファ上で処理してからコピーする.
+ *
+ * 結果を遅らせるフィルタでは、結果がないフレームを表示せず、終了時に残っ
+ * た結果を取り出して表示する.
+ *
+ * \param communicator FPGAボードとのコミュニケータ
+ * \param stage フィルタ
+ * \param mouse クリックした座標.フィルタと共有する
+ * \param options プログラム引数の解析結果
+ */
+void RunSequential(filter_core::FPGACommunicator& communicator,
+                   const filter_core::FilterStage& stage,
+                   filter_core::MousePosition& mouse,
+                   const filter_core::Options& options) {
+  const auto& image_options = options.image_options;
+
+  FrameMailbox mailbox(AllocateCanvases(communicator, options));
+  // 平面に分解するカラー画像と領域だけのフィルタは行毎に読み書きするため、
+  // 領域が連続していなくてもよい
+  const bool is_planar = options.color_layout == ColorLayout::PLANAR;
+  const bool is_direct =
+    is_planar || options.roi_size.area() > 0 ||
+    IsContinuous(GetCanvas(mailbox.back(), options));
+  // 直接書き込めない場合、画素順に転送する画像はDMAバッファ上で処理する
+  cv::Mat upload, download;
+  if (!is_direct) {
+    upload = communicator.write_buffer(image_options.size, image_options.type);
+    download = communicator.read_buffer(image_options.size, image_options.type);
+  }
+  // クリックはフレーム毎に送信する
+  std::vector<std::unique_ptr<MouseEvent>> mouse_events;
+  mouse_events.emplace_back(
+      new MouseEvent(communicator, mouse, image_options.size));
+  cv::namedWindow(frame_title);
+  setMouseCallback(frame_title, &HandleMouseEvent, &mouse_events);
+
+  // 結果を遅らせるフィルタは入力画像を保持している画像と入れ替えるため、
+  // 次の入力画像は返された画像へ書き込む
+  cv::Mat held;
+  if (stage.finish) {
+    held = communicator.write_buffer(image_options.size, image_options.type);
+  }
+
+  FrameMeter frame_meter;
+
+  auto streams = MakeStreams(options, options.is_paced);
+  auto recorder = MakeRecorder(options);
+
+  std::atomic<bool> is_stopped(false);
+  Display(communicator, options, mailbox, *recorder, is_stopped, [&] {
+    while (!is_stopped.load() && streams->isReady()) {
+      const auto canvas = GetCanvas(mailbox.back(), options);
+      cv::Mat src =
+        (stage.finish)? held : (is_direct)? canvas.original : upload;
+      cv::Mat dst = (is_direct)? canvas.filtered : download;
+      streams->get(src);
+
+      mouse_events.front()->send();
+      const bool is_filtered = (options.is_debug_mode)?
+        stage.filter(
+            // ユーザレジスタを表示
+            OutputUserRegisters(communicator), src, dst) :
+        stage.filter(communicator, src, dst);
+
+      // フレームレート計測.表示ではなく処理の頻度
+      const auto interval = frame_meter.tick();
+      if (!options.is_debug_mode) { ShowFramerate(interval); }
+
+      if (is_filtered) { Publish(mailbox, *recorder, dst, src, options); }
+      if (stage.finish) { held = src; }
+    }
+
+    if (!stage.finish) { return; }
+
+    const auto canvas = GetCanvas(mailbox.back(), options);
+    cv::Mat src = held;
+    cv::Mat dst = (is_direct)? canvas.filtered : download;
+    if (stage.finish(communicator, src, dst))
+      { Publish(mailbox, *recorder, dst, src, options); }
+  });
+}
+/*!
+ * \brief パイプラインを流れるフレームを確保する.
+ *
+ * 画素順に転送する画像のフレームはDMAバッファの一部を参照する.
+ *
+ * \param communicator FPGAボードとのコミュニケータ
+ * \param options プログラム引数の解析結果
+ * \return フレーム
+ */
+std::vector<filter_core::Frame> MakeFrames(
+    filter_core::FPGACommunicator& communicator,
+    const filter_core::Options& options) {
+  const auto& image_options = options.image_options;
+
+  vector<Frame> frames;
+  for (size_t i = 0; i < options.pipeline_depth; ++i) {
+    if (options.color_layout == ColorLayout::PLANAR) {
+      frames.emplace_back(Mat(image_options.size, image_options.type),
+                          Mat(image_options.size, image_options.type));
+    } else {
+      size_t offset = i * image_options.total_size * image_options.step;
+      frames.emplace_back(
+          communicator.write_buffer(
+              image_options.size, image_options.type, offset),
+          communicator.read_buffer(
+              image_options.size, image_options.type, offset));
+    }
+  }
+
+  return frames;
+}
+/*!
+ * \brief ボード毎にパイプラインのレーンのフレームを確保する.
+ * \param boards FPGAボード
+ * \param options プログラム引数の解析結果
+ * \return レーン毎のフレーム
+ */
+std::vector<std::vector<filter_core::Frame>> MakeLanes(
+    filter_core::DevicePool& boards, const filter_core::Options& options) {
+  vector<vector<Frame>> lanes;
+  for (size_t i = 0; i < boards.size(); ++i)
+    { lanes.push_back(MakeFrames(boards[i], options)); }
+  return lanes;
+}
+/*!
+ * \brief パイプラインの終了ステージを生成する.
+ * \param boards FPGAボード
+ * \param stages ボード毎のフィルタ
+ * \return 終了ステージ.結果を遅らせるフィルタがなければnullptr
+ */
+filter_core::Pipeline::lane_filter_t MakeFinish(
+    filter_core::DevicePool& boards,
+    const std::vector<filter_core::FilterStage>& stages) {
+  if (!stages.front().finish) { return nullptr; }
+
+  return [&boards, &stages](size_t lane, Mat& src, Mat dst)
+    { return stages[lane].finish(boards[lane], src, dst); };
+}
+/*!
+ * \brief ボード毎のフィルタしたフレームの数を表示する.
+ * \param pipeline パイプライン
+ */
+void ShowLaneCounts(const filter_core::Pipeline& pipeline) {
+  const auto counts = pipeline.filtered();
+  if (counts.size() < 2) { return; }
+
+  std::cout << std::endl << "boards:";
+  for (size_t i = 0; i < counts.size(); ++i)
+    { std::cout << " #" << i << " " << counts[i]; }
+}
+/*!
+ * \brief キャプチャ、FPGA転送、出力をそれぞれ別のスレッドで並行に実行する.
+ *
+ * 出力は最新の画像を郵便受けへ渡すだけで、表示は呼び出したスレッドで行う.
+ * 複数のボードがある場合、FPGA転送はボード毎のスレッドで並行に行い、出力
+ * はキャプチャした順に行う.
+ *
+ * \param boards FPGAボード
+ * \param stages ボード毎のフィルタ
+ * \param mouse クリックした座標.フィルタと共有する
+ * \param options プログラム引数の解析結果
+ */
+void RunPipelined(filter_core::DevicePool& boards,
+                  const std::vector<filter_core::FilterStage>& stages,
+                  filter_core::MousePosition& mouse,
+                  const filter_core::Options& options) {
+  const auto& image_options = options.image_options;
+
+  FrameMailbox mailbox(
+      GetCanvasSize(options.compose_layout, image_options.size),
+      image_options.type);
+  // クリックはFPGA転送ステージがフレーム毎に送信する
+  auto mouse_events = MakeMouseEvents(boards, mouse, image_options.size);
+  cv::namedWindow(frame_title);
+  setMouseCallback(frame_title, &HandleMouseEvent, &mouse_events);
+
+  auto streams = MakeStreams(options, options.is_paced);
+
+  auto recorder = MakeRecorder(options);
+
+  FrameMeter frame_meter;
+
+  Pipeline pipeline(MakeLanes(boards, options), options.dispatch);
+  std::atomic<bool> is_stopped(false);
+  Display(boards[0], options, mailbox, *recorder, is_stopped, [&] {
+    pipeline.run(
+        [&](Mat src) {
+          if (!streams->isReady()) { return false; }
+
+          streams->get(src);
+          return true;
+        },
+        [&](size_t lane, Mat& src, Mat dst) {
+          mouse_events[lane]->send();
+          return stages[lane].filter(
+              (options.is_debug_mode)?
+                OutputUserRegisters(boards[lane]) : boards[lane],
+              src, dst);
+        },
+        MakeFinish(boards, stages),
+        [&](Mat src, Mat dst) {
+          // フレームレート計測.前回の出力からの経過時間を表示する
+          const auto interval = frame_meter.tick();
+          if (!options.is_debug_mode) { ShowFramerate(interval); }
+
+          Publish(mailbox, *recorder, dst, src, options);
+          return !is_stopped.load();
+        });
+  });
+  ShowLaneCounts(pipeline);
+}
+/*!
+ * \brief 入力の全ての画像をフィルタし、ファイルへ書き込む.表示はしない.
+ *
+ * 読み込み、FPGA転送、書き込みの依頼をパイプラインで並行に実行し、符号化
+ * と書き込みは複数のスレッドで行う.出力のファイル名は入力の画像ファイル
+ * の名前から拡張子を除いたもので、ファイル名のない入力では入力の順番.複
+ * 数のボードがある場合、FPGA転送はボード毎のスレッドで並行に行う.複数の
+ * 入力を詰めた場合は入力毎に分けて書き込み、ファイル名に入力の番号を付け
+ * る.
+ *
+ * \param boards FPGAボード
+ * \param stages ボード毎のフィルタ
+ * \param options プログラム引数の解析結果
+ */
+void RunBatch(filter_core::DevicePool& boards,
+              const std::vector<filter_core::FilterStage>& stages,
+              const filter_core::Options& options) {
+  const auto& image_options = options.image_options;
+
+  auto streams = MakeStreams(options, false);
+  const auto& record_options = options.record_options;
+  const size_t stream_count = options.inputs.size();
+  ImageWriter writer(options.encoder_count,
+                     options.encoder_count * 2 * stream_count,
+                     GetStreamSize(image_options.size, stream_count),
+                     image_options.type,
+                     GetImageParameters(record_options.image_format,
+                                        record_options.compression));
+
+  const auto start = steady_clock::now();
+
+  // 取り込んだ順の入力毎の名前.出力も取り込んだ順に行われる
+  std::mutex names_mutex;
+  std::deque<vector<string>> names;
+  uint64_t count = 0;
+  Pipeline pipeline(MakeLanes(boards, options), options.dispatch);
+  pipeline.run(
+      [&](Mat src) {
+        if (!streams->isReady()) { return false; }
+
+        streams->get(src);
+        vector<string> stems;
+        for (size_t i = 0; i < stream_count; ++i)
+          { stems.push_back(streams->name(i)); }
+        std::lock_guard<std::mutex> lock(names_mutex);
+        names.push_back(std::move(stems));
+        return true;
+      },
+      [&](size_t lane, Mat& src, Mat dst)
+        { return stages[lane].filter(boards[lane], src, dst); },
+      MakeFinish(boards, stages),
+      [&](Mat src, Mat dst) {
+        vector<string> stems;
+        {
+          std::lock_guard<std::mutex> lock(names_mutex);
+          stems = std::move(names.front());
+          names.pop_front();
+        }
+
+        const auto outputs = SplitStreams(dst, stream_count);
+        for (size_t i = 0; i < stream_count; ++i) {
+          char number[32] = "";
+          std::snprintf(number, sizeof(number), "%08llu",
+                        static_cast<unsigned long long>(count));
+          string filename = (stems[i].empty())? number : stems[i];
+          if (stream_count > 1) { filename += "-" + to_string(i); }
+          writer.write(outputs[i], options.batch_directory + "/" + filename +
+                                   "." + record_options.image_format);
+        }
+        ++count;
+
+        return true;
+      });
+  writer.close();
+
+  const double seconds =
+    std::chrono::duration<double>(steady_clock::now() - start).count();
+  std::cout << writer.written() << " images in " << seconds << " s (" <<
+    ((seconds > 0.0)? writer.written() / seconds : 0.0) << " images/s)";
+  ShowLaneCounts(pipeline);
+  std::cout << std::endl;
 }
 /*!
  * \brief mainの実装.
@@ -174,70 +726,71 @@ int MainImpl(filter_core::Options&& options) {
 
   if (options.is_debug_mode) { ShowOptions(options); }
 
-  const auto& image_options = options.image_options;
-
-  cv::Mat dst(image_options.size, image_options.type);
-  cv::Mat combined(image_options.combined_image_size, image_options.type);
-  // マウス座標
-  std::atomic<uint32_t> mouse_x(0);
-  std::atomic<uint32_t> mouse_y(0);
-
-  auto start = system_clock::now();
+  if (!options.trace_filename.empty()) {
+    Timeline::instance().enable(options.trace_capacity);
+    Timeline::instance().name_thread("main");
+  }
 
-  filter_t filter = (options.is_colored)?
-    static_cast<filter_t>(
-        bind(FilterColored,
-             _1, _2, _3, cref(image_options), 1000, image_options.step)):
-    static_cast<filter_t>(
-        bind(Filter, _1, _2, _3, cref(image_options), 1000));
+  const auto& image_options = options.image_options;
 
-  FPGACommunicator communicator(options.frequency,
-                                options.filename,
-                                image_options.total_size);
+  // カラー画像の全チャネル、またはパイプライン上の全フレームと、詰めた領域
+  // またはping-pongで保持する入力画像を格納する
+  const size_t frame_size = image_options.total_size * image_options.step;
+  const size_t frames_size =
+    frame_size * std::max<size_t>(options.pipeline_depth, 1);
+  // ビットストリームの書き込みに時間がかかるため、全てのボードを並行に開く
+  DevicePool boards(
+      options.board_count,
+      [&options](size_t card) { return MakeDevice(options, card); },
+      frames_size + options.roi_size.area() * image_options.step +
+        ((options.is_ping_pong)? frame_size : 0));
+
+  // 統計は全てのボードで共有する
+  Handshake handshake(options.wait_strategy, options.wait_timeout,
+                      options.is_refresh_acknowledged);
+
+  // クリックした座標.ボードへ送信し、領域だけをフィルタする場合は領域の
+  // 移動にも使う
+  MousePosition mouse;
+
+  vector<FilterStage> stages;
+  for (size_t i = 0; i < boards.size(); ++i) {
+    auto& communicator = boards[i];
+    stages.push_back(
+        MakeFilter(communicator, handshake, options, mouse, frames_size));
 
 //      filter_core::test(communicator, image_size, options->interpolation);
 
-  // 画像サイズを指定
-  SendImageSize(communicator,
-                image_options.total_size, image_options.width);
-
-  for (auto src :
-       Camera(
-           MakeConveter(
-               options.is_colored,
-               image_options.size, image_options.interpolation))) {
-    // マウスイベントを追加.
-    MouseEvent mouse_event(communicator, mouse_x, mouse_y, image_options.size);
-    setMouseCallback(frame_title, &HandleMouseEvent, &mouse_event);
-
-    if (options.is_debug_mode) {
-      filter(
-          // ユーザレジスタを表示
-          OutputUserRegisters(communicator), src, dst);
+    // 画像サイズを指定.領域だけをフィルタする場合は領域の大きさ
+    if (options.roi_size.area() > 0) {
+      SendImageSize(communicator,
+                    options.roi_size.area(), options.roi_size.width);
     } else {
-      // フレームレート計測
-      FramerateChecker framerate_checker(start);
-
-      filter(communicator, src, dst);
+      SendImageSize(communicator,
+                    image_options.total_size, image_options.width);
     }
+    SendColorLayout(communicator, options.color_layout);
+  }
 
-    // 出力
-    cv::Mat output = (options.is_with_captured)?
-      Combine(combined, dst, src, image_options.size) : dst;
-    cv::imshow(frame_title, output);
-
-    auto key = cv::waitKey(30);
-    if (key == 'p' || key == 'P') {
-      OutputImage(output, options.output_directory.c_str());
-    } else if (key == 'd' || key == 'D') {
-      std::cout << "\r";
-      OutputUserRegisters(communicator);
-      std::cout << std::endl;
-    } else if (key >= 0) {
-      break;
-    }
+  if (!options.batch_directory.empty()) {
+    RunBatch(boards, stages, options);
+  } else if (options.pipeline_depth > 0) {
+    RunPipelined(boards, stages, mouse, options);
+  } else {
+    RunSequential(boards[0], stages[0], mouse, options);
   }
   std::cout << std::endl;
+  // フレーム毎の起動と完了待ちにかかった時間
+  std::cout <<
+    "refresh (" <<
+      ((handshake.is_acknowledged())? "acknowledged" : "fixed delay") <<
+      "): " << handshake.refresh_statistics() << std::endl <<
+    "finish wait (" << ToString(options.wait_strategy) << "): " <<
+      handshake.finish_statistics() << std::endl <<
+    StageTracer::instance().report() << std::endl;
+
+  if (!options.trace_filename.empty())
+    { WriteTimeline(options.trace_filename); }
 
   return EXIT_SUCCESS;
 }
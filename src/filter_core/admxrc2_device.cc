@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/admxrc2_device.h"
+
+#include <admxrc2.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "filter_core/fpga_communicator.h"
+
+
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+using std::weak_ptr;
+using std::chrono::milliseconds;
+using std::this_thread::sleep_for;
+using filter_core::fpga_space_t;
+
+
+namespace filter_core {
+namespace admxrc2_device {
+
+constexpr size_t STATUS_REG_LCLKLOCKED = 0x1U << 0;
+constexpr size_t STATUS_REG_LCLKSTICKY = 0x1U << 1;
+constexpr size_t STATUS_REG_SHIFT_LOCKED = 8;
+constexpr size_t STATUS_REG_SHIFT_STICKY = 16;
+
+constexpr size_t MEMSTAT_REG_SHIFT_TRAINED = 0;
+
+constexpr size_t MODEx_REG_ZBTSSRAM_PIPELINE = 0x1U << 0;
+}  // namespace admxrc2_device
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace admxrc2_device {
+
+std::shared_ptr<uint8_t> AllocateBufferForDMA(size_t size);
+void CheckForMemoryLock(filter_core::fpga_space_t space,
+                        uint32_t lock_flag_number);
+void Configure(std::weak_ptr<ADMXRC2_HANDLE> handle,
+               const std::string& filename,
+               filter_core::fpga_space_t space);
+std::shared_ptr<ADMXRC2_HANDLE> GetCardHandle(int card);
+ADMXRC2_CARD_INFO GetCardInfo(std::weak_ptr<ADMXRC2_HANDLE> handle);
+BankInfo GetBankInfo(std::weak_ptr<ADMXRC2_HANDLE> handle,
+                     const ADMXRC2_CARD_INFO& info);
+filter_core::fpga_space_t GetFPGASpace(std::weak_ptr<ADMXRC2_HANDLE> handle);
+uint32_t GetLockFlagNumber(ADMXRC2_BOARD_TYPE type);
+double GetMemoryClockFrequency(ADMXRC2_BOARD_TYPE type);
+void ResetMemorySystem(filter_core::fpga_space_t space);
+bool SetClockRates(std::weak_ptr<ADMXRC2_HANDLE> handle,
+                   double local_clock,
+                   double memory_clock);
+void SetMemoryPortConfiguration(filter_core::fpga_space_t space);
+std::shared_ptr<ADMXRC2_DMADESC> SetupDMA(
+    std::shared_ptr<ADMXRC2_HANDLE> handle,
+    uint8_t* buffer,
+    size_t buffer_size);
+void WaitForLclkDcm(filter_core::fpga_space_t space);
+}  // namespace admxrc2_device
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace admxrc2_device {
+
+inline void SetRegister(filter_core::fpga_space_t space,
+                        uint32_t i,
+                        uint32_t value)
+  { space[i] = value; space[i]; }
+}  // namespace admxrc2_device
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace admxrc2_device {
+
+std::shared_ptr<uint8_t> AllocateBufferForDMA(size_t size) {
+  uint8_t* buffer = (uint8_t*) ADMXRC2_Malloc(size);
+
+  if (buffer != nullptr) {
+    return std::shared_ptr<uint8_t>(
+        buffer,
+        [](uint8_t* b) { if (b != nullptr) { ADMXRC2_Free(b); } });
+  } else {
+    throw runtime_error("failed to allocate buffer for DMA");
+  }
+}
+
+void CheckForMemoryLock(fpga_space_t space, unsigned int lock_flag_number) {
+  uint32_t mask = (1 << lock_flag_number) - 1;
+  uint32_t status = space[STATUS_REG];
+  uint32_t memstat = space[MEMSTAT_REG];
+
+  if (((status >> STATUS_REG_SHIFT_LOCKED) & mask) == 0)
+    { throw runtime_error("Not all memory lock flags asserted"); }
+  if (((memstat >> MEMSTAT_REG_SHIFT_TRAINED) & mask) == 0)
+    { throw runtime_error("Not all memory banks trained"); }
+
+  /* Clear sticky loss-of-lock / loss-of-trained bits */
+  space[STATUS_REG] = 0xffU << STATUS_REG_SHIFT_STICKY;
+  space[STATUS_REG];
+}
+
+void Configure(weak_ptr<ADMXRC2_HANDLE> handle,
+               const string& filename,
+               fpga_space_t space) {
+  auto status = ADMXRC2_ConfigureFromFile(*handle.lock(), filename.c_str());
+  if (status != ADMXRC2_SUCCESS) {
+    throw runtime_error(
+        string("failed to configure: ") + ADMXRC2_GetStatusString(status));
+  }
+}
+
+shared_ptr<ADMXRC2_HANDLE> GetCardHandle(int card) {
+  ADMXRC2_HANDLE handle;
+  auto status = ADMXRC2_OpenCard(card, &handle);
+
+  if (status == ADMXRC2_SUCCESS) {
+    return shared_ptr<ADMXRC2_HANDLE>(
+        new ADMXRC2_HANDLE(handle),
+        [](ADMXRC2_HANDLE* h) {
+          if (*h != ADMXRC2_HANDLE_INVALID_VALUE) { ADMXRC2_CloseCard(*h); }
+          delete h;
+          h = nullptr;
+        });
+  } else {
+    throw runtime_error(
+        string("failed to open card: ") + ADMXRC2_GetStatusString(status));
+  }
+}
+
+ADMXRC2_CARD_INFO GetCardInfo(weak_ptr<ADMXRC2_HANDLE> handle) {
+  ADMXRC2_CARD_INFO info;
+  auto status = ADMXRC2_GetCardInfo(*handle.lock(), &info);
+
+  if (status == ADMXRC2_SUCCESS) {
+    return info;
+  } else {
+    throw runtime_error(
+        string("failed to get card info: ") + ADMXRC2_GetStatusString(status));
+  }
+}
+
+BankInfo GetBankInfo(std::weak_ptr<ADMXRC2_HANDLE> handle,
+                     const ADMXRC2_CARD_INFO& info) {
+  BankInfo bank_info;
+
+  for (int i = 0; i < info.NumRAMBank && i < MAX_BANK; ++i) {
+    if (info.RAMBanksFitted & (0x1UL << i)) {
+      auto status = ADMXRC2_GetBankInfo(*handle.lock(), i, &bank_info[i]);
+      if (status != ADMXRC2_SUCCESS) {
+        throw runtime_error(string("failed to get bank info: ") +
+                            ADMXRC2_GetStatusString(status));
+      }
+    }
+  }
+
+  return std::move(bank_info);
+}
+
+fpga_space_t GetFPGASpace(weak_ptr<ADMXRC2_HANDLE> handle) {
+  ADMXRC2_SPACE_INFO info;
+  auto status = ADMXRC2_GetSpaceInfo(*handle.lock(), 0, &info);
+
+  if (status != ADMXRC2_SUCCESS || info.VirtualBase == NULL) {
+    throw runtime_error(
+        string("failed to get space info: ") + ADMXRC2_GetStatusString(status));
+  } else {
+    return static_cast<volatile uint32_t*>(info.VirtualBase);
+  }
+}
+
+uint32_t GetLockFlagNumber(ADMXRC2_BOARD_TYPE type) {
+  switch (type) {
+  case ADMXRC2_BOARD_ADMXRC2:
+    return 3;
+  case ADMXRC2_BOARD_ADMXRC4SX:
+    return 2;
+  default:
+    throw runtime_error("unsupported board");
+  }
+}
+
+double GetMemoryClockFrequency(ADMXRC2_BOARD_TYPE type) {
+  switch (type) {
+  case ADMXRC2_BOARD_ADMXRC2:
+    return 66.67;
+  case ADMXRC2_BOARD_ADMXRC4SX:
+    return 150.0;
+  default:
+    throw runtime_error("unsupported board");
+  }
+}
+
+void ResetMemorySystem(fpga_space_t space) {
+  SetRegister(space, MEMCTL_REG, 0x1U);
+  sleep_for(milliseconds(1));
+  SetRegister(space, MEMCTL_REG, 0x0U);
+  sleep_for(milliseconds(500));
+}
+
+bool SetClockRates(
+    weak_ptr<ADMXRC2_HANDLE> handle,
+    double local_clock,
+    double memory_clock) {
+  double actual_memory_clock_frequency, actual_locak_clock_frequency;
+
+  return ADMXRC2_SetClockRate(*handle.lock(),
+                              ADMXRC2_CLOCK_LCLK,
+                              local_clock * 1.0e6,
+                              &actual_locak_clock_frequency) ==
+           ADMXRC2_SUCCESS &&
+      ADMXRC2_SetClockRate(*handle.lock(),
+                           1,
+                           memory_clock * 1.0e6,
+                           &actual_memory_clock_frequency) == ADMXRC2_SUCCESS;
+}
+
+void SetMemoryPortConfiguration(fpga_space_t space) {
+  for (int i = 0; i < MAX_BANK; ++i)
+    { SetRegister(space, MODEx_REG(i), MODEx_REG_ZBTSSRAM_PIPELINE); }
+}
+
+shared_ptr<ADMXRC2_DMADESC> SetupDMA(shared_ptr<ADMXRC2_HANDLE> handle,
+                                     uint8_t* buffer,
+                                     size_t buffer_size) {
+  ADMXRC2_DMADESC descriptor;
+  auto status = ADMXRC2_SetupDMA(*handle, buffer, buffer_size, 0, &descriptor);
+
+  if (status == ADMXRC2_SUCCESS) {
+    return std::shared_ptr<ADMXRC2_DMADESC>(
+        new ADMXRC2_DMADESC(descriptor),
+        [handle](ADMXRC2_DMADESC* desc){
+          if (handle && *handle != ADMXRC2_HANDLE_INVALID_VALUE) {
+            ADMXRC2_UnsetupDMA(*handle, *desc);
+            delete desc;
+            desc = nullptr;
+          }
+        });
+  } else {
+    throw runtime_error(
+        string("failed to open DMA channels: ") +
+          ADMXRC2_GetStatusString(status));
+  }
+}
+
+void WaitForLclkDcm(fpga_space_t space) {
+  sleep_for(milliseconds(500));
+
+  uint32_t status = space[STATUS_REG];
+  if (status & STATUS_REG_LCLKLOCKED) {
+    SetRegister(space, STATUS_REG, STATUS_REG_LCLKSTICKY);
+  } else { throw runtime_error("LCLK DCM is not locked"); }
+}
+}  // namespace admxrc2_device
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief コンストラクタ.ボードを開き、ビットファイルで構成する.
+ *
+ * \param card カード番号
+ * \param local_clock_rate FPGAの動作周波数
+ * \param bitstream_filename ビットファイル名
+ */
+ADMXRC2Device::ADMXRC2Device(int card,
+                             double local_clock_rate,
+                             const string& bitstream_filename) {
+  namespace detail = admxrc2_device;
+
+  handle_ = detail::GetCardHandle(card);
+  info_ = detail::GetCardInfo(handle_);
+  space_ = detail::GetFPGASpace(handle_);
+  bank_info_ = detail::GetBankInfo(handle_, info_);
+
+  detail::SetClockRates(
+      handle_,
+      local_clock_rate,
+      detail::GetMemoryClockFrequency(info_.BoardType));
+  detail::Configure(handle_, bitstream_filename, space_);
+  detail::WaitForLclkDcm(space_);
+
+  dma_mode_ = ADMXRC2_BuildDMAModeWord(
+      info_.BoardType,
+      ADMXRC2_IOWIDTH_32,
+      0,
+      ADMXRC2_DMAMODE_USEREADY | ADMXRC2_DMAMODE_USEBTERM |
+        ADMXRC2_DMAMODE_BURSTENABLE);
+
+  detail::SetMemoryPortConfiguration(space_);
+  detail::ResetMemorySystem(space_);
+  detail::CheckForMemoryLock(space_,
+                             detail::GetLockFlagNumber(info_.BoardType));
+}
+/*!
+ * \brief ADMXRC2_Mallocでバッファを確保し、DMA転送のためにロックする.
+ * \param size バイト数
+ * \return バッファ
+ */
+shared_ptr<uint8_t> ADMXRC2Device::allocate(size_t size) {
+  namespace detail = admxrc2_device;
+
+  auto buffer = detail::AllocateBufferForDMA(size);
+  auto descriptor = detail::SetupDMA(handle_, buffer.get(), size);
+
+  std::lock_guard<std::mutex> lock(regions_mutex_);
+  regions_.erase(
+      std::remove_if(regions_.begin(), regions_.end(),
+                     [](const Region& r) { return r.descriptor.expired(); }),
+      regions_.end());
+  regions_.push_back(Region{buffer.get(), size, descriptor});
+
+  // ロックを解除してからバッファを解放する
+  return shared_ptr<uint8_t>(
+      buffer.get(),
+      [buffer, descriptor](uint8_t*) mutable {
+        descriptor.reset();
+        buffer.reset();
+      });
+}
+/*!
+ * \brief バッファとローカルアドレス間でDMA転送する.
+ * \param buffer バッファ内の転送元または転送先
+ * \param length バイト数
+ * \param local_address ローカルアドレス
+ * \param direction 転送方向
+ */
+void ADMXRC2Device::transfer(uint8_t* buffer,
+                             unsigned long length,
+                             unsigned long local_address,
+                             DMADirection direction) {
+  shared_ptr<ADMXRC2_DMADESC> descriptor;
+  unsigned long offset = 0;
+  {
+    std::lock_guard<std::mutex> lock(regions_mutex_);
+    for (const auto& r : regions_) {
+      if (buffer >= r.base && buffer + length <= r.base + r.size) {
+        descriptor = r.descriptor.lock();
+        offset = static_cast<unsigned long>(buffer - r.base);
+        break;
+      }
+    }
+  }
+  if (!descriptor)
+    { throw runtime_error("the buffer is not locked for DMA"); }
+
+  auto status = ADMXRC2_DoDMA(
+      *handle_,
+      *descriptor,
+      offset,
+      length,
+      local_address,
+      (direction == DMADirection::TO_LOCAL)?
+        ADMXRC2_PCITOLOCAL : ADMXRC2_LOCALTOPCI,
+      ADMXRC2_DMACHAN_ANY,
+      dma_mode_,
+      0, NULL, NULL);
+  if (status != ADMXRC2_SUCCESS) {
+    throw runtime_error(
+        string((direction == DMADirection::TO_LOCAL)?
+                 "failed to send data: " : "failed to get data: ") +
+          ADMXRC2_GetStatusString(status));
+  }
+}
+}  // namespace filter_core
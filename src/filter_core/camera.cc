@@ -7,13 +7,23 @@
 #include "filter_core/camera.h"
 
 #include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <exception>
 #include <memory>
 #include <stdexcept>
+#include <thread>
+#include "filter_core/fused_resize.h"
 #include "filter_core/program_options.h"
+#include "filter_core/stage_tracer.h"
+#include "filter_core/timeline.h"
 
 
 using std::unique_ptr;
 using std::runtime_error;
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
 using cv::cvtColor;
 using cv::imshow;
 using cv::Mat;
@@ -29,25 +39,128 @@ namespace filter_core {
  * \return コンバートされた画像.
  */
 Mat Grayscaler::convert(Mat src) {
-  cvtColor(src, color_converted_, CV_BGR2GRAY);
-  resize(color_converted_, output_, size_, interpolation_);
+  convert(src, output_);
 
   return output_;
 }
+/*!
+ * \brief 画像をコンバートし、指定した画像へ書き込む.
+ * \param src 入力画像.
+ * \param dst 出力先.サイズと型が一致していれば再確保されない.
+ */
+void Grayscaler::convert(Mat src, Mat dst) {
+  if (CanFuseResize(src, size_, interpolation_)) {
+    if (pool()) { fused_.resize(src, dst, *pool()); }
+    else { fused_.resize(src, dst); }
+    return;
+  }
+
+  cvtColor(src, color_converted_, CV_BGR2GRAY);
+  resize(color_converted_, dst, size_, 0, 0, interpolation_);
+}
 /*!
  * \brief 画像をリサイズする
  * \param src 入力画像.
  * \return リサイズされた画像.
  */
 Mat Resizer::convert(Mat src) {
-  resize(src, output_, size_, interpolation_);
+  convert(src, output_);
 
   return output_;
 }
+/*!
+ * \brief 画像をリサイズし、指定した画像へ書き込む
+ * \param src 入力画像.
+ * \param dst 出力先.サイズと型が一致していれば再確保されない.
+ */
+void Resizer::convert(Mat src, Mat dst) {
+  if (pool() && CanFuseResize(src, size_, interpolation_)) {
+    fused_.resize(src, dst, *pool());
+    return;
+  }
+
+  resize(src, dst, size_, 0, 0, interpolation_);
+}
 }  // namespace filter_core
 
 
 namespace filter_core {
+
+constexpr size_t Camera::NO_SLOT;
+
+/*!
+ * \brief コンストラクタ.カメラ0から先読みせずに取得する.
+ * \param converter コンバータ
+ */
+Camera::Camera(unique_ptr<Converter>&& converter)
+  : Camera(std::move(converter), unique_ptr<FrameSource>(new VideoSource(0)),
+           0, false) {}
+/*!
+ * \brief コンストラクタ.
+ * \param converter コンバータ
+ * \param source 入力
+ * \param prefetch_depth 先読みするフレーム数.0の場合は先読みしない
+ * \param is_paced ファイルからの入力を記録されたフレームレートで再生する場合は
+ *        真.偽の場合はできる限り速く読み込む
+ */
+Camera::Camera(unique_ptr<Converter>&& converter,
+               unique_ptr<FrameSource>&& source,
+               size_t prefetch_depth,
+               bool is_paced)
+  : source_(std::move(source)),
+    frame_(),
+    converter_(std::move(converter)),
+    has_pending_(false),
+    period_((is_paced && !source_->isLive() && source_->fps() > 0.0)?
+              duration_cast<steady_clock::duration>(
+                  duration<double>(1.0 / source_->fps())) :
+              steady_clock::duration::zero()),
+    start_(),
+    delivered_(0),
+    slots_(),
+    slot_names_(prefetch_depth),
+    free_(std::max<size_t>(prefetch_depth, 1)),
+    filled_(std::max<size_t>(prefetch_depth, 1)),
+    pending_(NO_SLOT),
+    current_(),
+    name_(),
+    error_(),
+    decoder_() {
+  for (size_t i = 0; i < prefetch_depth; ++i) {
+    slots_.emplace_back(converter_->size(), converter_->type());
+    free_.push(i);
+  }
+  if (!slots_.empty()) { decoder_ = std::thread(&Camera::decode, this); }
+}
+/*!
+ * \brief デストラクタ.先読みするスレッドを停止させる.
+ */
+Camera::~Camera() {
+  free_.close();
+  filled_.close();
+  if (decoder_.joinable()) { decoder_.join(); }
+}
+/*!
+ * \brief 次の画像を取得できる場合、真を返す.
+ *
+ * ファイルからの入力では、終端に達したかを知るために次の画像を読み込む.
+ * 先読みするスレッドで送出された例外は、ここで再送出される.
+ *
+ * \returns 取得できる場合、真
+ */
+bool Camera::isReady() {
+  if (slots_.empty()) {
+    if (!has_pending_) { has_pending_ = fetch(); }
+    return has_pending_;
+  }
+
+  if (pending_ == NO_SLOT && !filled_.pop(pending_)) {
+    pending_ = NO_SLOT;
+    if (error_) { std::rethrow_exception(error_); }
+    return false;
+  }
+  return true;
+}
 /*!
  * \brief フレームイテレータを返す
  * \return フレームイテレータ
@@ -63,8 +176,90 @@ FrameIterator Camera::end() { return FrameIterator(*this); }
  * \return キャプチャ画像
  */
 Mat Camera::get() {
-  if (capture_.read(frame_)) { return converter_->convert(frame_); }
-  else { throw std::runtime_error("failed to read a frame"); }
+  next();
+
+  if (slots_.empty()) {
+    name_ = source_->name();
+    ScopedStage stage(Stage::CONVERT);
+    return converter_->convert(frame_);
+  } else {
+    slots_[pending_].copyTo(current_);
+    name_.swap(slot_names_[pending_]);
+    free_.push(pending_);
+    pending_ = NO_SLOT;
+    return current_;
+  }
+}
+/*!
+ * \brief キャプチャ画像を取得し、指定した画像へ書き込む
+ * \param dst 出力先
+ */
+void Camera::get(Mat dst) {
+  next();
+
+  if (slots_.empty()) {
+    name_ = source_->name();
+    ScopedStage stage(Stage::CONVERT);
+    converter_->convert(frame_, dst);
+  } else {
+    slots_[pending_].copyTo(dst);
+    name_.swap(slot_names_[pending_]);
+    free_.push(pending_);
+    pending_ = NO_SLOT;
+  }
+}
+/*!
+ * \brief 入力から1フレームを読み込む
+ * \return 読み込めた場合は真.ファイルの終端に達した場合は偽
+ */
+bool Camera::fetch() {
+  ScopedStage stage(Stage::CAPTURE);
+
+  if (!source_->isOpened()) { return false; }
+  if (source_->read(frame_)) { return true; }
+  if (source_->isLive()) { throw std::runtime_error("failed to read a frame"); }
+  return false;
+}
+/*!
+ * \brief 次の画像が得られるまで待ち、実時間で再生する場合は時刻まで待つ.
+ *
+ * 先読みしない場合はframe_に、先読みする場合はslots_[pending_]に画像が得
+ * られる.
+ */
+void Camera::next() {
+  if (!isReady()) { throw std::runtime_error("no more frames"); }
+  has_pending_ = false;
+
+  if (period_ > steady_clock::duration::zero()) {
+    if (delivered_ == 0) {
+      start_ = steady_clock::now();
+    } else {
+      std::this_thread::sleep_until(
+          start_ + period_ * static_cast<steady_clock::rep>(delivered_));
+    }
+  }
+  ++delivered_;
+}
+/*!
+ * \brief 先読みするスレッドの処理.空いた画像へ読み込んで変換する.
+ */
+void Camera::decode() {
+  Timeline::instance().name_thread("decode");
+
+  try {
+    size_t slot = 0;
+    while (free_.pop(slot) && fetch()) {
+      slot_names_[slot] = source_->name();
+      {
+        ScopedStage stage(Stage::CONVERT);
+        converter_->convert(frame_, slots_[slot]);
+      }
+      if (!filled_.push(slot)) { break; }
+    }
+  } catch (...) {
+    error_ = std::current_exception();
+  }
+  filled_.close();
 }
 }  // namespace filter_core
 
@@ -83,5 +278,18 @@ unique_ptr<Converter> MakeConveter(
     return unique_ptr<Converter>(new Grayscaler(size, interpolation));
   }
 }
+/*!
+ * \brief 出力先を指定してコンバータを生成
+ * \param output 出力先
+ * \return コンバータ
+ */
+unique_ptr<Converter> MakeConveter(
+    bool is_colored, Mat output, int interpolation) {
+  if (is_colored) {
+    return unique_ptr<Converter>(new Resizer(output, interpolation));
+  } else {
+    return unique_ptr<Converter>(new Grayscaler(output, interpolation));
+  }
+}
 }  // namespace filter_core
 
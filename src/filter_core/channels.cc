@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/channels.h"
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <vector>
+
+
+using std::vector;
+using cv::Mat;
+
+
+namespace filter_core {
+namespace channels {
+
+void SplitRow(const uint8_t* src, uint8_t* b, uint8_t* g, uint8_t* r,
+              int begin, int end);
+void MergeRow(const uint8_t* b, const uint8_t* g, const uint8_t* r,
+              uint8_t* dst, int begin, int end);
+#ifdef FILTER_CORE_HAS_SSSE3_KERNELS
+int SplitRowSSSE3(const uint8_t* src, uint8_t* b, uint8_t* g, uint8_t* r,
+                  int width);
+int MergeRowSSSE3(const uint8_t* b, const uint8_t* g, const uint8_t* r,
+                  uint8_t* dst, int width);
+#endif
+}  // namespace channels
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace channels {
+
+void SplitRow(const uint8_t* src, uint8_t* b, uint8_t* g, uint8_t* r,
+              int begin, int end) {
+  for (int x = begin; x < end; ++x) {
+    b[x] = src[x * CHANNEL + 0];
+    g[x] = src[x * CHANNEL + 1];
+    r[x] = src[x * CHANNEL + 2];
+  }
+}
+
+void MergeRow(const uint8_t* b, const uint8_t* g, const uint8_t* r,
+              uint8_t* dst, int begin, int end) {
+  for (int x = begin; x < end; ++x) {
+    dst[x * CHANNEL + 0] = b[x];
+    dst[x * CHANNEL + 1] = g[x];
+    dst[x * CHANNEL + 2] = r[x];
+  }
+}
+
+#ifdef FILTER_CORE_HAS_SSSE3_KERNELS
+ShuffleMasks::ShuffleMasks() {
+  alignas(16) int8_t m[VECTOR_WIDTH];
+  for (int c = 0; c < CHANNEL; ++c) {
+    for (int q = 0; q < CHANNEL; ++q) {
+      for (int i = 0; i < VECTOR_WIDTH; ++i) {
+        int s = i * CHANNEL + c;
+        m[i] = (s / VECTOR_WIDTH == q)? s % VECTOR_WIDTH : -0x80;
+      }
+      split[c][q] = _mm_load_si128(reinterpret_cast<const __m128i*>(m));
+    }
+  }
+  for (int q = 0; q < CHANNEL; ++q) {
+    for (int c = 0; c < CHANNEL; ++c) {
+      for (int i = 0; i < VECTOR_WIDTH; ++i) {
+        int t = q * VECTOR_WIDTH + i;
+        m[i] = (t % CHANNEL == c)? t / CHANNEL : -0x80;
+      }
+      merge[q][c] = _mm_load_si128(reinterpret_cast<const __m128i*>(m));
+    }
+  }
+}
+
+const ShuffleMasks& GetShuffleMasks() {
+  static const ShuffleMasks masks;
+  return masks;
+}
+
+bool HasSSSE3() {
+  static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+  return has_ssse3;
+}
+
+bool HasAVX2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+
+__attribute__((target("ssse3")))
+int SplitRowSSSE3(const uint8_t* src, uint8_t* b, uint8_t* g, uint8_t* r,
+                  int width) {
+  const auto& masks = GetShuffleMasks();
+  uint8_t* planes[CHANNEL] = {b, g, r};
+
+  int x = 0;
+  for (; x + VECTOR_WIDTH <= width; x += VECTOR_WIDTH) {
+    const __m128i* p = reinterpret_cast<const __m128i*>(src + x * CHANNEL);
+    const __m128i v[CHANNEL] =
+      {_mm_loadu_si128(p), _mm_loadu_si128(p + 1), _mm_loadu_si128(p + 2)};
+    for (int c = 0; c < CHANNEL; ++c) {
+      __m128i out = _mm_or_si128(
+          _mm_or_si128(_mm_shuffle_epi8(v[0], masks.split[c][0]),
+                       _mm_shuffle_epi8(v[1], masks.split[c][1])),
+          _mm_shuffle_epi8(v[2], masks.split[c][2]));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[c] + x), out);
+    }
+  }
+  return x;
+}
+
+__attribute__((target("ssse3")))
+int MergeRowSSSE3(const uint8_t* b, const uint8_t* g, const uint8_t* r,
+                  uint8_t* dst, int width) {
+  const auto& masks = GetShuffleMasks();
+
+  int x = 0;
+  for (; x + VECTOR_WIDTH <= width; x += VECTOR_WIDTH) {
+    const __m128i v[CHANNEL] = {
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x)),
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + x)),
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + x))};
+    __m128i* p = reinterpret_cast<__m128i*>(dst + x * CHANNEL);
+    for (int q = 0; q < CHANNEL; ++q) {
+      __m128i out = _mm_or_si128(
+          _mm_or_si128(_mm_shuffle_epi8(v[0], masks.merge[q][0]),
+                       _mm_shuffle_epi8(v[1], masks.merge[q][1])),
+          _mm_shuffle_epi8(v[2], masks.merge[q][2]));
+      _mm_storeu_si128(p + q, out);
+    }
+  }
+  return x;
+}
+#endif
+}  // namespace channels
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief BGR画像を各チャネルの画像へ分解する.
+ *
+ * CV_8UC3はSSSE3が使える場合はSSSE3で分解する.それ以外の型はcv::splitと
+ * 同じ.出力先は確保済みであること.
+ *
+ * \param src 入力画像
+ * \param planes 各チャネルの出力画像
+ */
+void SplitChannels(Mat src, vector<Mat>& planes) {
+  namespace detail = channels;
+
+  if (src.type() != CV_8UC3) {
+    cv::split(src, planes);
+    return;
+  }
+
+  for (int y = 0; y < src.rows; ++y) {
+    const uint8_t* s = src.ptr<uint8_t>(y);
+    uint8_t* b = planes[0].ptr<uint8_t>(y);
+    uint8_t* g = planes[1].ptr<uint8_t>(y);
+    uint8_t* r = planes[2].ptr<uint8_t>(y);
+
+    int x = 0;
+#ifdef FILTER_CORE_HAS_SSSE3_KERNELS
+    if (detail::HasSSSE3()) { x = detail::SplitRowSSSE3(s, b, g, r, src.cols); }
+#endif
+    detail::SplitRow(s, b, g, r, x, src.cols);
+  }
+}
+/*!
+ * \brief 各チャネルの画像をBGR画像へ合成する.
+ *
+ * CV_8UC3はSSSE3が使える場合はSSSE3で合成する.それ以外の型はcv::mergeと
+ * 同じ.出力先は確保済みであること.
+ *
+ * \param planes 各チャネルの入力画像
+ * \param dst 出力画像
+ */
+void MergeChannels(const vector<Mat>& planes, Mat dst) {
+  namespace detail = channels;
+
+  if (dst.type() != CV_8UC3) {
+    cv::merge(planes, dst);
+    return;
+  }
+
+  for (int y = 0; y < dst.rows; ++y) {
+    const uint8_t* b = planes[0].ptr<uint8_t>(y);
+    const uint8_t* g = planes[1].ptr<uint8_t>(y);
+    const uint8_t* r = planes[2].ptr<uint8_t>(y);
+    uint8_t* d = dst.ptr<uint8_t>(y);
+
+    int x = 0;
+#ifdef FILTER_CORE_HAS_SSSE3_KERNELS
+    if (detail::HasSSSE3()) { x = detail::MergeRowSSSE3(b, g, r, d, dst.cols); }
+#endif
+    detail::MergeRow(b, g, r, d, x, dst.cols);
+  }
+}
+}  // namespace filter_core
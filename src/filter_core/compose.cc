@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/compose.h"
+
+#include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <string>
+#include "filter_core/stage_tracer.h"
+
+
+using std::string;
+using cv::Mat;
+using cv::Rect;
+using cv::Size;
+
+
+namespace filter_core {
+namespace compose {
+
+void CopyTo(cv::Mat src, cv::Mat dst);
+}  // namespace compose
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace compose {
+/*!
+ * \brief 画像をコピーする.既に同じ領域を参照している場合は何もしない.
+ * \param src コピー元
+ * \param dst コピー先
+ */
+void CopyTo(Mat src, Mat dst) {
+  if (src.data != dst.data) { src.copyTo(dst); }
+}
+}  // namespace compose
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief 構成に必要な画像サイズを返す.
+ * \param layout 構成
+ * \param size フィルタ画像のサイズ
+ * \return 画像サイズ
+ */
+Size GetCanvasSize(ComposeLayout layout, Size size) {
+  switch (layout) {
+    case ComposeLayout::SIDE_BY_SIDE:
+      return Size(size.width * 2, size.height);
+    case ComposeLayout::DIFFERENCE:
+      return Size(size.width, size.height * 3);
+    case ComposeLayout::FILTERED:
+    case ComposeLayout::STACKED:
+      return Size(size.width, size.height * 2);
+  }
+  return size;
+}
+/*!
+ * \brief 表示する画像のサイズを返す.
+ * \param layout 構成
+ * \param size フィルタ画像のサイズ
+ * \return 画像サイズ
+ */
+Size GetShownSize(ComposeLayout layout, Size size) {
+  switch (layout) {
+    case ComposeLayout::SIDE_BY_SIDE:
+      return Size(size.width * 2, size.height);
+    case ComposeLayout::STACKED:
+      return Size(size.width, size.height * 2);
+    case ComposeLayout::FILTERED:
+    case ComposeLayout::DIFFERENCE:
+      return size;
+  }
+  return size;
+}
+/*!
+ * \brief 画像を構成に従って領域に分ける.
+ *
+ * 元画像を取り込む領域が要るため、フィルタ画像だけを表示する場合も元画像
+ * の領域を下に持つ.
+ *
+ * \param image GetCanvasSizeの大きさの画像
+ * \param layout 構成
+ * \param size フィルタ画像のサイズ
+ * \return 領域
+ */
+Canvas MakeCanvas(Mat image, ComposeLayout layout, Size size) {
+  if (image.size() != GetCanvasSize(layout, size))
+    { throw std::invalid_argument("the canvas does not fit the layout"); }
+
+  const int w = size.width;
+  const int h = size.height;
+
+  Canvas canvas;
+  canvas.image = image;
+  canvas.filtered = image(Rect(0, 0, w, h));
+  if (layout == ComposeLayout::SIDE_BY_SIDE) {
+    canvas.original = image(Rect(w, 0, w, h));
+  } else {
+    canvas.original = image(Rect(0, h, w, h));
+  }
+  if (layout == ComposeLayout::DIFFERENCE)
+    { canvas.difference = image(Rect(0, h * 2, w, h)); }
+
+  canvas.shown =
+    (layout == ComposeLayout::FILTERED)? canvas.filtered :
+    (layout == ComposeLayout::DIFFERENCE)? canvas.difference :
+    image;
+  return canvas;
+}
+/*!
+ * \brief フィルタ画像と元画像の領域がそれぞれ連続したメモリであるかを返す.
+ *
+ * 連続していれば、DMA転送で直接読み書きできる.
+ *
+ * \param canvas 領域
+ * \return 連続していれば真
+ */
+bool IsContinuous(const Canvas& canvas) {
+  return canvas.filtered.isContinuous() && canvas.original.isContinuous();
+}
+/*!
+ * \brief 領域に書き込まれたフィルタ画像と元画像から表示する画像を作る.
+ *
+ * 差の表示以外では何もしない.
+ *
+ * \param canvas 領域
+ * \param layout 構成
+ */
+void Compose(Canvas& canvas, ComposeLayout layout) {
+  if (layout != ComposeLayout::DIFFERENCE) { return; }
+
+  ScopedStage stage(Stage::COMPOSE);
+  cv::absdiff(canvas.filtered, canvas.original, canvas.difference);
+}
+/*!
+ * \brief フィルタ画像と元画像を領域へコピーし、表示する画像を作る.
+ *
+ * 既に領域を参照している画像はコピーしない.
+ *
+ * \param canvas 領域
+ * \param layout 構成
+ * \param filtered フィルタ画像
+ * \param original 元画像
+ */
+void Compose(Canvas& canvas, ComposeLayout layout,
+             Mat filtered, Mat original) {
+  namespace detail = compose;
+
+  {
+    ScopedStage stage(Stage::COMPOSE);
+    detail::CopyTo(filtered, canvas.filtered);
+    if (layout != ComposeLayout::FILTERED)
+      { detail::CopyTo(original, canvas.original); }
+  }
+  Compose(canvas, layout);
+}
+/*!
+ * \brief 名前から構成を返す.
+ * \param s 'filtered'、'side-by-side'、'stacked'、'difference'のいずれか
+ * \return 構成
+ */
+ComposeLayout GetComposeLayout(const string& s) {
+  if (s == "filtered") { return ComposeLayout::FILTERED; }
+  else if (s == "side-by-side") { return ComposeLayout::SIDE_BY_SIDE; }
+  else if (s == "stacked") { return ComposeLayout::STACKED; }
+  else if (s == "difference") { return ComposeLayout::DIFFERENCE; }
+  else { throw std::invalid_argument("unknown layout: " + s); }
+}
+/*!
+ * \brief 構成の名前を返す.
+ * \param layout 構成
+ * \return 名前
+ */
+string ToString(ComposeLayout layout) {
+  switch (layout) {
+    case ComposeLayout::FILTERED: return "filtered";
+    case ComposeLayout::SIDE_BY_SIDE: return "side-by-side";
+    case ComposeLayout::STACKED: return "stacked";
+    case ComposeLayout::DIFFERENCE: return "difference";
+  }
+  return "";
+}
+}  // namespace filter_core
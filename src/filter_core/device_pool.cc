@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/device_pool.h"
+
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+
+using std::shared_ptr;
+
+
+namespace filter_core {
+/*!
+ * \brief コンストラクタ.全てのボードを並行に開き、通信を確立する.
+ *
+ * いずれかのボードを開けなかった場合は、全てのボードの処理を待ってから例
+ * 外を送出する.
+ *
+ * \param count ボードの数
+ * \param factory カードの番号からデバイスを開く関数
+ * \param buffer_size 各ボードでDMA転送する配列の最大長
+ */
+DevicePool::DevicePool(size_t count, factory_t factory, size_t buffer_size)
+  : communicators_() {
+  if (count == 0) { throw std::invalid_argument("no boards to open"); }
+
+  std::vector<std::future<shared_ptr<Device>>> devices;
+  for (size_t i = 0; i < count; ++i)
+    { devices.push_back(std::async(std::launch::async, factory, i)); }
+
+  for (auto& device : devices) { device.wait(); }
+  for (auto& device : devices) {
+    communicators_.emplace_back(
+        new FPGACommunicator(device.get(), buffer_size));
+  }
+}
+}  // namespace filter_core
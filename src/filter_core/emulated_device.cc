@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/emulated_device.h"
+
+#include <admxrc2.h>
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "filter_core/fpga_communicator.h"
+#include "filter_core/reference_filter.h"
+
+
+using std::runtime_error;
+using std::shared_ptr;
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+using std::this_thread::sleep_until;
+using cv::Mat;
+
+
+namespace filter_core {
+/*!
+ * \brief コンストラクタ.フィルタを実行するスレッドを開始する.
+ * \param filter 参照用のフィルタ
+ * \param latency enable信号が有効になってからfinish信号が有効になるまでの
+ *                最小時間
+ * \param bandwidth DMA転送の帯域(バイト/秒).0は無制限
+ * \param bank_count SRAMバンク数
+ * \param bank_size 1バンクのバイト数
+ */
+EmulatedDevice::EmulatedDevice(ReferenceFilter filter,
+                               microseconds latency,
+                               double bandwidth,
+                               size_t bank_count,
+                               size_t bank_size)
+  : info_(),
+    filter_(filter),
+    latency_(latency),
+    bandwidth_(bandwidth),
+    registers_(),
+    memory_mutex_(),
+    banks_(std::min(bank_count, MAX_BANK), std::vector<uint8_t>(bank_size)),
+    state_mutex_(),
+    state_changed_(),
+    requested_(0),
+    completed_(0),
+    is_closed_(false),
+    input_(),
+    previous_(),
+    output_(),
+    worker_() {
+  std::memset(&info_, 0, sizeof(info_));
+  info_.BoardType = ADMXRC2_BOARD_ADMXRC2;
+  info_.NumRAMBank = banks_.size();
+  info_.RAMBanksFitted = (0x1UL << banks_.size()) - 1;
+
+  for (auto& r : registers_) { r = 0; }
+
+  worker_ = std::thread(&EmulatedDevice::work, this);
+}
+/*!
+ * \brief デストラクタ.フィルタを実行するスレッドを停止する.
+ */
+EmulatedDevice::~EmulatedDevice() {
+  {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    is_closed_ = true;
+  }
+  state_changed_.notify_all();
+  worker_.join();
+}
+/*!
+ * \brief バンク情報を返す.模擬されるのはバンクの有無と大きさのみ.1語は
+ *        32ビットとする.
+ * \return バンク情報
+ */
+BankInfo EmulatedDevice::bank_info() const {
+  BankInfo bank_info;
+  std::memset(&bank_info, 0, sizeof(bank_info));
+  for (size_t i = 0; i < banks_.size(); ++i) {
+    bank_info[i].Fitted = 1;
+    bank_info[i].Width = 32;
+    bank_info[i].Size = banks_[i].size() / 4;
+  }
+
+  return bank_info;
+}
+/*!
+ * \brief レジスタを読み込む.
+ * \param i インデックス
+ * \return レジスタの値.存在しないレジスタは0
+ */
+uint32_t EmulatedDevice::get(size_t i) {
+  return (i < registers_.size())? registers_[i].load() : 0;
+}
+/*!
+ * \brief レジスタへ書き込む.
+ *
+ * enable信号が有効になった時点でフィルタの実行を要求し、無効になった時点で
+ * finish信号を無効にする.refresh信号には直ちにREFRESH_ACK_REGで応答する.
+ *
+ * \param i インデックス
+ * \param v 書き込む値
+ */
+void EmulatedDevice::set(size_t i, uint32_t v) {
+  if (i >= registers_.size()) { return; }
+
+  uint32_t previous = registers_[i].exchange(v);
+  if (i == REFRESH_REG) { registers_[REFRESH_ACK_REG] = (v != 0); }
+  if (i == ENABLE_REG) {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    if (v != 0 && previous == 0) {
+      ++requested_;
+      state_changed_.notify_all();
+    } else if (v == 0) {
+      registers_[FINISH_REG] = 0;
+    }
+  }
+}
+/*!
+ * \brief バッファを確保する.
+ * \param size バイト数
+ * \return バッファ
+ */
+shared_ptr<uint8_t> EmulatedDevice::allocate(size_t size) {
+  return shared_ptr<uint8_t>(new uint8_t[size](),
+                             std::default_delete<uint8_t[]>());
+}
+/*!
+ * \brief BANK_REGとPAGE_REGで選択された領域との間でコピーする.
+ *
+ * 帯域が設定されている場合は、その帯域での転送時間が経つまで戻らない.
+ *
+ * \param buffer 転送元または転送先
+ * \param length バイト数
+ * \param local_address ローカルアドレス
+ * \param direction 転送方向
+ */
+void EmulatedDevice::transfer(uint8_t* buffer,
+                              unsigned long length,
+                              unsigned long local_address,
+                              DMADirection direction) {
+  const auto start = steady_clock::now();
+  const uint32_t bank = registers_[BANK_REG] & 0xfU;
+  const uint64_t page = registers_[PAGE_REG] & PAGE_REG_PAGEMASK;
+
+  if (local_address < MEMORY_WINDOW_ADDRESS ||
+      local_address - MEMORY_WINDOW_ADDRESS + length > PAGE_SIZE)
+    { throw runtime_error("the transfer is outside the memory window"); }
+  if (bank >= banks_.size())
+    { throw runtime_error("the bank is not fitted"); }
+
+  const uint64_t offset =
+    (page << PAGE_SHIFT) + (local_address - MEMORY_WINDOW_ADDRESS);
+  {
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    auto& memory = banks_[bank];
+    if (offset + length > memory.size())
+      { throw runtime_error("the transfer exceeds the bank"); }
+
+    if (direction == DMADirection::TO_LOCAL) {
+      std::memcpy(memory.data() + offset, buffer, length);
+    } else {
+      std::memcpy(buffer, memory.data() + offset, length);
+    }
+  }
+
+  if (bandwidth_ > 0.0) {
+    sleep_until(start + duration_cast<steady_clock::duration>(
+                  duration<double>(length / bandwidth_)));
+  }
+}
+/*!
+ * \brief finish信号が有効になるまで待つ.
+ * \param timeout 最大待ち時間
+ * \return タイムアウトまでにfinish信号が有効になれば真
+ */
+bool EmulatedDevice::wait_interrupt(microseconds timeout) {
+  std::unique_lock<std::mutex> lock(state_mutex_);
+  return state_changed_.wait_for(
+      lock, timeout, [this] { return registers_[FINISH_REG] != 0; });
+}
+/*!
+ * \brief フィルタの実行要求を処理する.
+ *
+ * 実行中にenable信号が無効にされた要求では、finish信号を有効にしない.
+ */
+void EmulatedDevice::work() {
+  std::unique_lock<std::mutex> lock(state_mutex_);
+  while (true) {
+    state_changed_.wait(
+        lock, [this] { return is_closed_ || requested_ > completed_; });
+    if (is_closed_) { break; }
+
+    const uint64_t request = requested_;
+    lock.unlock();
+    run();
+    lock.lock();
+
+    completed_ = request;
+    if (requested_ == request && registers_[ENABLE_REG] != 0) {
+      registers_[FINISH_REG] = 1;
+      state_changed_.notify_all();
+    }
+  }
+}
+/*!
+ * \brief フィルタを実行する.
+ *
+ * BANK_PAIR_REGで選択された入力バンクの先頭の画像にフィルタをかけ、出力
+ * バンクへ書き込む.BANK_SWAP_REGが有効であれば、対の入力と出力を入れ替え
+ * る.HISTORY_LENGTH_REGが有効であれば、HISTORY_FRAMEx_REG(0)の位置の今回
+ * のフレームにフィルタをかけ、2以上であればHISTORY_FRAMEx_REG(1)の位置の
+ * 前回のフレームも時間方向のフィルタに渡す.画像の大きさはIMAGE_SIZE_REG
+ * とIMAGE_WIDTH_REGで、配置はCOLOR_LAYOUT_REGで決まる.処理時間が設定より
+ * 短い場合は、その時間が経つまで戻らない.
+ */
+void EmulatedDevice::run() {
+  const auto start = steady_clock::now();
+
+  const uint32_t pair = registers_[BANK_PAIR_REG];
+  const size_t swap = (registers_[BANK_SWAP_REG] != 0)? 1 : 0;
+  const size_t output = pair * 2 + (swap ^ 1);
+  const uint32_t current = registers_[HISTORY_FRAMEx_REG(0)];
+  const uint32_t previous = registers_[HISTORY_FRAMEx_REG(1)];
+  const uint32_t history_length = registers_[HISTORY_LENGTH_REG];
+  const bool is_history = history_length != 0;
+  const bool has_previous = history_length >= 2;
+  const size_t input = (is_history)? current >> 24 : pair * 2 + swap;
+  const size_t offset = (is_history)? current & 0xffffffU : 0;
+  const size_t previous_input = previous >> 24;
+  const size_t previous_offset = previous & 0xffffffU;
+  const int width = std::max<uint32_t>(registers_[IMAGE_WIDTH_REG], 1);
+  const int height = registers_[IMAGE_SIZE_REG] / width;
+  const auto layout =
+    static_cast<ColorLayout>(registers_[COLOR_LAYOUT_REG].load());
+  const size_t channel = (layout == ColorLayout::MONOCHROME)? 1 : 3;
+  const size_t plane_size = static_cast<size_t>(width) * height;
+  const size_t size = plane_size * channel;
+
+  const bool is_previous_valid = has_previous &&
+    previous_input < banks_.size() &&
+    previous_offset + size <= banks_[previous_input].size();
+  if (std::max(input, output) < banks_.size() &&
+      offset + size <= banks_[input].size()) {
+    input_.resize(size);
+    previous_.resize((is_previous_valid)? size : 0);
+    output_.resize(size);
+    {
+      std::lock_guard<std::mutex> lock(memory_mutex_);
+      const auto begin = banks_[input].begin() + offset;
+      std::copy(begin, begin + size, input_.begin());
+      if (is_previous_valid) {
+        const auto p = banks_[previous_input].begin() + previous_offset;
+        std::copy(p, p + size, previous_.begin());
+      }
+    }
+
+    // 前回のフレームがなければ空の画像を渡す
+    auto previous_plane = [&](int type, size_t plane_offset) {
+      return (is_previous_valid)?
+        Mat(height, width, type, previous_.data() + plane_offset) : Mat();
+    };
+    if (layout == ColorLayout::INTERLEAVED) {
+      ApplyTemporalReferenceFilter(
+          filter_,
+          Mat(height, width, CV_8UC3, input_.data()),
+          previous_plane(CV_8UC3, 0),
+          Mat(height, width, CV_8UC3, output_.data()));
+    } else {
+      for (size_t i = 0; i < channel; ++i) {
+        ApplyTemporalReferenceFilter(
+            filter_,
+            Mat(height, width, CV_8UC1, input_.data() + i * plane_size),
+            previous_plane(CV_8UC1, i * plane_size),
+            Mat(height, width, CV_8UC1, output_.data() + i * plane_size));
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(memory_mutex_);
+      std::copy(output_.begin(), output_.end(), banks_[output].begin());
+    }
+  }
+
+  sleep_until(start + latency_);
+}
+}  // namespace filter_core
@@ -0,0 +1,643 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/filter.h"
+
+#include "filter_core/channels.h"
+#include "filter_core/stage_tracer.h"
+
+#include <boost/optional.hpp>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+using std::runtime_error;
+using std::vector;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using cv::Mat;
+
+
+namespace filter_core {
+namespace filter_detail {
+
+/*!
+ * \var PING_PONG_BANK_COUNT
+ * ピンポン転送で使用するバンク数.入出力の対が2組
+ */
+constexpr uint32_t PING_PONG_BANK_COUNT = 4;
+
+inline uint32_t InputBank(uint32_t pair) { return pair * 2; }
+inline uint32_t OutputBank(uint32_t pair) { return pair * 2 + 1; }
+
+/*!
+ * \var MINIMUM_STRIPE_ROWS
+ * ハイブリッド実行でFPGAとCPUのそれぞれに割り当てる最小の行数.両者の速さ
+ * を測り続けるため、一方に全ての行を割り当てることはしない
+ */
+constexpr int MINIMUM_STRIPE_ROWS = 8;
+/*!
+ * \var RATIO_SMOOTHING
+ * 測った時間から求めた分け方へ、1フレームで近づける割合
+ */
+constexpr double RATIO_SMOOTHING = 0.25;
+
+/*!
+ * \brief FPGAへ送る行の割合から、FPGAがフィルタする行数を求める.
+ * \param ratio FPGAへ送る行の割合
+ * \param height 画像の高さ
+ * \return 行数
+ */
+inline int GetFpgaRows(double ratio, int height) {
+  const int minimum = std::min(MINIMUM_STRIPE_ROWS, height / 2);
+  const int rows = static_cast<int>(std::lround(ratio * height));
+  return std::min(std::max(rows, minimum), height - minimum);
+}
+
+void Upload(filter_core::FPGACommunicator& com, cv::Mat src,
+            const filter_core::ImageOptions& options,
+            filter_core::ColorLayout layout,
+            uint64_t offset, uint32_t bank);
+void Download(filter_core::FPGACommunicator& com, cv::Mat dst,
+              const filter_core::ImageOptions& options,
+              filter_core::ColorLayout layout,
+              uint32_t bank);
+std::vector<std::pair<uint32_t, uint64_t>> GetHistorySlots(
+    const filter_core::FPGACommunicator& com, unsigned long frame_size,
+    size_t length);
+void CopyOutside(cv::Mat src, cv::Mat dst, cv::Rect r);
+}  // namespace filter_detail
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace filter_detail {
+/*!
+ * \brief 画像をSRAMへ送信する.平面に分解するカラー画像はDMAバッファ上で分
+ *        解してから送信する.
+ * \param com FPGAボードとのコミュニケータ
+ * \param src 入力画像
+ * \param options 画像の設定
+ * \param layout SRAM上の画像の配置
+ * \param offset バンク内のバイトオフセット
+ * \param bank バンク
+ */
+void Upload(FPGACommunicator& com, Mat src,
+            const ImageOptions& options, ColorLayout layout,
+            uint64_t offset, uint32_t bank) {
+  const int channel = options.step;
+  const unsigned long length = options.total_size * channel;
+
+  if (layout != ColorLayout::PLANAR) {
+    com.write(src.data, offset, length, bank);
+    return;
+  }
+
+  vector<Mat> splitted;
+  for (int i = 0; i < channel; ++i) {
+    splitted.push_back(
+        com.write_buffer(options.size, CV_8UC1, i * options.total_size));
+  }
+  SplitChannels(src, splitted);
+  com.write(splitted.front().data, offset, length, bank);
+}
+/*!
+ * \brief バンクの先頭の画像を取得する.平面に分解するカラー画像はDMAバッ
+ *        ファ上へ取得してから合成する.
+ * \param com FPGAボードとのコミュニケータ
+ * \param dst 出力画像
+ * \param options 画像の設定
+ * \param layout SRAM上の画像の配置
+ * \param bank バンク
+ */
+void Download(FPGACommunicator& com, Mat dst,
+              const ImageOptions& options, ColorLayout layout,
+              uint32_t bank) {
+  const int channel = options.step;
+  const unsigned long length = options.total_size * channel;
+
+  if (layout != ColorLayout::PLANAR) {
+    com.read(dst.data, 0, length, bank);
+    return;
+  }
+
+  vector<Mat> filtered;
+  for (int i = 0; i < channel; ++i) {
+    filtered.push_back(
+        com.read_buffer(options.size, CV_8UC1, i * options.total_size));
+  }
+  com.read(filtered.front().data, 0, length, bank);
+  MergeChannels(filtered, dst);
+}
+/*!
+ * \brief 空いているバンクにフレームの置き場所を割り当てる.
+ *
+ * バンク0、1はフィルタの入出力に使うため、バンク2以降の搭載されている
+ * バンクを番号順に使う.HISTORY_FRAMEx_REGで表せるよう、オフセットは24ビッ
+ * トに収める.
+ *
+ * \param com FPGAボードとのコミュニケータ
+ * \param frame_size 1フレームのバイト数
+ * \param length 置き場所の数
+ * \return バンクとオフセット
+ */
+std::vector<std::pair<uint32_t, uint64_t>> GetHistorySlots(
+    const FPGACommunicator& com, unsigned long frame_size, size_t length) {
+  constexpr uint64_t OFFSET_LIMIT = 1ULL << 24;
+
+  std::vector<std::pair<uint32_t, uint64_t>> slots;
+  for (uint32_t bank = 2;
+       bank < com.info_.NumRAMBank && bank < MAX_BANK && slots.size() < length;
+       ++bank) {
+    if ((com.info_.RAMBanksFitted & (0x1UL << bank)) == 0) { continue; }
+
+    // 1語はWidthビット、バンクはSize語
+    const auto& info = com.bank_info_[bank];
+    const uint64_t capacity = std::min<uint64_t>(
+        static_cast<uint64_t>(info.Size) * info.Width / 8, OFFSET_LIMIT);
+    for (uint64_t offset = 0;
+         offset + frame_size <= capacity && slots.size() < length;
+         offset += frame_size)
+      { slots.emplace_back(bank, offset); }
+  }
+
+  if (slots.size() < length) {
+    throw runtime_error(
+        "the spare SRAM banks hold only " + std::to_string(slots.size()) +
+        " frames");
+  }
+  return slots;
+}
+/*!
+ * \brief 矩形の外側の画素だけをコピーする.
+ *
+ * 矩形より上と下の行は行全体を、矩形と重なる行は左右の部分をコピーする.
+ *
+ * \param src コピー元の画像
+ * \param dst コピー先の画像.コピー元と同じサイズ、同じ型
+ * \param r コピーしない矩形.画像に収まること
+ */
+void CopyOutside(Mat src, Mat dst, cv::Rect r) {
+  const cv::Rect parts[] = {
+    cv::Rect(0, 0, src.cols, r.y),
+    cv::Rect(0, r.br().y, src.cols, src.rows - r.br().y),
+    cv::Rect(0, r.y, r.x, r.height),
+    cv::Rect(r.br().x, r.y, src.cols - r.br().x, r.height)
+  };
+  for (const auto& part : parts) {
+    if (part.area() > 0) { src(part).copyTo(dst(part)); }
+  }
+}
+}  // namespace filter_detail
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief コンストラクタ.
+ * \param com FPGAボードとのコミュニケータ
+ * \param options 画像の設定
+ * \param handshake FPGAの起動と完了待ちの手順
+ * \param buffer_offset 入力画像を保持する画像のDMAバッファ上のオフセット
+ */
+PingPongFilter::PingPongFilter(FPGACommunicator& com,
+                               const ImageOptions& options,
+                               Handshake& handshake,
+                               size_t buffer_offset)
+  : options_(options),
+    handshake_(handshake),
+    pair_(0),
+    is_pending_(false),
+    held_(com.write_buffer(options.size, options.type, buffer_offset)) {
+  for (uint32_t i = 0; i < filter_detail::PING_PONG_BANK_COUNT; ++i) {
+    if (i >= com.info_.NumRAMBank ||
+        (com.info_.RAMBanksFitted & (0x1UL << i)) == 0)
+      { throw runtime_error("ping-pong mode needs four SRAM banks"); }
+  }
+}
+/*!
+ * \brief 入力画像を送信し、1フレーム前の入力画像をフィルタした結果を取得する.
+ *
+ * 送信した入力画像を保持し、入力画像を1フレーム前の入力画像を保持してい
+ * た画像と入れ替える.最初のフレームでは結果がないため、入力画像を空いて
+ * いる画像と入れ替え、出力画像を書き換えずに偽を返す.
+ *
+ * \param com FPGAボードとのコミュニケータ
+ * \param src 入力画像.1フレーム前の入力画像を保持する画像に入れ替わる
+ * \param dst 出力画像
+ * \return 出力画像へ結果を書き込んだ場合は真
+ */
+bool PingPongFilter::operator()(FPGACommunicator& com, Mat& src, Mat dst) {
+  namespace detail = filter_detail;
+
+  const unsigned long length = options_.total_size * options_.step;
+
+  // FPGAが前のフレームをフィルタしている間に、もう一方の対へ画像を送信
+  auto upload = com.write_async(src.data, 0, length, detail::InputBank(pair_));
+  // 送信と並行して前のフレームの完了を待つ
+  if (is_pending_) { handshake_.stop(com); }
+  upload.get();
+  // 今送信したフレームのフィルタを開始
+  com.write(BANK_PAIR_REG, pair_);
+  handshake_.start(com);
+
+  const bool is_filtered = is_pending_;
+  // FPGAがフィルタしている間に、前のフレームの結果を取得する
+  if (is_pending_)
+    { com.read(dst.data, 0, length, detail::OutputBank(pair_ ^ 1)); }
+  // 今送信した入力画像を保持し、結果と対になる前のフレームの入力画像を返す
+  std::swap(src, held_);
+
+  is_pending_ = true;
+  pair_ ^= 1;
+  return is_filtered;
+}
+/*!
+ * \brief 最後に送信したフレームの完了を待ち、その入力画像と結果を取得する.
+ *
+ * 完了を待つことでenable信号も無効になる.送信したフレームがなければ何も
+ * せずに偽を返す.
+ *
+ * \param com FPGAボードとのコミュニケータ
+ * \param src 空いている画像.最後に送信した入力画像を保持する画像に入れ替
+ *        わる
+ * \param dst 出力画像
+ * \return 出力画像へ結果を書き込んだ場合は真
+ */
+bool PingPongFilter::finish(FPGACommunicator& com, Mat& src, Mat dst) {
+  namespace detail = filter_detail;
+
+  if (!is_pending_) { return false; }
+
+  is_pending_ = false;
+  handshake_.stop(com);
+  com.read(dst.data, 0, options_.total_size * options_.step,
+           detail::OutputBank(pair_ ^ 1));
+  std::swap(src, held_);
+  return true;
+}
+/*!
+ * \brief コンストラクタ.
+ *
+ * 領域の画素を詰める先は、画素順に転送する画像ではDMAバッファの一部、平面
+ * に分解するカラー画像ではホスト側の画像.
+ *
+ * \param com FPGAボードとのコミュニケータ
+ * \param options 画像の設定
+ * \param handshake FPGAの起動と完了待ちの手順
+ * \param layout SRAM上の画像の配置
+ * \param size 領域の大きさ
+ * \param origin 領域の左上の座標.無効値の場合はクリックした座標に追従する
+ * \param mouse クリックした座標
+ * \param buffer_offset 領域の画素を詰めるDMAバッファ上のオフセット
+ */
+RoiFilter::RoiFilter(FPGACommunicator& com,
+                     const ImageOptions& options,
+                     Handshake& handshake,
+                     ColorLayout layout,
+                     cv::Size size,
+                     boost::optional<cv::Point> origin,
+                     const MousePosition& mouse,
+                     size_t buffer_offset)
+  : options_(options),
+    roi_options_(size, options.type, options.interpolation, options.step),
+    handshake_(handshake),
+    layout_(layout),
+    is_following_click_(!origin),
+    mouse_(mouse),
+    clicks_(mouse.clicks.load()),
+    center_((origin)?
+              *origin + cv::Point(size.width / 2, size.height / 2) :
+              cv::Point(options.size.width / 2, options.size.height / 2)),
+    previous_(),
+    upload_(),
+    download_() {
+  if (size.width > options.size.width || size.height > options.size.height)
+    { throw runtime_error("the region of interest exceeds the image"); }
+
+  if (layout == ColorLayout::PLANAR) {
+    upload_ = Mat(size, options.type);
+    download_ = Mat(size, options.type);
+  } else {
+    upload_ = com.write_buffer(size, options.type, buffer_offset);
+    download_ = com.read_buffer(size, options.type, buffer_offset);
+  }
+}
+/*!
+ * \brief 領域に空間フィルタをかけ、入力画像の残りの部分と合成する.
+ *
+ * 出力画像が入力画像と同じ場合は領域だけを書き換え、異なる場合は領域の
+ * 外側だけを入力画像からコピーする.
+ *
+ * \param com FPGAボードとのコミュニケータ
+ * \param src 入力画像
+ * \param dst 出力画像
+ */
+void RoiFilter::operator()(FPGACommunicator& com, Mat src, Mat dst) {
+  namespace detail = filter_detail;
+
+  // クリックされていれば領域を移動
+  const uint32_t clicks = mouse_.clicks.load();
+  if (is_following_click_ && clicks != clicks_) {
+    center_ = cv::Point(mouse_.x.load(), mouse_.y.load());
+    clicks_ = clicks;
+  }
+
+  const cv::Rect r = region();
+  if (r != previous_) {
+    com.write(ROI_X_REG, r.x);
+    com.write(ROI_Y_REG, r.y);
+    previous_ = r;
+  }
+
+  src(r).copyTo(upload_);
+  if (layout_ == ColorLayout::MONOCHROME) {
+    Filter(com, upload_, download_, roi_options_, handshake_);
+  } else {
+    FilterColored(com, upload_, download_, roi_options_, handshake_, layout_);
+  }
+
+  if (src.data != dst.data) { detail::CopyOutside(src, dst, r); }
+  download_.copyTo(dst(r));
+}
+/*!
+ * \brief 中心の座標から、画像に収まる領域を求める.
+ * \return 領域
+ */
+cv::Rect RoiFilter::region() const {
+  const cv::Size size = roi_options_.size;
+  const int x = std::min(std::max(center_.x - size.width / 2, 0),
+                         options_.size.width - size.width);
+  const int y = std::min(std::max(center_.y - size.height / 2, 0),
+                         options_.size.height - size.height);
+
+  return cv::Rect(x, y, size.width, size.height);
+}
+/*!
+ * \brief コンストラクタ.フレームの置き場所を割り当て、FPGAへ通知する.
+ * \param com FPGAボードとのコミュニケータ
+ * \param options 画像の設定
+ * \param handshake FPGAの起動と完了待ちの手順
+ * \param layout SRAM上の画像の配置
+ * \param length 残すフレームの数.今回のフレームを含む
+ */
+HistoryFilter::HistoryFilter(FPGACommunicator& com,
+                             const ImageOptions& options,
+                             Handshake& handshake,
+                             ColorLayout layout,
+                             size_t length)
+  : options_(options),
+    handshake_(handshake),
+    layout_(layout),
+    slots_(),
+    next_(0),
+    length_(0) {
+  namespace detail = filter_detail;
+
+  if (length == 0 || length > MAX_HISTORY_LENGTH)
+    { throw std::invalid_argument("invalid history length"); }
+
+  slots_ = detail::GetHistorySlots(
+      com, options.total_size * options.step, length);
+  com.write(HISTORY_LENGTH_REG, 0);
+}
+/*!
+ * \brief 入力画像を次の置き場所へ送信し、残っている過去のフレームと共に
+ *        フィルタした結果を取得する.
+ *
+ * 過去のフレームは再送信しない.置き場所が一巡するまでは、有効なフレーム
+ * の数が増えていく.
+ *
+ * \param com FPGAボードとのコミュニケータ
+ * \param src 入力画像
+ * \param dst 出力画像
+ */
+void HistoryFilter::operator()(FPGACommunicator& com, Mat src, Mat dst) {
+  namespace detail = filter_detail;
+
+  const auto& slot = slots_[next_];
+  detail::Upload(com, src, options_, layout_, slot.second, slot.first);
+
+  if (length_ < slots_.size()) { com.write(HISTORY_LENGTH_REG, ++length_); }
+  // 新しい順に置き場所を通知する
+  for (size_t age = 0; age < length_; ++age) {
+    const auto& s = slots_[(next_ + slots_.size() - age) % slots_.size()];
+    com.write(HISTORY_FRAMEx_REG(age),
+              (s.first << 24) | static_cast<uint32_t>(s.second));
+  }
+
+  handshake_.start(com);
+  handshake_.stop(com);
+  detail::Download(com, dst, options_, layout_, 1);
+
+  next_ = (next_ + 1) % slots_.size();
+}
+/*!
+ * \brief コンストラクタ.CPUでフィルタするスレッドを起動する.
+ *
+ * 呼び出し元を含むいずれか1つのスレッドがFPGAとの転送を行い、残りのスレッ
+ * ドがCPUでフィルタする.スレッドが1つの場合は両者を順に行う.
+ *
+ * \param options 画像の設定
+ * \param handshake FPGAの起動と完了待ちの手順
+ * \param reference ビットストリームと同じ結果を得る参照用のフィルタ
+ * \param thread_count 呼び出し元を含めたスレッド数
+ */
+HybridFilter::HybridFilter(const ImageOptions& options,
+                           Handshake& handshake,
+                           ReferenceFilter reference,
+                           size_t thread_count)
+  : options_(options),
+    handshake_(handshake),
+    reference_(reference),
+    pool_(std::make_shared<WorkerPool>(
+        std::max<size_t>(thread_count, 1) - 1, false)),
+    ratio_(0.5),
+    sent_rows_(0) {}
+/*!
+ * \brief FPGAとCPUで帯に分けて空間フィルタをかけ、次のフレームの分け方を
+ *        調整する.
+ * \param com FPGAボードとのコミュニケータ
+ * \param src 入力画像.行が連続していること
+ * \param dst 出力画像.行が連続していること
+ */
+void HybridFilter::operator()(FPGACommunicator& com, Mat src, Mat dst) {
+  namespace detail = filter_detail;
+
+  if (!src.isContinuous() || !dst.isContinuous())
+    { throw runtime_error("hybrid filtering needs continuous images"); }
+
+  const int height = options_.size.height;
+  const int fpga_rows = detail::GetFpgaRows(ratio_, height);
+  const int cpu_rows = height - fpga_rows;
+  // 境界の行のために下の隣の1行を加えて送る.その行の結果は読み出さない
+  const int sent_rows = std::min(fpga_rows + 1, height);
+  if (sent_rows != sent_rows_) {
+    SendImageSize(com, sent_rows * options_.width, options_.width);
+    sent_rows_ = sent_rows;
+  }
+
+  const unsigned long row_size = options_.width * options_.step;
+  // 1つのスレッドはFPGAとの転送で塞がるため、帯は残りのスレッドの数
+  const size_t band_count = std::max<size_t>(pool_->size() - 1, 1);
+  vector<double> band_times(band_count);
+  double fpga_seconds = 0.0;
+  // タスク0がFPGAとの転送で、最初に取られる.残りはCPUでフィルタする帯.
+  // スレッドが1つの場合は順に実行されるため、各タスクの時間はそのタスク
+  // の開始から測る
+  pool_->run(band_count + 1, [&](size_t i, size_t) {
+    const auto start = steady_clock::now();
+    if (i == 0) {
+      com.write(src.data, 0, sent_rows * row_size, 0);
+      handshake_.start(com);
+      handshake_.stop(com);
+      com.read(dst.data, 0, fpga_rows * row_size, 1);
+      fpga_seconds = duration<double>(steady_clock::now() - start).count();
+      return;
+    }
+
+    ScopedStage stage(Stage::CPU_FILTER);
+    const size_t band = i - 1;
+    const int top = fpga_rows + static_cast<int>(cpu_rows * band / band_count);
+    const int bottom =
+      fpga_rows + static_cast<int>(cpu_rows * (band + 1) / band_count);
+    ApplyReferenceFilter(reference_, src, dst, cv::Range(top, bottom));
+    band_times[band] = duration<double>(steady_clock::now() - start).count();
+  });
+
+  if (fpga_rows == 0 || cpu_rows == 0) { return; }
+
+  // 1行にかけた時間から、両者が同時に終わる割合へ近づける.CPUの帯は並行
+  // に処理されるため、最も遅い帯で終わる
+  const double fpga_time = fpga_seconds / fpga_rows;
+  const double cpu_time =
+    *std::max_element(band_times.begin(), band_times.end()) / cpu_rows;
+  if (fpga_time + cpu_time > 0.0) {
+    const double target = cpu_time / (fpga_time + cpu_time);
+    ratio_ += detail::RATIO_SMOOTHING * (target - ratio_);
+  }
+}
+/*!
+ * \brief ハードウェアを用いて空間フィルタをかける.
+ * \param com FPGAボードとのコミュニケータ
+ * \param src 入力画像
+ * \param dst 出力画像
+ * \param options 画像の設定
+ * \param handshake FPGAの起動と完了待ちの手順
+ */
+void Filter(FPGACommunicator& com,
+            Mat src, Mat dst,
+            const ImageOptions& options,
+            Handshake& handshake) {
+  // 画像を送信
+  com.write(src.data, 0, options.total_size, 0);
+  // refresh信号を送り、enable信号を有効にする
+  handshake.start(com);
+  // フィルタリング完了を待ち、enableを無効にする
+  handshake.stop(com);
+  // 画像を取得
+  com.read(dst.data, 0, options.total_size, 1);
+}
+
+/*!
+ * \brief ハードウェアを用いてカラー画像の全チャネルに一度に空間フィルタを
+ *        かける.
+ *
+ * 全チャネルを1回のDMA転送で送信し、FPGAを1回起動し、1回のDMA転送で取得
+ * する.PLANARでは各チャネルをDMAバッファ上へ直接分解して平面を連続して配
+ * 置し、DMAバッファから直接合成する.INTERLEAVEDでは画素順のまま転送する.
+ *
+ * \param com FPGAボードとのコミュニケータ
+ * \param src 入力画像
+ * \param dst 出力画像
+ * \param options 画像の設定
+ * \param handshake FPGAの起動と完了待ちの手順
+ * \param layout SRAM上の画像の配置
+ */
+void FilterColored(FPGACommunicator& com,
+                   Mat src, Mat dst,
+                   const ImageOptions& options,
+                   Handshake& handshake,
+                   ColorLayout layout) {
+  const int channel = options.step;
+  const unsigned long length = options.total_size * channel;
+
+  if (layout == ColorLayout::INTERLEAVED) {
+    com.write(src.data, 0, length, 0);
+    handshake.start(com);
+    handshake.stop(com);
+    com.read(dst.data, 0, length, 1);
+    return;
+  }
+
+  vector<Mat> splitted(channel);
+  vector<Mat> filtered(channel);
+  for (int i = 0; i < channel; ++i) {
+    const size_t offset = i * options.total_size;
+    splitted[i] = com.write_buffer(options.size, CV_8UC1, offset);
+    filtered[i] = com.read_buffer(options.size, CV_8UC1, offset);
+  }
+
+  SplitChannels(src, splitted);
+
+  com.write(splitted.front().data, 0, length, 0);
+  handshake.start(com);
+  handshake.stop(com);
+  com.read(filtered.front().data, 0, length, 1);
+
+  MergeChannels(filtered, dst);
+}
+/*!
+ * \brief ハードウェアを用いて空間フィルタを繰り返しかける.
+ *
+ * 画像を1回だけ送信し、パス毎にBANK_SWAP_REGでバンク0と1の入力と出力を入
+ * れ替えて、前のパスの結果をそのまま次のパスの入力とする.最後のパスの出力
+ * バンクから1回だけ取得するため、パス数によらずDMA転送は送受信の1往復で
+ * 済む.終了時にBANK_SWAP_REGを無効に戻す.
+ *
+ * \param com FPGAボードとのコミュニケータ
+ * \param src 入力画像
+ * \param dst 出力画像
+ * \param options 画像の設定
+ * \param handshake FPGAの起動と完了待ちの手順
+ * \param layout SRAM上の画像の配置
+ * \param passes パス数.1以上
+ */
+void FilterChain(FPGACommunicator& com,
+                 Mat src, Mat dst,
+                 const ImageOptions& options,
+                 Handshake& handshake,
+                 ColorLayout layout,
+                 size_t passes) {
+  namespace detail = filter_detail;
+
+  detail::Upload(com, src, options, layout, 0, 0);
+
+  // BANK_SWAP_REGは呼び出し時に無効であり、変わる場合だけ書き込む
+  uint32_t swap = 0;
+  for (size_t i = 0; i < passes; ++i) {
+    if (swap != i % 2) {
+      swap = i % 2;
+      com.write(BANK_SWAP_REG, swap);
+    }
+    handshake.start(com);
+    handshake.stop(com);
+  }
+  // 最後のパスの出力は、入れ替えていなければバンク1、入れ替えていればバンク0
+  const uint32_t output = swap ^ 1;
+  if (swap != 0) { com.write(BANK_SWAP_REG, 0); }
+
+  detail::Download(com, dst, options, layout, output);
+}
+}  // namespace filter_core
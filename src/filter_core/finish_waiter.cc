@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/finish_waiter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include "filter_core/fpga_communicator.h"
+#include "filter_core/stage_tracer.h"
+#include "filter_core/timeline.h"
+
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+using std::this_thread::sleep_for;
+
+
+namespace filter_core {
+namespace finish_waiter {
+
+/*!
+ * \var LEGACY_INTERVAL
+ * SLEEPで確認する間隔
+ */
+constexpr microseconds LEGACY_INTERVAL(250);
+/*!
+ * \var SPIN_PERIOD
+ * ADAPTIVEでビジーウェイトする時間.小さい画像はこの間に完了する
+ */
+constexpr microseconds SPIN_PERIOD(20);
+/*!
+ * \var MIN_BACKOFF, MAX_BACKOFF
+ * ADAPTIVEでビジーウェイトの後に確認する間隔の初期値と上限
+ */
+constexpr microseconds MIN_BACKOFF(5);
+constexpr microseconds MAX_BACKOFF(250);
+
+/*!
+ * \class Condition
+ * \brief 待つ条件.レジスタが0以外であるか、0であるか
+ */
+class Condition {
+ private:
+  filter_core::FPGACommunicator& com_;
+  const size_t i_;
+  const bool is_set_;
+ public:
+  Condition(filter_core::FPGACommunicator& com, size_t i, bool is_set)
+    : com_(com), i_(i), is_set_(is_set) {}
+ public:
+  bool operator()() const { return (com_[i_] != 0) == is_set_; }
+};
+
+bool Sleep(const Condition& is_done, steady_clock::time_point deadline);
+bool Spin(const Condition& is_done, steady_clock::time_point deadline);
+bool Adaptive(const Condition& is_done, steady_clock::time_point deadline);
+}  // namespace finish_waiter
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace finish_waiter {
+/*!
+ * \brief 一定間隔で確認する.
+ * \param is_done 待つ条件
+ * \param deadline 期限
+ * \return 期限までに条件が満たされれば真
+ */
+bool Sleep(const Condition& is_done, steady_clock::time_point deadline) {
+  while (!is_done()) {
+    if (steady_clock::now() >= deadline) { return false; }
+
+    ScopedSpan span("poll sleep");
+    sleep_for(LEGACY_INTERVAL);
+  }
+  return true;
+}
+/*!
+ * \brief ビジーウェイトで確認する.
+ * \param is_done 待つ条件
+ * \param deadline 期限
+ * \return 期限までに条件が満たされれば真
+ */
+bool Spin(const Condition& is_done, steady_clock::time_point deadline) {
+  while (!is_done()) {
+    if (steady_clock::now() >= deadline) { return false; }
+  }
+  return true;
+}
+/*!
+ * \brief しばらくビジーウェイトし、その後は間隔を倍々に延ばしながら確認する.
+ * \param is_done 待つ条件
+ * \param deadline 期限
+ * \return 期限までに条件が満たされれば真
+ */
+bool Adaptive(const Condition& is_done, steady_clock::time_point deadline) {
+  const auto spin_deadline =
+    std::min(deadline, steady_clock::now() + SPIN_PERIOD);
+  {
+    ScopedSpan span("poll spin");
+    if (Spin(is_done, spin_deadline)) { return true; }
+  }
+
+  for (auto interval = MIN_BACKOFF; !is_done();
+       interval = std::min(interval * 2, MAX_BACKOFF)) {
+    const auto now = steady_clock::now();
+    if (now >= deadline) { return false; }
+
+    ScopedSpan span("poll sleep");
+    sleep_for(std::min(interval, duration_cast<microseconds>(deadline - now)));
+  }
+  return true;
+}
+}  // namespace finish_waiter
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief 待ち時間を記録する.
+ * \param d 待ち時間
+ * \param is_timed_out タイムアウトしたか
+ */
+void WaitStatistics::add(duration_type d, bool is_timed_out) {
+  ++count;
+  if (is_timed_out) { ++timeouts; }
+  total += d;
+  min = std::min(min, d);
+  max = std::max(max, d);
+}
+
+/*!
+ * \brief finish信号が有効になるまで待つ.enable信号は変更しない.
+ * \param com FPGAボードとのコミュニケータ
+ * \return タイムアウトまでにfinish信号が有効になれば真
+ */
+bool FinishWaiter::wait(FPGACommunicator& com) {
+  const auto start = steady_clock::now();
+
+  bool is_finished = false;
+  if (strategy_ == WaitStrategy::INTERRUPT &&
+      com.device_->supports_interrupt()) {
+    is_finished = com[FINISH_REG] != 0 ||
+                  com.device_->wait_interrupt(timeout_);
+  } else {
+    is_finished = WaitRegister(com, FINISH_REG, true, strategy_, timeout_);
+  }
+
+  const auto end = steady_clock::now();
+  StageTracer::instance().record(Stage::FINISH_WAIT, start, end);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  statistics_.add(duration_cast<microseconds>(end - start), !is_finished);
+
+  return is_finished;
+}
+/*!
+ * \brief これまでの待ち時間の統計を返す.
+ * \return 統計
+ */
+WaitStatistics FinishWaiter::statistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return statistics_;
+}
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief レジスタが0以外、または0になるまでポーリングで待つ.
+ *
+ * INTERRUPTはポーリングでは実現できないため、ADAPTIVEとして扱う.
+ *
+ * \param com FPGAボードとのコミュニケータ
+ * \param i レジスタのインデックス
+ * \param is_set 0以外になるのを待つ場合は真、0になるのを待つ場合は偽
+ * \param strategy 待ち方
+ * \param timeout 最大待ち時間
+ * \return タイムアウトまでに条件が満たされれば真
+ */
+bool WaitRegister(FPGACommunicator& com,
+                  size_t i,
+                  bool is_set,
+                  WaitStrategy strategy,
+                  microseconds timeout) {
+  namespace detail = finish_waiter;
+
+  const detail::Condition is_done(com, i, is_set);
+  const auto deadline = steady_clock::now() + timeout;
+  switch (strategy) {
+    case WaitStrategy::SLEEP: return detail::Sleep(is_done, deadline);
+    case WaitStrategy::SPIN: return detail::Spin(is_done, deadline);
+    case WaitStrategy::INTERRUPT:
+    case WaitStrategy::ADAPTIVE: return detail::Adaptive(is_done, deadline);
+  }
+  return false;
+}
+/*!
+ * \brief 待ち時間の統計を出力する.
+ * \param os 出力ストリーム
+ * \param s 統計
+ * \return 出力ストリーム
+ */
+std::ostream& operator<<(std::ostream& os, const WaitStatistics& s) {
+  if (s.count == 0) { return os << "no finish waits"; }
+
+  return os << s.count << " waits, "
+            << "mean " << s.total.count() / s.count << " us, "
+            << "min " << s.min.count() << " us, "
+            << "max " << s.max.count() << " us, "
+            << s.timeouts << " timeouts";
+}
+/*!
+ * \brief 待ち方の名前を返す.
+ * \param strategy 待ち方
+ * \return 名前
+ */
+std::string ToString(WaitStrategy strategy) {
+  switch (strategy) {
+    case WaitStrategy::SLEEP: return "sleep";
+    case WaitStrategy::SPIN: return "spin";
+    case WaitStrategy::INTERRUPT: return "interrupt";
+    case WaitStrategy::ADAPTIVE: return "adaptive";
+  }
+  return "";
+}
+}  // namespace filter_core
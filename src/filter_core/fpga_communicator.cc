@@ -8,97 +8,48 @@
 
 #include <admxrc2.h>
 
-#include <array>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
+#include <future>
 #include <ios>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <thread>
+#include <utility>
+#include <vector>
+#include "filter_core/admxrc2_device.h"
+#include "filter_core/stage_tracer.h"
+#include "filter_core/timeline.h"
 
 
-using std::get;
-using std::make_tuple;
 using std::move;
+using std::packaged_task;
 using std::runtime_error;
 using std::shared_ptr;
 using std::string;
-using std::tuple;
-using std::weak_ptr;
-using std::chrono::milliseconds;
+using std::chrono::duration_cast;
 using std::chrono::microseconds;
+using std::chrono::steady_clock;
 using std::this_thread::sleep_for;
-using filter_core::fpga_space_t;
 
 
 namespace filter_core {
 namespace fpga_communicator {
 
-constexpr size_t STATUS_REG_LCLKLOCKED = 0x1U << 0;
-constexpr size_t STATUS_REG_LCLKSTICKY = 0x1U << 1;
-constexpr size_t STATUS_REG_SHIFT_LOCKED = 8;
-constexpr size_t STATUS_REG_SHIFT_STICKY = 16;
-
-constexpr size_t MEMSTAT_REG_SHIFT_TRAINED = 0;
-
-constexpr size_t MODEx_REG_ZBTSSRAM_PIPELINE = 0x1U << 0;
-
-constexpr size_t PAGE_REG_PAGEMASK = 0x7ffU;
-constexpr unsigned long PAGE_SIZE = 0x200000U;
-constexpr unsigned long PAGE_SHIFT = 21;
-
-constexpr unsigned long MEMORY_WINDOW_ADDRESS = 0x200000U;   /* In bytes */
-}  // namespace fpga_communicator 
-}  // namespace filter_core
-
-
-namespace filter_core {
-namespace fpga_communicator {
-
-std::shared_ptr<uint8_t> AllocateBufferForDMA(size_t size);
-void CheckForMemoryLock(filter_core::fpga_space_t space,
-                        uint32_t lock_flag_number);
-void Configure(std::weak_ptr<ADMXRC2_HANDLE> handle,
-               const std::string& filename,
-               filter_core::fpga_space_t space);
-std::shared_ptr<ADMXRC2_HANDLE> GetCardHandle();
-ADMXRC2_CARD_INFO GetCardInfo(std::weak_ptr<ADMXRC2_HANDLE> handle);
-BankInfo GetBankInfo(std::weak_ptr<ADMXRC2_HANDLE> handle,
-                     const ADMXRC2_CARD_INFO& info);
-filter_core::fpga_space_t GetFPGASpace(std::weak_ptr<ADMXRC2_HANDLE> handle);
-BankInfo GetBankInfo(std::weak_ptr<ADMXRC2_HANDLE> handle,
-                     const ADMXRC2_CARD_INFO& info);
-uint32_t GetLockFlagNumber(ADMXRC2_BOARD_TYPE type);
-double GetMemoryClockFrequency(ADMXRC2_BOARD_TYPE type);
-void Read(ADMXRC2_HANDLE handle,
-          filter_core::fpga_space_t space,
-          ADMXRC2_DMADESC dma_descriptor,
-          uint8_t* read_buffer,
-          uint32_t dma_mode,
-          void* buffer,
-          uint64_t offset,
-          unsigned long length);
-void ResetMemorySystem(filter_core::fpga_space_t space);
-void SelectBank(filter_core::fpga_space_t space, uint32_t bank);
-bool SetClockRates(std::weak_ptr<ADMXRC2_HANDLE> handle,
-                   double local_clock,
-                   double memory_clock);
-void SetMemoryPortConfiguration(filter_core::fpga_space_t space);
-std::shared_ptr<ADMXRC2_DMADESC> SetupDMA(
-    std::shared_ptr<ADMXRC2_HANDLE> handle,
-    uint8_t* buffer,
-    size_t buffer_size);
-void WaitForLclkDcm(filter_core::fpga_space_t space);
-void Write(ADMXRC2_HANDLE handle,
-           filter_core::fpga_space_t space,
-           ADMXRC2_DMADESC dma_descriptor,
-           uint8_t* write_buffer,
-           uint32_t dma_mode,
-           void* buffer,
-           uint64_t offset,
-           unsigned long length);
+/*!
+ * \var OUTSIDE_BUFFER
+ * 配列がDMA用のバッファの外にあることを示す
+ */
+constexpr unsigned long OUTSIDE_BUFFER = ~0UL;
+/*!
+ * \var MAX_PENDING_TRANSFERS
+ * 同時に受け付ける非同期転送の要求数
+ */
+constexpr size_t MAX_PENDING_TRANSFERS = 8;
 }  // namespace fpga_communicator 
 }  // namespace filter_core
 
@@ -106,274 +57,192 @@ void Write(ADMXRC2_HANDLE handle,
 namespace filter_core {
 namespace fpga_communicator {
 
-inline void Write(filter_core::fpga_space_t space, uint32_t i, uint32_t value)
-  { space[i] = value; space[i]; }
+unsigned long GetBufferPosition(const uint8_t* dma_buffer,
+                                size_t buffer_size,
+                                const void* buffer,
+                                unsigned long length) noexcept;
+std::pair<uint8_t*, size_t> FindRegion(
+    const std::vector<std::pair<std::shared_ptr<uint8_t>, size_t>>& regions,
+    uint8_t* dma_buffer,
+    size_t buffer_size,
+    const void* buffer,
+    unsigned long length) noexcept;
+cv::Mat MapBuffer(uint8_t* buffer, size_t buffer_size,
+                  cv::Size size, int type, size_t offset);
+void Count(filter_core::TransferStatistics& statistics,
+           uint64_t chunks,
+           unsigned long length,
+           std::chrono::steady_clock::time_point start);
+uint64_t Read(filter_core::Device& device,
+              filter_core::PageWindow& window,
+              uint8_t* read_buffer,
+              size_t buffer_size,
+              unsigned long chunk_size,
+              void* buffer,
+              uint64_t offset,
+              unsigned long length);
+uint64_t Write(filter_core::Device& device,
+               filter_core::PageWindow& window,
+               uint8_t* write_buffer,
+               size_t buffer_size,
+               unsigned long chunk_size,
+               void* buffer,
+               uint64_t offset,
+               unsigned long length);
 }  // namespace fpga_communicator 
 }  // namespace filter_core
 
 
 namespace filter_core {
 namespace fpga_communicator {
-
-std::shared_ptr<uint8_t> AllocateBufferForDMA(size_t size) {
-  uint8_t* buffer = (uint8_t*) ADMXRC2_Malloc(size);
-
-  if (buffer != nullptr) {
-    return std::shared_ptr<uint8_t>(
-        buffer,
-        [](uint8_t* b) { if (b != nullptr) { ADMXRC2_Free(b); } });
-  } else {
-    throw runtime_error("failed to allocate buffer for DMA");
-  }
-}
-
-void CheckForMemoryLock(fpga_space_t space, unsigned int lock_flag_number) {
-  uint32_t mask = (1 << lock_flag_number) - 1;
-  uint32_t status = space[STATUS_REG];
-  uint32_t memstat = space[MEMSTAT_REG];
-
-  if (((status >> STATUS_REG_SHIFT_LOCKED) & mask) == 0)
-    { throw runtime_error("Not all memory lock flags asserted"); }
-  if (((memstat >> MEMSTAT_REG_SHIFT_TRAINED) & mask) == 0)
-    { throw runtime_error("Not all memory banks trained"); }
-
-  /* Clear sticky loss-of-lock / loss-of-trained bits */
-  space[STATUS_REG] = 0xffU << STATUS_REG_SHIFT_STICKY;
-  space[STATUS_REG];
-}
-
-void Configure(weak_ptr<ADMXRC2_HANDLE> handle,
-               const string& filename,
-               fpga_space_t space) {
-  auto status = ADMXRC2_ConfigureFromFile(*handle.lock(), filename.c_str());
-  if (status != ADMXRC2_SUCCESS) {
-    throw runtime_error(
-        string("failed to configure: ") + ADMXRC2_GetStatusString(status));
-  }
-}
-
-shared_ptr<ADMXRC2_HANDLE> GetCardHandle() {
-  ADMXRC2_HANDLE handle;
-  auto status = ADMXRC2_OpenCard(0, &handle);
-
-  if (status == ADMXRC2_SUCCESS) {
-    return shared_ptr<ADMXRC2_HANDLE>(
-        new ADMXRC2_HANDLE(handle),
-        [](ADMXRC2_HANDLE* h) {
-          if (*h != ADMXRC2_HANDLE_INVALID_VALUE) { ADMXRC2_CloseCard(*h); }
-          delete h;
-          h = nullptr;
-        });
-  } else {
-    throw runtime_error(
-        string("failed to open card: ") + ADMXRC2_GetStatusString(status));
-  }
-}
-
-ADMXRC2_CARD_INFO GetCardInfo(weak_ptr<ADMXRC2_HANDLE> handle) {
-  ADMXRC2_CARD_INFO info;
-  auto status = ADMXRC2_GetCardInfo(*handle.lock(), &info);
-
-  if (status == ADMXRC2_SUCCESS) {
-    return info;
-  } else {
-    throw runtime_error(
-        string("failed to get card info: ") + ADMXRC2_GetStatusString(status));
-  }
+/*!
+ * \brief 配列がDMA用のバッファの内側にある場合、バッファ先頭からの位置を返す.
+ * \return バッファ先頭からの位置.外側にある場合はOUTSIDE_BUFFER
+ */
+unsigned long GetBufferPosition(const uint8_t* dma_buffer,
+                                size_t buffer_size,
+                                const void* buffer,
+                                unsigned long length) noexcept {
+  auto p = static_cast<const uint8_t*>(buffer);
+
+  return (p >= dma_buffer && p + length <= dma_buffer + buffer_size)?
+    static_cast<unsigned long>(p - dma_buffer) : OUTSIDE_BUFFER;
 }
-
-BankInfo GetBankInfo(std::weak_ptr<ADMXRC2_HANDLE> handle,
-                     const ADMXRC2_CARD_INFO& info) {
-  BankInfo bank_info;
-
-  for (int i = 0; i < info.NumRAMBank && i < MAX_BANK; ++i) {
-    if (info.RAMBanksFitted & (0x1UL << i)) {
-      auto status = ADMXRC2_GetBankInfo(*handle.lock(), i, &bank_info[i]);
-      if (status != ADMXRC2_SUCCESS) {
-        throw runtime_error(
-            string("failed to get bank info: ") + ADMXRC2_GetStatusString(status));
-      }
-    }
+/*!
+ * \brief 配列を含む、allocateで確保した領域を探す.
+ * \return 領域の先頭と大きさ.どの領域にもなければ既定のDMA用のバッファ
+ */
+std::pair<uint8_t*, size_t> FindRegion(
+    const std::vector<std::pair<shared_ptr<uint8_t>, size_t>>& regions,
+    uint8_t* dma_buffer,
+    size_t buffer_size,
+    const void* buffer,
+    unsigned long length) noexcept {
+  for (const auto& region : regions) {
+    if (GetBufferPosition(region.first.get(), region.second, buffer, length) !=
+        OUTSIDE_BUFFER)
+      { return std::make_pair(region.first.get(), region.second); }
   }
-
-  return std::move(bank_info);
+  return std::make_pair(dma_buffer, buffer_size);
 }
 
-fpga_space_t GetFPGASpace(weak_ptr<ADMXRC2_HANDLE> handle) {
-  ADMXRC2_SPACE_INFO info;
-  auto status = ADMXRC2_GetSpaceInfo(*handle.lock(), 0, &info);
+cv::Mat MapBuffer(uint8_t* buffer, size_t buffer_size,
+                  cv::Size size, int type, size_t offset) {
+  cv::Mat header(size, type, buffer + offset);
 
-  if (status != ADMXRC2_SUCCESS || info.VirtualBase == NULL) {
-    throw runtime_error(
-        string("failed to get space info: ") + ADMXRC2_GetStatusString(status));
-  } else {
-    return static_cast<volatile uint32_t*>(info.VirtualBase);
-  }
-}
+  if (offset + header.total() * header.elemSize() > buffer_size)
+    { throw runtime_error("the image exceeds the buffer for DMA"); }
 
-uint32_t GetLockFlagNumber(ADMXRC2_BOARD_TYPE type) {
-  switch (type) {
-  case ADMXRC2_BOARD_ADMXRC2:
-    return 3;
-  case ADMXRC2_BOARD_ADMXRC4SX:
-    return 2;
-  default:
-    throw runtime_error("unsupported board");
-  }
+  return header;
 }
 
-double GetMemoryClockFrequency(ADMXRC2_BOARD_TYPE type) {
-  switch (type) {
-  case ADMXRC2_BOARD_ADMXRC2:
-    return 66.67;
-  case ADMXRC2_BOARD_ADMXRC4SX:
-    return 150.0;
-  default:
-    throw runtime_error("unsupported board");
-  }
+/*!
+ * \brief 1回の転送を記録する.DMA転送は分割した単位毎に数える.
+ */
+void Count(TransferStatistics& statistics,
+           uint64_t chunks,
+           unsigned long length,
+           steady_clock::time_point start) {
+  statistics.transfers += chunks;
+  statistics.bytes += length;
+  statistics.transfer_time +=
+    duration_cast<microseconds>(steady_clock::now() - start);
 }
 
-void Read(ADMXRC2_HANDLE handle,
-          fpga_space_t space,
-          ADMXRC2_DMADESC dma_descriptor,
-          uint8_t* read_buffer,
-          uint32_t dma_mode,
-          void* buffer,
-          uint64_t offset,
-          unsigned long length) {
+/*!
+ * \brief ページ境界とchunk_sizeで分割してDMA転送で読み込む.
+ * \return DMA転送の回数
+ */
+uint64_t Read(Device& device,
+              PageWindow& window,
+              uint8_t* read_buffer,
+              size_t buffer_size,
+              unsigned long chunk_size,
+              void* buffer,
+              uint64_t offset,
+              unsigned long length) {
   uint8_t* dst = (uint8_t*)buffer;
-
-  while (length > 0) {
+  // 読み込み先がバッファ内にあれば、そこへ直接転送する
+  unsigned long position =
+    GetBufferPosition(read_buffer, buffer_size, buffer, length);
+  const bool is_direct = position != OUTSIDE_BUFFER;
+  if (!is_direct) { position = 0; }
+
+  uint64_t chunks = 0;
+  for (; length > 0; ++chunks) {
     unsigned long pgidx = static_cast<unsigned long>(offset >> PAGE_SHIFT);
     unsigned long pgoffs = (unsigned long)offset & (PAGE_SIZE - 1);
     unsigned long chunk = (PAGE_SIZE - pgoffs > length)?
         length: (PAGE_SIZE - pgoffs);
+    if (chunk > chunk_size) { chunk = chunk_size; }
+    if (!is_direct && chunk > buffer_size) { chunk = buffer_size; }
 
     /* Set the page register */
-    Write(space, PAGE_REG, pgidx & PAGE_REG_PAGEMASK);
-
-    auto status = ADMXRC2_DoDMA(handle,
-                                dma_descriptor,
-                                offset,
-                                chunk,
-                                MEMORY_WINDOW_ADDRESS + pgoffs,
-                                ADMXRC2_LOCALTOPCI,
-                                ADMXRC2_DMACHAN_ANY,
-                                dma_mode,
-                                0, NULL, NULL);
-    if (status == ADMXRC2_SUCCESS) {
-      memcpy(dst, read_buffer, chunk);
-
-      dst += chunk;
-      offset += chunk;
-      length -= chunk;
-    } else {
-      throw runtime_error(
-          string("failed to get data") + ADMXRC2_GetStatusString(status));
+    window.select_page(pgidx);
+
+    {
+      ScopedSpan span("dma read chunk", "bytes", chunk);
+      device.transfer(read_buffer + position,
+                      chunk,
+                      MEMORY_WINDOW_ADDRESS + pgoffs,
+                      DMADirection::TO_HOST);
     }
-  }
-}
-
-void ResetMemorySystem(fpga_space_t space) {
-  Write(space, MEMCTL_REG, 0x1U);
-  sleep_for(milliseconds(1));
-  Write(space, MEMCTL_REG, 0x0U);
-  sleep_for(milliseconds(500));
-}
-
-void SelectBank(fpga_space_t space, uint32_t bank)
-  { Write(space, BANK_REG, (uint32_t)bank & 0xfU); }
-
-bool SetClockRates(
-    weak_ptr<ADMXRC2_HANDLE> handle,
-    double local_clock,
-    double memory_clock) {
-  double actual_memory_clock_frequency, actual_locak_clock_frequency;
-
-  return ADMXRC2_SetClockRate(*handle.lock(),
-                              ADMXRC2_CLOCK_LCLK,
-                              local_clock * 1.0e6,
-                              &actual_locak_clock_frequency) == ADMXRC2_SUCCESS &&
-      ADMXRC2_SetClockRate(*handle.lock(),
-                           1,
-                           memory_clock * 1.0e6,
-                           &actual_memory_clock_frequency) == ADMXRC2_SUCCESS;
-}
-
-void SetMemoryPortConfiguration(fpga_space_t space) {
-  for (int i = 0; i < MAX_BANK; ++i)
-    { Write(space, MODEx_REG(i), MODEx_REG_ZBTSSRAM_PIPELINE); }
-}
+    if (is_direct) { position += chunk; }
+    else { memcpy(dst, read_buffer, chunk); }
 
-shared_ptr<ADMXRC2_DMADESC> SetupDMA(shared_ptr<ADMXRC2_HANDLE> handle,
-                                     uint8_t* buffer,
-                                     size_t buffer_size) {
-  ADMXRC2_DMADESC descriptor;
-  auto status = ADMXRC2_SetupDMA(*handle, buffer, buffer_size, 0, &descriptor);
-
-  if (status == ADMXRC2_SUCCESS) {
-    return std::shared_ptr<ADMXRC2_DMADESC>(
-        new ADMXRC2_DMADESC(descriptor),
-        [handle](ADMXRC2_DMADESC* desc){
-          if (handle && *handle != ADMXRC2_HANDLE_INVALID_VALUE) {
-            ADMXRC2_UnsetupDMA(*handle, *desc);
-            delete desc;
-            desc = nullptr;
-          }
-        });
-  } else {
-    throw runtime_error(
-        string("failed to open DMA channels: ") +
-          ADMXRC2_GetStatusString(status));
+    dst += chunk;
+    offset += chunk;
+    length -= chunk;
   }
+  return chunks;
 }
 
-void WaitForLclkDcm(fpga_space_t space) {
-  sleep_for(milliseconds(500));
-
-  uint32_t status = space[STATUS_REG];
-  if (status & STATUS_REG_LCLKLOCKED) {
-    Write(space, STATUS_REG, STATUS_REG_LCLKSTICKY);
-  } else { throw runtime_error("LCLK DCM is not locked"); }
-}
+/*!
+ * \brief ページ境界とchunk_sizeで分割してDMA転送で書き込む.
+ * \return DMA転送の回数
+ */
+uint64_t Write(Device& device,
+               PageWindow& window,
+               uint8_t* write_buffer,
+               size_t buffer_size,
+               unsigned long chunk_size,
+               void* buffer,
+               uint64_t offset,
+               unsigned long length) {
+  // 送信元がバッファ内になければ、バッファ先頭へコピーしてから転送する
+  unsigned long position =
+    GetBufferPosition(write_buffer, buffer_size, buffer, length);
+  if (position == OUTSIDE_BUFFER) {
+    if (length > buffer_size)
+      { throw runtime_error("the data exceeds the buffer for DMA"); }
+
+    memcpy(write_buffer, static_cast<uint8_t*>(buffer), length);
+    position = 0;
+  }
 
-void Write(ADMXRC2_HANDLE handle,
-           fpga_space_t space,
-           ADMXRC2_DMADESC dma_descriptor,
-           uint8_t* write_buffer,
-           uint32_t dma_mode,
-           void* buffer,
-           uint64_t offset,
-           unsigned long length) {
-  memcpy(write_buffer, static_cast<uint8_t*>(buffer), length);
-
-  while (length > 0) {
+  uint64_t chunks = 0;
+  for (; length > 0; ++chunks) {
     unsigned long pgidx = static_cast<unsigned long>(offset >> PAGE_SHIFT);
     unsigned long pgoffs = (unsigned long)offset & (PAGE_SIZE - 1);
     unsigned long chunk = (PAGE_SIZE - pgoffs > length)?
         length: (PAGE_SIZE - pgoffs);
+    if (chunk > chunk_size) { chunk = chunk_size; }
 
     /* Set the page register */
-    Write(space, PAGE_REG, pgidx & PAGE_REG_PAGEMASK);
-
-    auto status = ADMXRC2_DoDMA(
-        handle,
-        dma_descriptor,
-        offset,
-        chunk,
-        MEMORY_WINDOW_ADDRESS + pgoffs,
-        ADMXRC2_PCITOLOCAL,
-        ADMXRC2_DMACHAN_ANY,
-        dma_mode,
-        0, NULL, NULL);
-    if (status == ADMXRC2_SUCCESS) {
-      offset += chunk;
-      length -= chunk;
-    } else {
-      throw runtime_error(
-          string("failed to send data") + ADMXRC2_GetStatusString(status));
+    window.select_page(pgidx);
+
+    {
+      ScopedSpan span("dma write chunk", "bytes", chunk);
+      device.transfer(write_buffer + position,
+                      chunk,
+                      MEMORY_WINDOW_ADDRESS + pgoffs,
+                      DMADirection::TO_LOCAL);
     }
+    position += chunk;
+    offset += chunk;
+    length -= chunk;
   }
+  return chunks;
 }
 }  // namespace fpga_communicator 
 }  // namespace filter_core
@@ -381,49 +250,96 @@ void Write(ADMXRC2_HANDLE handle,
 
 namespace filter_core {
 /*!
- * \brief コンストラクタ.FPGAボードとの通信を確立する.
+ * \brief コンストラクタ.カード0との通信を確立する.
  *
  * \param local_clock_rate FPGAの動作周波数
- * \param memory_clock_rate SRAMの動作周波数
  * \param bitstream_filename ビットファイル名
  * \param buffer_size DMA転送する配列の最大長
  */
 FPGACommunicator::FPGACommunicator(double local_clock_rate,
                                    const string& bitstream_filename,
-                                   size_t buffer_size) {
-  namespace detail = fpga_communicator;
-
-  handle_ = detail::GetCardHandle();
-  info_ = detail::GetCardInfo(handle_);
-  space_ = detail::GetFPGASpace(handle_);
-  bank_info_ = detail::GetBankInfo(handle_, info_);
-
-  detail::SetClockRates(
-      handle_,
-      local_clock_rate,
-      detail::GetMemoryClockFrequency(info_.BoardType));
-  detail::Configure(handle_, bitstream_filename, space_);
-  detail::WaitForLclkDcm(space_);
-
-  read_buffer_ = detail::AllocateBufferForDMA(buffer_size);
-  write_buffer_ = detail::AllocateBufferForDMA(buffer_size);
-
-  read_descriptor_ = detail::SetupDMA(handle_,
-                                      read_buffer_.get(), buffer_size);
-  write_descriptor_ = detail::SetupDMA(handle_,
-                                       write_buffer_.get(), buffer_size);
-
-  dma_mode_ = ADMXRC2_BuildDMAModeWord(
-      info_.BoardType,
-      ADMXRC2_IOWIDTH_32,
-      0,
-      ADMXRC2_DMAMODE_USEREADY | ADMXRC2_DMAMODE_USEBTERM |
-        ADMXRC2_DMAMODE_BURSTENABLE);
-
-  detail::SetMemoryPortConfiguration(space_);
-  detail::ResetMemorySystem(space_);
-  detail::CheckForMemoryLock(space_,
-                             detail::GetLockFlagNumber(info_.BoardType));
+                                   size_t buffer_size)
+  : FPGACommunicator(
+        std::make_shared<ADMXRC2Device>(
+            0, local_clock_rate, bitstream_filename),
+        buffer_size) {}
+/*!
+ * \brief コンストラクタ.デバイスとの通信を確立する.
+ *
+ * \param device デバイス
+ * \param buffer_size DMA転送する配列の最大長
+ */
+FPGACommunicator::FPGACommunicator(shared_ptr<Device> device,
+                                   size_t buffer_size)
+  : device_(device),
+    info_(device->info()),
+    bank_info_(device->bank_info()),
+    read_buffer_(device->allocate(buffer_size)),
+    write_buffer_(device->allocate(buffer_size)),
+    buffer_size_(buffer_size),
+    dma_mutex_(),
+    regions_(),
+    chunk_size_(PAGE_SIZE),
+    statistics_(),
+    window_(*device_, statistics_),
+    register_writes_(0),
+    transfers_(fpga_communicator::MAX_PENDING_TRANSFERS),
+    transfer_thread_flag_(),
+    transfer_thread_() {}
+/*!
+ * \brief デストラクタ.受け付け済みの非同期転送を完了させる.
+ */
+FPGACommunicator::~FPGACommunicator() {
+  transfers_.close();
+  if (transfer_thread_.joinable()) { transfer_thread_.join(); }
+}
+/*!
+ * \brief 受信用のDMAバッファを参照する画像を返す
+ *
+ * 返された画像を読み込み先として渡すと、バッファからのコピーが省略される.
+ *
+ * \param size 画像サイズ
+ * \param type 画像の型
+ * \param offset バッファ先頭からのオフセット
+ * \return DMAバッファを参照する画像
+ */
+cv::Mat FPGACommunicator::read_buffer(cv::Size size, int type, size_t offset) {
+  return fpga_communicator::MapBuffer(
+      read_buffer_.get(), buffer_size_, size, type, offset);
+}
+/*!
+ * \brief 送信用のDMAバッファを参照する画像を返す
+ *
+ * 返された画像へ書き込み、それを書き込む配列として渡すと、バッファへのコ
+ * ピーが省略される.
+ *
+ * \param size 画像サイズ
+ * \param type 画像の型
+ * \param offset バッファ先頭からのオフセット
+ * \return DMAバッファを参照する画像
+ */
+cv::Mat FPGACommunicator::write_buffer(cv::Size size, int type, size_t offset) {
+  return fpga_communicator::MapBuffer(
+      write_buffer_.get(), buffer_size_, size, type, offset);
+}
+/*!
+ * \brief DMA転送できる領域を確保し、それを参照する画像を返す
+ *
+ * 返された画像(またはその連続した部分)を読み書きする配列として渡すと、
+ * DMA用のバッファを経由せずに直接転送される.領域はコミュニケータと同じ
+ * 期間だけ有効.
+ *
+ * \param size 画像サイズ
+ * \param type 画像の型
+ * \return 確保した領域を参照する画像
+ */
+cv::Mat FPGACommunicator::allocate(cv::Size size, int type) {
+  const size_t length = size.area() * CV_ELEM_SIZE(type);
+  auto buffer = device_->allocate(length);
+
+  std::lock_guard<std::mutex> lock(dma_mutex_);
+  regions_.emplace_back(buffer, length);
+  return fpga_communicator::MapBuffer(buffer.get(), length, size, type, 0);
 }
 /*!
  * \brief 指定したバンクに格納された値を読み込み、配列へコピーする
@@ -437,10 +353,20 @@ void FPGACommunicator::read(void* buffer,
                             uint64_t offset,
                             unsigned long length,
                             uint32_t bank) {
-  fpga_communicator::SelectBank(space_, bank);
-  fpga_communicator::Read(*handle_, space_,
-                          *read_descriptor_, read_buffer_.get(), dma_mode_,
-                          buffer, offset, length);
+  std::lock_guard<std::mutex> lock(dma_mutex_);
+  const auto start = steady_clock::now();
+
+  // allocateで確保した領域にあれば、そこへ直接転送する
+  const auto region = fpga_communicator::FindRegion(
+      regions_, read_buffer_.get(), buffer_size_, buffer, length);
+  window_.select_bank(bank);
+  const uint64_t chunks =
+    fpga_communicator::Read(*device_, window_,
+                            region.first, region.second, chunk_size_,
+                            buffer, offset, length);
+
+  fpga_communicator::Count(statistics_, chunks, length, start);
+  StageTracer::instance().record(Stage::DMA_READ, start);
 }
 /*!
  * \brief ユーザレジスタへ書き込む
@@ -449,7 +375,15 @@ void FPGACommunicator::read(void* buffer,
  * \param v 書き込む値
  */
 void FPGACommunicator::write(uint32_t i, size_t v) noexcept {
-  fpga_communicator::Write(space_, i, v);
+  // DMA転送用のレジスタを直接書き換えた場合は、保持している値を捨てる
+  if (i == BANK_REG || i == PAGE_REG) {
+    std::lock_guard<std::mutex> lock(dma_mutex_);
+    window_.invalidate();
+    device_->set(i, v);
+  } else {
+    device_->set(i, v);
+  }
+  register_writes_.fetch_add(1, std::memory_order_relaxed);
 }
 /*!
  * \brief 配列の値を、指定したバンクへ書き込む
@@ -463,10 +397,105 @@ void FPGACommunicator::write(void* buffer,
                              uint64_t offset,
                              unsigned long length,
                              uint32_t bank) {
-  fpga_communicator::SelectBank(space_, bank);
-  fpga_communicator::Write(*handle_, space_,
-                           *write_descriptor_, write_buffer_.get(), dma_mode_,
-                           buffer, offset, length);
+  std::lock_guard<std::mutex> lock(dma_mutex_);
+  const auto start = steady_clock::now();
+
+  // allocateで確保した領域にあれば、そこから直接転送する
+  const auto region = fpga_communicator::FindRegion(
+      regions_, write_buffer_.get(), buffer_size_, buffer, length);
+  window_.select_bank(bank);
+  const uint64_t chunks =
+    fpga_communicator::Write(*device_, window_,
+                             region.first, region.second, chunk_size_,
+                             buffer, offset, length);
+
+  fpga_communicator::Count(statistics_, chunks, length, start);
+  StageTracer::instance().record(Stage::DMA_WRITE, start);
+}
+/*!
+ * \brief 転送スレッドでreadを行う
+ *
+ * 転送が完了するまで、bufferを書き換えたり破棄したりしてはならない.
+ *
+ * \param buffer 書き込み先
+ * \param offset バンク先頭からのオフセット
+ * \param length 読み込むバイト数
+ * \param bank バンク
+ * \return 転送の完了を待つためのfuture.転送中の例外はgetで再送出される
+ */
+std::future<void> FPGACommunicator::read_async(void* buffer,
+                                               uint64_t offset,
+                                               unsigned long length,
+                                               uint32_t bank) {
+  return enqueue(
+      packaged_task<void ()>(
+          [=] { read(buffer, offset, length, bank); }));
+}
+/*!
+ * \brief 転送スレッドでwriteを行う
+ *
+ * 転送が完了するまで、bufferを書き換えたり破棄したりしてはならない.
+ *
+ * \param buffer 書き込む配列
+ * \param offset バンク先頭からのオフセット
+ * \param length 書き込むバイト数
+ * \param bank バンク
+ * \return 転送の完了を待つためのfuture.転送中の例外はgetで再送出される
+ */
+std::future<void> FPGACommunicator::write_async(void* buffer,
+                                                uint64_t offset,
+                                                unsigned long length,
+                                                uint32_t bank) {
+  return enqueue(
+      packaged_task<void ()>(
+          [=] { write(buffer, offset, length, bank); }));
+}
+/*!
+ * \brief 1回のDMA転送の最大バイト数を設定する
+ *
+ * 転送はページ境界と、この大きさのうち近い方で分割される.既定値はページ
+ * の大きさ.
+ *
+ * \param chunk_size 最大バイト数
+ */
+void FPGACommunicator::set_chunk_size(unsigned long chunk_size) {
+  if (chunk_size == 0)
+    { throw runtime_error("the chunk size must be positive"); }
+
+  std::lock_guard<std::mutex> lock(dma_mutex_);
+  chunk_size_ = chunk_size;
+}
+/*!
+ * \brief これまでのDMA転送とレジスタへの書き込みの回数を返す
+ * \return 回数.レジスタへの書き込みはユーザレジスタへの書き込みを含む
+ */
+TransferStatistics FPGACommunicator::statistics() {
+  std::lock_guard<std::mutex> lock(dma_mutex_);
+
+  TransferStatistics statistics = statistics_;
+  statistics.register_writes += register_writes_.load();
+  return statistics;
+}
+/*!
+ * \brief 転送要求を転送スレッドへ渡す.転送スレッドは初回に起動する.
+ * \param task 転送要求
+ * \return 転送の完了を待つためのfuture
+ */
+std::future<void> FPGACommunicator::enqueue(packaged_task<void ()>&& task) {
+  std::call_once(transfer_thread_flag_, [this] {
+    transfer_thread_ = std::thread([this] {
+      Timeline::instance().name_thread("transfer");
+
+      packaged_task<void ()> t;
+      while (transfers_.pop(t)) { t(); }
+    });
+  });
+
+  auto future = task.get_future();
+  if (!transfers_.push(move(task)))
+    { throw runtime_error("the communicator has been closed"); }
+
+  return future;
 }
 /*!
  * \brief ユーザレジスタの値を出力
@@ -501,6 +530,16 @@ FPGACommunicator& SendImageSize(FPGACommunicator& com,
 
   return com;
 }
+/*!
+ * \brief FPGAボードへSRAM上の画像の配置を送る
+ * @param com コミュニケータ
+ * @param layout 画像の配置
+ */
+FPGACommunicator& SendColorLayout(FPGACommunicator& com, ColorLayout layout) {
+  com.write(COLOR_LAYOUT_REG, static_cast<uint32_t>(layout));
+
+  return com;
+}
 /*!
  * \brief FPGAボードへrefresh信号を送る
  * @param com コミュニケータ
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/frame_source.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+
+using std::string;
+using std::unique_ptr;
+
+
+namespace filter_core {
+namespace frame_source {
+
+/*!
+ * \var SEQUENCE_FPS
+ * 画像ファイルの連番を実時間で再生する場合の毎秒のフレーム数
+ */
+constexpr double SEQUENCE_FPS = 30.0;
+
+bool IsDeviceIndex(const std::string& input);
+bool IsGlob(const std::string& input);
+std::string GetStem(const std::string& filename);
+}  // namespace frame_source
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace frame_source {
+
+bool IsDeviceIndex(const string& input) {
+  return !input.empty() &&
+    std::all_of(input.begin(), input.end(), [](char c)
+                { return std::isdigit(static_cast<unsigned char>(c)); });
+}
+
+bool IsGlob(const string& input) {
+  return input.find_first_of("*?") != string::npos;
+}
+
+string GetStem(const string& filename) {
+  const auto slash = filename.find_last_of("/\\");
+  const string base = (slash == string::npos)?
+    filename : filename.substr(slash + 1);
+  const auto dot = base.find_last_of('.');
+  return (dot == string::npos || dot == 0)? base : base.substr(0, dot);
+}
+}  // namespace frame_source
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief コンストラクタ.パターンに一致するファイルを列挙する.
+ * \param pattern パターン.'*'と'?'を使える
+ * \param fps 実時間で再生する場合の毎秒のフレーム数
+ */
+ImageSequenceSource::ImageSequenceSource(const string& pattern, double fps)
+  : filenames_(), next_(0), name_(), fps_(fps) {
+  cv::glob(pattern, filenames_, false);
+  std::sort(filenames_.begin(), filenames_.end());
+}
+/*!
+ * \brief 次の画像ファイルを読み込む.
+ *
+ * 読み込めないファイルは、名前順の番号とともに報告して飛ばす.読み込んだ
+ * ファイルの名前はnameで得られる.
+ *
+ * \param frame 読み込み先
+ * \return 読み込めた場合は真.全てのファイルを読み込んだ場合は偽
+ */
+bool ImageSequenceSource::read(cv::Mat& frame) {
+  namespace detail = frame_source;
+
+  while (next_ < filenames_.size()) {
+    const size_t index = next_++;
+    frame = cv::imread(filenames_[index], CV_LOAD_IMAGE_COLOR);
+    if (!frame.empty()) {
+      name_ = detail::GetStem(filenames_[index]);
+      return true;
+    }
+    std::cerr << "skipped an unreadable image " << index << ": " <<
+      filenames_[index] << std::endl;
+  }
+  return false;
+}
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief 入力を開く.
+ *
+ * 数字だけの場合はカメラの番号、'*'か'?'を含む場合は画像ファイルのパター
+ * ン、それ以外は動画ファイルとして開く.
+ *
+ * \param input 入力
+ * \return 入力
+ */
+unique_ptr<FrameSource> MakeSource(const string& input) {
+  namespace detail = frame_source;
+
+  unique_ptr<FrameSource> source;
+  if (detail::IsDeviceIndex(input)) {
+    source.reset(new VideoSource(std::stoi(input)));
+  } else if (detail::IsGlob(input)) {
+    source.reset(new ImageSequenceSource(input, detail::SEQUENCE_FPS));
+  } else {
+    source.reset(new VideoSource(input));
+  }
+
+  if (!source->isOpened())
+    { throw std::runtime_error("failed to open the input: " + input); }
+  return source;
+}
+}  // namespace filter_core
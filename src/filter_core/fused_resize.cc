@@ -0,0 +1,481 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/fused_resize.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "filter_core/channels.h"
+#include "filter_core/worker_pool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_CORE_HAS_X86_KERNELS
+#endif
+
+
+using std::vector;
+using cv::Mat;
+using cv::Size;
+
+
+namespace filter_core {
+namespace fused_resize {
+
+/*!
+ * \var CHANNEL
+ * 入力のチャネル数.BGRのみ
+ */
+constexpr int CHANNEL = 3;
+/*!
+ * \var VECTOR_WIDTH
+ * SSSE3で一度に処理する画素数.AVX2はこの2倍
+ */
+constexpr int VECTOR_WIDTH = 16;
+/*!
+ * \var GRAY_SHIFT
+ * グレースケール変換の重みの小数部のビット数.cvtColorと同じ
+ */
+constexpr int GRAY_SHIFT = 14;
+constexpr int B_WEIGHT = 1868;
+constexpr int G_WEIGHT = 9617;
+constexpr int R_WEIGHT = 4899;
+constexpr int GRAY_ROUND = 1 << (GRAY_SHIFT - 1);
+/*!
+ * \var COEFFICIENT_BITS
+ * 線形補間の重みの小数部のビット数.resizeと同じ
+ */
+constexpr int COEFFICIENT_BITS = 11;
+constexpr int COEFFICIENT_SCALE = 1 << COEFFICIENT_BITS;
+/*!
+ * \var TILE_BYTES
+ * 並列に処理する場合に、1つの帯が参照する入力のおおよそのバイト数.L2キャッ
+ * シュに収まる大きさ
+ */
+constexpr size_t TILE_BYTES = 256 * 1024;
+
+void ConvertGrayRow(const uint8_t* src, uint8_t* dst, int begin, int end);
+template <int C>
+void Sample(const uint8_t* src, const Tap* taps, uint8_t* dst, int width);
+template <int C>
+void Interpolate(const uint8_t* src, const Tap* taps, int* dst, int width);
+#ifdef FILTER_CORE_HAS_X86_KERNELS
+int ConvertGrayRowSSSE3(const uint8_t* src, uint8_t* dst, int width);
+int ConvertGrayRowAVX2(const uint8_t* src, uint8_t* dst, int width);
+#endif
+}  // namespace fused_resize
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace fused_resize {
+
+void ConvertGrayRow(const uint8_t* src, uint8_t* dst, int begin, int end) {
+  for (int x = begin; x < end; ++x) {
+    const uint8_t* s = src + x * CHANNEL;
+    dst[x] = static_cast<uint8_t>(
+        (s[0] * B_WEIGHT + s[1] * G_WEIGHT + s[2] * R_WEIGHT + GRAY_ROUND) >>
+        GRAY_SHIFT);
+  }
+}
+
+/*!
+ * \brief 最近傍で1行を縮小する
+ */
+template <int C>
+void Sample(const uint8_t* src, const Tap* taps, uint8_t* dst, int width) {
+  for (int x = 0; x < width; ++x) {
+    const uint8_t* s = src + taps[x].offset[0] * C;
+    for (int c = 0; c < C; ++c) { dst[x * C + c] = s[c]; }
+  }
+}
+
+/*!
+ * \brief 線形補間で1行を縮小する.固定小数点のまま、丸めずに書き込む
+ */
+template <int C>
+void Interpolate(const uint8_t* src, const Tap* taps, int* dst, int width) {
+  for (int x = 0; x < width; ++x) {
+    const Tap& tap = taps[x];
+    const uint8_t* s0 = src + tap.offset[0] * C;
+    const uint8_t* s1 = src + tap.offset[1] * C;
+    for (int c = 0; c < C; ++c)
+      { dst[x * C + c] = s0[c] * tap.weight[0] + s1[c] * tap.weight[1]; }
+  }
+}
+
+#ifdef FILTER_CORE_HAS_X86_KERNELS
+/*!
+ * \brief 16画素をB、G、Rの各16バイトへ分解する.マスクはchannelsと共有する
+ */
+__attribute__((target("ssse3")))
+inline void Split16(const uint8_t* src, const channels::ShuffleMasks& masks,
+                    __m128i* bgr) {
+  const __m128i* p = reinterpret_cast<const __m128i*>(src);
+  const __m128i v[CHANNEL] =
+    {_mm_loadu_si128(p), _mm_loadu_si128(p + 1), _mm_loadu_si128(p + 2)};
+  for (int c = 0; c < CHANNEL; ++c) {
+    bgr[c] = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(v[0], masks.split[c][0]),
+                     _mm_shuffle_epi8(v[1], masks.split[c][1])),
+        _mm_shuffle_epi8(v[2], masks.split[c][2]));
+  }
+}
+
+/*!
+ * \brief 16ビットに広げた8画素のグレースケール値を求める
+ *
+ * (B, G)と(R, 1)の組を重みとpmaddwdで積和し、32ビットで足し合わせる.
+ */
+__attribute__((target("ssse3")))
+inline __m128i Gray8(__m128i b, __m128i g, __m128i r) {
+  const __m128i bg_weight = _mm_set1_epi32((G_WEIGHT << 16) | B_WEIGHT);
+  const __m128i r_weight = _mm_set1_epi32((GRAY_ROUND << 16) | R_WEIGHT);
+  const __m128i one = _mm_set1_epi16(1);
+
+  __m128i lo = _mm_add_epi32(
+      _mm_madd_epi16(_mm_unpacklo_epi16(b, g), bg_weight),
+      _mm_madd_epi16(_mm_unpacklo_epi16(r, one), r_weight));
+  __m128i hi = _mm_add_epi32(
+      _mm_madd_epi16(_mm_unpackhi_epi16(b, g), bg_weight),
+      _mm_madd_epi16(_mm_unpackhi_epi16(r, one), r_weight));
+  return _mm_packs_epi32(_mm_srai_epi32(lo, GRAY_SHIFT),
+                         _mm_srai_epi32(hi, GRAY_SHIFT));
+}
+
+__attribute__((target("ssse3")))
+int ConvertGrayRowSSSE3(const uint8_t* src, uint8_t* dst, int width) {
+  const auto& masks = channels::GetShuffleMasks();
+  const __m128i zero = _mm_setzero_si128();
+
+  int x = 0;
+  for (; x + VECTOR_WIDTH <= width; x += VECTOR_WIDTH) {
+    __m128i bgr[CHANNEL];
+    Split16(src + x * CHANNEL, masks, bgr);
+
+    const __m128i lo = Gray8(_mm_unpacklo_epi8(bgr[0], zero),
+                             _mm_unpacklo_epi8(bgr[1], zero),
+                             _mm_unpacklo_epi8(bgr[2], zero));
+    const __m128i hi = Gray8(_mm_unpackhi_epi8(bgr[0], zero),
+                             _mm_unpackhi_epi8(bgr[1], zero),
+                             _mm_unpackhi_epi8(bgr[2], zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+                     _mm_packus_epi16(lo, hi));
+  }
+  return x;
+}
+
+/*!
+ * \brief Gray8のAVX2版.128ビットのレーン毎に8画素ずつ処理する
+ */
+__attribute__((target("avx2")))
+inline __m256i Gray8x2(__m256i b, __m256i g, __m256i r) {
+  const __m256i bg_weight = _mm256_set1_epi32((G_WEIGHT << 16) | B_WEIGHT);
+  const __m256i r_weight = _mm256_set1_epi32((GRAY_ROUND << 16) | R_WEIGHT);
+  const __m256i one = _mm256_set1_epi16(1);
+
+  __m256i lo = _mm256_add_epi32(
+      _mm256_madd_epi16(_mm256_unpacklo_epi16(b, g), bg_weight),
+      _mm256_madd_epi16(_mm256_unpacklo_epi16(r, one), r_weight));
+  __m256i hi = _mm256_add_epi32(
+      _mm256_madd_epi16(_mm256_unpackhi_epi16(b, g), bg_weight),
+      _mm256_madd_epi16(_mm256_unpackhi_epi16(r, one), r_weight));
+  return _mm256_packs_epi32(_mm256_srai_epi32(lo, GRAY_SHIFT),
+                            _mm256_srai_epi32(hi, GRAY_SHIFT));
+}
+
+/*!
+ * \brief 32画素ずつ変換する.
+ *
+ * 16画素ずつ分解した2組を上下のレーンに置く.unpackとpackはレーン内で閉じ
+ * るため、並べ替えずに画素の順序が保たれる.
+ */
+__attribute__((target("avx2")))
+int ConvertGrayRowAVX2(const uint8_t* src, uint8_t* dst, int width) {
+  const auto& masks = channels::GetShuffleMasks();
+  const __m256i zero = _mm256_setzero_si256();
+
+  int x = 0;
+  for (; x + VECTOR_WIDTH * 2 <= width; x += VECTOR_WIDTH * 2) {
+    __m128i first[CHANNEL];
+    __m128i second[CHANNEL];
+    Split16(src + x * CHANNEL, masks, first);
+    Split16(src + (x + VECTOR_WIDTH) * CHANNEL, masks, second);
+
+    __m256i bgr[CHANNEL];
+    for (int c = 0; c < CHANNEL; ++c) {
+      bgr[c] = _mm256_inserti128_si256(
+          _mm256_castsi128_si256(first[c]), second[c], 1);
+    }
+
+    const __m256i lo = Gray8x2(_mm256_unpacklo_epi8(bgr[0], zero),
+                               _mm256_unpacklo_epi8(bgr[1], zero),
+                               _mm256_unpacklo_epi8(bgr[2], zero));
+    const __m256i hi = Gray8x2(_mm256_unpackhi_epi8(bgr[0], zero),
+                               _mm256_unpackhi_epi8(bgr[1], zero),
+                               _mm256_unpackhi_epi8(bgr[2], zero));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x),
+                        _mm256_packus_epi16(lo, hi));
+  }
+  return x;
+}
+#endif
+}  // namespace fused_resize
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief コンストラクタ.
+ * \param size 出力画像のサイズ
+ * \param interpolation 補間方法.cv::INTER_NEARESTかcv::INTER_LINEAR
+ * \param is_gray グレースケールへ変換する場合は真.偽の場合はBGRのまま縮小する
+ */
+FusedResizer::FusedResizer(Size size, int interpolation, bool is_gray)
+  : size_(size),
+    interpolation_(interpolation),
+    is_gray_(is_gray),
+    channels_((is_gray)? 1 : fused_resize::CHANNEL),
+    src_size_(),
+    columns_(),
+    rows_(),
+    scratches_() {}
+/*!
+ * \brief 呼び出したスレッドで画像全体を縮小する.
+ * \param src 入力画像.CV_8UC3
+ * \param dst 出力先.サイズと型が一致していれば再確保されない.
+ */
+void FusedResizer::resize(Mat src, Mat dst) {
+  prepare(src.size(), 1);
+  dst.create(size_, (is_gray_)? CV_8UC1 : CV_8UC3);
+
+  resize(src, dst, 0, size_.height, scratches_[0]);
+}
+/*!
+ * \brief 出力を行の帯に分け、複数のスレッドで縮小する.
+ * \param src 入力画像.CV_8UC3
+ * \param dst 出力先.サイズと型が一致していれば再確保されない.
+ * \param pool 帯を処理するスレッド
+ */
+void FusedResizer::resize(Mat src, Mat dst, WorkerPool& pool) {
+  prepare(src.size(), pool.size());
+  dst.create(size_, (is_gray_)? CV_8UC1 : CV_8UC3);
+
+  const int height = getBandHeight(src, pool.size());
+  const size_t bands = (size_.height + height - 1) / height;
+  pool.run(bands, [&](size_t band, size_t worker) {
+    const int begin = static_cast<int>(band) * height;
+    resize(src, dst, begin, std::min(begin + height, size_.height),
+           scratches_[worker]);
+  });
+}
+/*!
+ * \brief 入力のサイズに合わせて参照表を作り、作業領域を確保する.
+ *
+ * 参照する位置と重みはcv::resizeと同じ方法で求める.
+ *
+ * \param src_size 入力画像のサイズ
+ * \param scratch_count 作業領域の数.並列に処理するスレッドの数
+ */
+void FusedResizer::prepare(Size src_size, size_t scratch_count) {
+  namespace detail = fused_resize;
+
+  auto make_taps = [this](int src_length, int dst_length) {
+    const double scale = static_cast<double>(src_length) / dst_length;
+    vector<Tap> taps(dst_length);
+    for (int i = 0; i < dst_length; ++i) {
+      Tap& tap = taps[i];
+      if (interpolation_ == cv::INTER_NEAREST) {
+        const int s = std::min(cvFloor(i * scale), src_length - 1);
+        tap = {{s, s}, {detail::COEFFICIENT_SCALE, 0}};
+        continue;
+      }
+
+      float f = static_cast<float>((i + 0.5) * scale - 0.5);
+      int s = cvFloor(f);
+      f -= s;
+      if (s < 0) { f = 0.0f; s = 0; }
+      if (s >= src_length - 1) { f = 0.0f; s = src_length - 1; }
+      tap = {{s, std::min(s + 1, src_length - 1)},
+             {cvRound((1.0f - f) * detail::COEFFICIENT_SCALE),
+              cvRound(f * detail::COEFFICIENT_SCALE)}};
+    }
+    return taps;
+  };
+
+  if (src_size != src_size_) {
+    src_size_ = src_size;
+    columns_ = make_taps(src_size.width, size_.width);
+    rows_ = make_taps(src_size.height, size_.height);
+    scratches_.clear();
+  }
+
+  if (scratches_.size() < scratch_count) {
+    scratches_.resize(scratch_count);
+    for (auto& scratch : scratches_) {
+      scratch.gray.resize((is_gray_)? src_size.width : 0);
+      for (auto& row : scratch.interpolated)
+        { row.resize(size_.width * channels_); }
+    }
+  }
+}
+/*!
+ * \brief 帯の高さを求める.
+ *
+ * 1つの帯が参照する入力がTILE_BYTESに収まるようにし、全てのスレッドに少
+ * なくとも1つの帯が行き渡るようにする.
+ *
+ * \param src 入力画像
+ * \param thread_count スレッドの数
+ * \return 出力の行数
+ */
+int FusedResizer::getBandHeight(Mat src, size_t thread_count) const {
+  namespace detail = fused_resize;
+
+  // 出力1行あたりに読む入力のバイト数.線形補間は2行を読む
+  const size_t taps = (interpolation_ == cv::INTER_NEAREST)? 1 : 2;
+  const size_t bytes_per_row = std::max<size_t>(
+      src.cols * detail::CHANNEL * taps *
+        std::max(src.rows / std::max(size_.height, 1), 1), 1);
+  const int by_cache = static_cast<int>(
+      std::max<size_t>(detail::TILE_BYTES / bytes_per_row, 1));
+  const int by_threads = static_cast<int>(
+      (size_.height + thread_count - 1) / std::max<size_t>(thread_count, 1));
+  return std::max(std::min(by_cache, by_threads), 1);
+}
+/*!
+ * \brief 出力の[begin, end)行を縮小する.
+ * \param src 入力画像
+ * \param dst 出力画像
+ * \param begin 最初の行
+ * \param end 最後の次の行
+ * \param scratch このスレッドの作業領域
+ */
+void FusedResizer::resize(Mat src, Mat dst, int begin, int end,
+                          Scratch& scratch) const {
+  namespace detail = fused_resize;
+
+  if (interpolation_ == cv::INTER_NEAREST) {
+    for (int y = begin; y < end; ++y) {
+      const uint8_t* s = load(src, rows_[y].offset[0], scratch);
+      uint8_t* d = dst.ptr<uint8_t>(y);
+      if (is_gray_) {
+        detail::Sample<1>(s, columns_.data(), d, size_.width);
+      } else {
+        detail::Sample<detail::CHANNEL>(s, columns_.data(), d, size_.width);
+      }
+    }
+    return;
+  }
+
+  // 横方向に補間した行は、隣り合う出力の行で共有する
+  scratch.interpolated_row[0] = scratch.interpolated_row[1] = -1;
+  const int width = size_.width * channels_;
+  constexpr int shift = detail::COEFFICIENT_BITS * 2;
+  for (int y = begin; y < end; ++y) {
+    const Tap& tap = rows_[y];
+    const int* top = interpolate(src, tap.offset[0], nullptr, scratch);
+    const int* bottom = interpolate(src, tap.offset[1], top, scratch);
+
+    uint8_t* d = dst.ptr<uint8_t>(y);
+    for (int x = 0; x < width; ++x) {
+      d[x] = static_cast<uint8_t>(
+          (top[x] * tap.weight[0] + bottom[x] * tap.weight[1] +
+           (1 << (shift - 1))) >> shift);
+    }
+  }
+}
+/*!
+ * \brief 入力の1行を返す.グレースケールへ変換する場合は作業領域へ変換する.
+ * \param src 入力画像
+ * \param y 入力の行
+ * \param scratch このスレッドの作業領域
+ * \return 行の先頭
+ */
+const uint8_t* FusedResizer::load(Mat src, int y, Scratch& scratch) const {
+  if (!is_gray_) { return src.ptr<uint8_t>(y); }
+
+  ConvertGrayRow(src.ptr<uint8_t>(y), scratch.gray.data(), src.cols);
+  return scratch.gray.data();
+}
+/*!
+ * \brief 入力の1行を横方向に補間する.
+ *
+ * 直近の2行は作業領域に保持しておき、同じ行であれば読み直さない.
+ *
+ * \param src 入力画像
+ * \param y 入力の行
+ * \param keep 上書きしてはならない行.なければnullptr
+ * \param scratch このスレッドの作業領域
+ * \return 補間した行
+ */
+const int* FusedResizer::interpolate(Mat src, int y, const int* keep,
+                                     Scratch& scratch) const {
+  namespace detail = fused_resize;
+
+  for (int i = 0; i < 2; ++i) {
+    if (scratch.interpolated_row[i] == y)
+      { return scratch.interpolated[i].data(); }
+  }
+
+  const int i = (scratch.interpolated[0].data() == keep)? 1 : 0;
+  const uint8_t* s = load(src, y, scratch);
+  int* row = scratch.interpolated[i].data();
+  if (is_gray_) {
+    detail::Interpolate<1>(s, columns_.data(), row, size_.width);
+  } else {
+    detail::Interpolate<detail::CHANNEL>(s, columns_.data(), row, size_.width);
+  }
+  scratch.interpolated_row[i] = y;
+  return row;
+}
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief FusedResizerで縮小できるかを返す.
+ *
+ * 入力がCV_8UC3で、縮小(または等倍)で、補間が最近傍か線形の場合に限る.
+ *
+ * \param src 入力画像
+ * \param size 出力画像のサイズ
+ * \param interpolation 補間方法
+ * \return 変換できる場合は真
+ */
+bool CanFuseResize(Mat src, Size size, int interpolation) {
+  return src.type() == CV_8UC3 &&
+    size.width > 0 && size.height > 0 &&
+    size.width <= src.cols && size.height <= src.rows &&
+    (interpolation == cv::INTER_NEAREST || interpolation == cv::INTER_LINEAR);
+}
+/*!
+ * \brief BGRの1行をグレースケールへ変換する.
+ *
+ * AVX2かSSSE3が使える場合はそれを使う.結果はcvtColor(CV_BGR2GRAY)と一致
+ * する.
+ *
+ * \param src 入力の行
+ * \param dst 出力の行
+ * \param width 画素数
+ */
+void ConvertGrayRow(const uint8_t* src, uint8_t* dst, int width) {
+  namespace detail = fused_resize;
+
+  int x = 0;
+#ifdef FILTER_CORE_HAS_X86_KERNELS
+  if (channels::HasAVX2()) {
+    x = detail::ConvertGrayRowAVX2(src, dst, width);
+  } else if (channels::HasSSSE3()) {
+    x = detail::ConvertGrayRowSSSE3(src, dst, width);
+  }
+#endif
+  detail::ConvertGrayRow(src, dst, x, width);
+}
+}  // namespace filter_core
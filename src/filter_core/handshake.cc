@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/handshake.h"
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include "filter_core/finish_waiter.h"
+#include "filter_core/fpga_communicator.h"
+#include "filter_core/stage_tracer.h"
+
+
+using std::runtime_error;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+
+
+namespace filter_core {
+namespace handshake {
+
+/*!
+ * \var REFRESH_ACK_TIMEOUT
+ * refresh信号の応答を待つ最大時間.従来の待ち時間(300us)より十分長い
+ */
+constexpr microseconds REFRESH_ACK_TIMEOUT(1000);
+
+bool SendAcknowledgedRefresh(filter_core::FPGACommunicator& com,
+                             filter_core::WaitStrategy strategy);
+}  // namespace handshake
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace handshake {
+/*!
+ * \brief refresh信号を送り、応答が有効になり、無効に戻るまで待つ.
+ * \param com FPGAボードとのコミュニケータ
+ * \param strategy 待ち方
+ * \return 応答が返れば真.返らなければrefresh信号を無効にして偽
+ */
+bool SendAcknowledgedRefresh(FPGACommunicator& com, WaitStrategy strategy) {
+  com.write(REFRESH_REG, 1);
+  const bool is_set =
+    WaitRegister(com, REFRESH_ACK_REG, true, strategy, REFRESH_ACK_TIMEOUT);
+  com.write(REFRESH_REG, 0);
+
+  return is_set &&
+         WaitRegister(com, REFRESH_ACK_REG, false, strategy,
+                      REFRESH_ACK_TIMEOUT);
+}
+}  // namespace handshake
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief コンストラクタ.
+ * \param strategy 信号の待ち方
+ * \param timeout finish信号を待つ最大時間
+ * \param is_acknowledged refresh信号の応答を使う場合は真
+ */
+Handshake::Handshake(WaitStrategy strategy,
+                     microseconds timeout,
+                     bool is_acknowledged)
+  : finish_waiter_(strategy, timeout),
+    strategy_(strategy),
+    is_acknowledged_(is_acknowledged),
+    mutex_(),
+    refresh_statistics_() {}
+/*!
+ * \brief refresh信号を送り、enable信号を有効にする.
+ * \param com FPGAボードとのコミュニケータ
+ */
+void Handshake::start(FPGACommunicator& com) {
+  refresh(com);
+  com.write(ENABLE_REG, 1);
+}
+/*!
+ * \brief フィルタリング完了を待ち、enable信号を無効にする.
+ *
+ * タイムアウトした場合もenable信号を無効にしてから例外を送出する.
+ *
+ * \param com FPGAボードとのコミュニケータ
+ */
+void Handshake::stop(FPGACommunicator& com) {
+  const bool is_finished = finish_waiter_.wait(com);
+  com.write(ENABLE_REG, 0);
+  if (!is_finished)
+    { throw runtime_error("timed out waiting for the finish signal"); }
+}
+/*!
+ * \brief refresh信号にかかった時間の統計を返す.
+ *
+ * タイムアウトの数は、応答が返らず一定時間待つ方法に切り替えた回数.
+ *
+ * \return 統計
+ */
+WaitStatistics Handshake::refresh_statistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return refresh_statistics_;
+}
+/*!
+ * \brief refresh信号を送る.
+ * \param com FPGAボードとのコミュニケータ
+ */
+void Handshake::refresh(FPGACommunicator& com) {
+  const auto start = steady_clock::now();
+
+  bool is_timed_out = false;
+  if (is_acknowledged_.load() &&
+      !handshake::SendAcknowledgedRefresh(com, strategy_)) {
+    is_timed_out = true;
+    if (is_acknowledged_.exchange(false)) {
+      std::cerr << "the bitstream did not acknowledge the refresh signal; "
+                   "falling back to fixed delays" << std::endl;
+    }
+  }
+  if (!is_acknowledged_.load()) { SendRefresh(com); }
+
+  const auto end = steady_clock::now();
+  StageTracer::instance().record(Stage::REFRESH, start, end);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  refresh_statistics_.add(duration_cast<microseconds>(end - start),
+                          is_timed_out);
+}
+}  // namespace filter_core
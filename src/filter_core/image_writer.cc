@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/image_writer.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "filter_core/timeline.h"
+
+
+using std::runtime_error;
+using std::string;
+
+
+namespace filter_core {
+/*!
+ * \brief コンストラクタ.領域を確保し、cv::imwriteで書き込むスレッドを起動する.
+ * \param thread_count 符号化するスレッドの数
+ * \param depth 書き込み待ちにできる画像の数
+ * \param size 画像サイズ
+ * \param type 画像の型
+ * \param parameters cv::imwriteに渡す形式毎のパラメータ
+ */
+ImageWriter::ImageWriter(size_t thread_count, size_t depth,
+                         cv::Size size, int type,
+                         const std::vector<int>& parameters)
+  : ImageWriter(thread_count, depth, size, type,
+                [parameters](const cv::Mat& image, const string& filename) {
+                  if (!cv::imwrite(filename, image, parameters))
+                    { throw runtime_error("failed to write " + filename); }
+                }) {}
+/*!
+ * \brief コンストラクタ.領域を確保し、スレッドを起動する.
+ * \param thread_count 符号化するスレッドの数
+ * \param depth 書き込み待ちにできる画像の数
+ * \param size 画像サイズ
+ * \param type 画像の型
+ * \param encoder 符号化
+ */
+ImageWriter::ImageWriter(size_t thread_count, size_t depth,
+                         cv::Size size, int type,
+                         encoder_t encoder)
+  : slots_(),
+    free_(std::max<size_t>(depth, 1)),
+    jobs_(std::max<size_t>(depth, 1)),
+    encoder_(std::move(encoder)),
+    written_(0),
+    skipped_(0),
+    error_mutex_(),
+    error_(),
+    threads_() {
+  for (size_t i = 0; i < std::max<size_t>(depth, 1); ++i) {
+    slots_.emplace_back(size, type);
+    free_.push(i);
+  }
+  for (size_t i = 0; i < std::max<size_t>(thread_count, 1); ++i)
+    { threads_.emplace_back(&ImageWriter::run, this); }
+}
+/*!
+ * \brief デストラクタ.書き込み待ちの画像を書き込んでから終了する.
+ */
+ImageWriter::~ImageWriter() {
+  jobs_.close();
+  for (auto& t : threads_) { if (t.joinable()) { t.join(); } }
+}
+/*!
+ * \brief 画像を複製し、書き込みを依頼する.
+ *
+ * 以前の書き込みで送出された例外は、ここで再送出される.
+ *
+ * \param image 画像
+ * \param filename ファイル名
+ */
+void ImageWriter::write(cv::Mat image, const string& filename) {
+  rethrow();
+
+  size_t slot = 0;
+  if (!free_.pop(slot)) { throw runtime_error("the image writer is closed"); }
+
+  enqueue(slot, image, filename);
+}
+/*!
+ * \brief 空いた領域があれば画像を複製し、書き込みを依頼する.ブロックしない.
+ *
+ * 以前の書き込みで送出された例外は、ここで再送出される.
+ *
+ * \param image 画像
+ * \param filename ファイル名
+ * \return 依頼した場合は真.全ての領域が書き込み待ちで、画像を捨てた場合は偽
+ */
+bool ImageWriter::try_write(cv::Mat image, const string& filename) {
+  rethrow();
+
+  size_t slot = 0;
+  if (!free_.try_pop(slot)) {
+    skipped_.fetch_add(1);
+    return false;
+  }
+
+  enqueue(slot, image, filename);
+  return true;
+}
+/*!
+ * \brief 全ての画像を書き込み終えるまで待つ.
+ *
+ * 書き込みで送出された例外は、ここで再送出される.
+ */
+void ImageWriter::close() {
+  jobs_.close();
+  for (auto& t : threads_) { if (t.joinable()) { t.join(); } }
+  rethrow();
+}
+/*!
+ * \brief 符号化するスレッドの処理.
+ */
+void ImageWriter::run() {
+  Timeline::instance().name_thread("encoder");
+
+  job_type job;
+  while (jobs_.pop(job)) {
+    try {
+      ScopedSpan span("encode");
+      encoder_(slots_[job.first], job.second);
+      written_.fetch_add(1);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex_);
+      if (!error_) { error_ = std::current_exception(); }
+    }
+    free_.push(job.first);
+  }
+}
+/*!
+ * \brief 画像を領域へ複製し、符号化するスレッドへ渡す.
+ * \param slot 領域
+ * \param image 画像
+ * \param filename ファイル名
+ */
+void ImageWriter::enqueue(size_t slot, cv::Mat image, const string& filename) {
+  image.copyTo(slots_[slot]);
+  if (!jobs_.push(job_type(slot, filename)))
+    { throw runtime_error("the image writer is closed"); }
+}
+/*!
+ * \brief 書き込みで送出された例外があれば再送出する.
+ */
+void ImageWriter::rethrow() {
+  std::lock_guard<std::mutex> lock(error_mutex_);
+  if (error_) { std::rethrow_exception(error_); }
+}
+}  // namespace filter_core
@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/pipeline.h"
+
+#include "filter_core/timeline.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+using std::exception_ptr;
+using std::thread;
+using cv::Mat;
+using cv::Size;
+
+
+namespace filter_core {
+namespace pipeline {
+
+size_t CountFrames(const std::vector<std::vector<filter_core::Frame>>& lanes);
+}  // namespace pipeline
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace pipeline {
+/*!
+ * \brief 全てのレーンのフレームの数を返す.
+ * \param lanes レーン毎のフレーム
+ * \return フレームの数
+ */
+size_t CountFrames(const std::vector<std::vector<Frame>>& lanes) {
+  size_t total = 0;
+  for (const auto& frames : lanes) { total += frames.size(); }
+  return total;
+}
+}  // namespace pipeline
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief コンストラクタ.フレームを確保する.
+ * \param depth パイプライン上に同時に存在するフレーム数
+ * \param size 画像サイズ
+ * \param type 画像の型
+ */
+Pipeline::Pipeline(size_t depth, Size size, int type)
+  : frames_(),
+    lanes_(),
+    dispatch_(Dispatch::ROUND_ROBIN),
+    filtered_(depth),
+    free_mutex_(),
+    free_returned_(),
+    is_closed_(false) {
+  std::vector<Frame> frames;
+  for (size_t i = 0; i < depth; ++i)
+    { frames.emplace_back(Mat(size, type), Mat(size, type)); }
+
+  frames_.reserve(depth);
+  add_lane(std::move(frames));
+}
+/*!
+ * \brief コンストラクタ.確保済みのフレームを使用する.
+ *
+ * DMAバッファを参照するフレームを渡すことで、ステージ間のコピーを省略できる.
+ *
+ * \param frames フレーム
+ */
+Pipeline::Pipeline(std::vector<Frame>&& frames)
+  : frames_(),
+    lanes_(),
+    dispatch_(Dispatch::ROUND_ROBIN),
+    filtered_(frames.size()),
+    free_mutex_(),
+    free_returned_(),
+    is_closed_(false) {
+  frames_.reserve(frames.size());
+  add_lane(std::move(frames));
+}
+/*!
+ * \brief コンストラクタ.レーン毎に確保済みのフレームを使用する.
+ *
+ * 各レーンのフレームはそのレーンのFPGA転送ステージだけが使うため、ボード
+ * 毎のDMAバッファを参照させられる.
+ *
+ * \param lanes レーン毎のフレーム
+ * \param dispatch フレームの割り当て方
+ */
+Pipeline::Pipeline(std::vector<std::vector<Frame>>&& lanes, Dispatch dispatch)
+  : frames_(),
+    lanes_(),
+    dispatch_(dispatch),
+    filtered_(pipeline::CountFrames(lanes)),
+    free_mutex_(),
+    free_returned_(),
+    is_closed_(false) {
+  frames_.reserve(pipeline::CountFrames(lanes));
+  for (auto& frames : lanes) { add_lane(std::move(frames)); }
+}
+/*!
+ * \brief パイプラインを実行する.
+ *
+ * キャプチャが終端に達するか、出力ステージが偽を返すまで実行する.いずれか
+ * のステージで送出された例外は、全てのスレッドを停止させた後に再送出される.
+ *
+ * \param capture キャプチャステージ
+ * \param filter FPGA転送ステージ
+ * \param output 出力ステージ
+ */
+void Pipeline::run(capture_t capture, filter_t filter, output_t output) {
+  run(capture,
+      [&filter](size_t, Mat& src, Mat dst) { return filter(src, dst); },
+      output);
+}
+/*!
+ * \brief レーン毎のFPGA転送ステージでパイプラインを実行する.
+ *
+ * FPGA転送ステージはレーン毎のスレッドで並行に実行される.出力ステージは
+ * キャプチャした順にフレームを受け取る.
+ *
+ * \param capture キャプチャステージ
+ * \param filter FPGA転送ステージ
+ * \param output 出力ステージ
+ */
+void Pipeline::run(capture_t capture, lane_filter_t filter, output_t output) {
+  run(capture, filter, nullptr, output);
+}
+/*!
+ * \brief 結果を遅らせるFPGA転送ステージでパイプラインを実行する.
+ *
+ * キャプチャが終端に達した後、各レーンは結果を待っているフレームがなくな
+ * るまで、空きフレームへ終了ステージで結果を取り出す.
+ *
+ * \param capture キャプチャステージ
+ * \param filter FPGA転送ステージ
+ * \param finish 終了ステージ.残った入力画像と結果を書き込んだ場合は真を
+ *        返す.結果を遅らせない場合はnullptr
+ * \param output 出力ステージ
+ */
+void Pipeline::run(capture_t capture, lane_filter_t filter,
+                   lane_filter_t finish, output_t output) {
+  std::mutex error_mutex;
+  exception_ptr error;
+  auto guard = [&](std::function<void ()> stage) {
+    try {
+      stage();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error) { error = std::current_exception(); }
+      close();
+    }
+  };
+
+  thread capture_thread([&] {
+    Timeline::instance().name_thread("capture");
+    guard([&] {
+      Frame* frame = nullptr;
+      for (uint64_t i = 0; ; ++i) {
+        const size_t l = select(i);
+        if (l == lanes_.size()) { break; }
+        Lane& lane = *lanes_[l];
+        if (!lane.free.pop(frame)) { break; }
+        ++lane.taken;
+        ++lane.in_flight;
+        if (!capture(frame->src)) {
+          // 終了ステージが使えるよう、フレームを空きフレームへ戻す
+          --lane.in_flight;
+          release(lane, frame);
+          break;
+        }
+        frame->index = i;
+        if (!lane.captured.push(frame)) { break; }
+      }
+    });
+    for (auto& lane : lanes_) { lane->captured.close(); }
+  });
+
+  // 最後に終えたFPGA転送ステージが出力ステージへ終端を伝える
+  std::atomic<size_t> running(lanes_.size());
+  std::vector<thread> filter_threads;
+  for (size_t l = 0; l < lanes_.size(); ++l) {
+    filter_threads.emplace_back([&, l] {
+      Timeline::instance().name_thread("filter");
+      guard([&] {
+        Lane& lane = *lanes_[l];
+        Frame* frame = nullptr;
+        while (lane.captured.pop(frame)) {
+          bool is_filtered = false;
+          {
+            ScopedSpan span("frame", "index", frame->index);
+            lane.held.push_back(frame->index);
+            is_filtered = filter(l, frame->src, frame->dst);
+          }
+          --lane.in_flight;
+          if (!is_filtered) {
+            lane.holding = lane.held.size();
+            release(lane, frame);
+            continue;
+          }
+          // 結果は最も古い待っているフレームのもの
+          frame->index = lane.held.front();
+          lane.held.pop_front();
+          lane.holding = lane.held.size();
+          ++lane.filtered;
+          if (!filtered_.push(frame)) { break; }
+        }
+
+        while (finish && !lane.held.empty() && lane.free.pop(frame)) {
+          ++lane.taken;
+          if (!finish(l, frame->src, frame->dst)) { break; }
+          frame->index = lane.held.front();
+          lane.held.pop_front();
+          lane.holding = lane.held.size();
+          ++lane.filtered;
+          if (!filtered_.push(frame)) { break; }
+        }
+      });
+      if (--running == 0) { filtered_.close(); }
+    });
+  }
+
+  Timeline::instance().name_thread("output");
+  guard([&] {
+    // 複数のレーンから前後して届くフレームを、キャプチャした順に並べ直す
+    std::map<uint64_t, Frame*> pending;
+    uint64_t next = 0;
+    Frame* frame = nullptr;
+    while (filtered_.pop(frame)) {
+      pending.emplace(frame->index, frame);
+      for (auto it = pending.begin();
+           it != pending.end() && it->first == next;
+           it = pending.erase(it), ++next) {
+        Frame* f = it->second;
+        if (!output(f->src, f->dst)) { return; }
+        release(*lanes_[f->lane], f);
+      }
+    }
+  });
+  close();
+
+  capture_thread.join();
+  for (auto& t : filter_threads) { t.join(); }
+
+  if (error) { std::rethrow_exception(error); }
+}
+/*!
+ * \brief レーン毎のフィルタしたフレームの数を返す.
+ * \return フレームの数
+ */
+std::vector<uint64_t> Pipeline::filtered() const {
+  std::vector<uint64_t> counts;
+  for (const auto& lane : lanes_) { counts.push_back(lane->filtered.load()); }
+  return counts;
+}
+/*!
+ * \brief レーンを追加する.フレームは空きフレームになる.
+ *
+ * frames_の領域は事前に確保しておくこと.フレームのアドレスが変わらない
+ * ことを前提とする.
+ *
+ * \param frames レーンのフレーム
+ */
+void Pipeline::add_lane(std::vector<Frame>&& frames) {
+  const size_t l = lanes_.size();
+  lanes_.emplace_back(new Lane(std::max<size_t>(frames.size(), 1)));
+  lanes_.back()->depth = frames.size();
+  for (auto& frame : frames) {
+    frame.lane = l;
+    frames_.push_back(std::move(frame));
+    lanes_.back()->free.push(&frames_.back());
+  }
+}
+/*!
+ * \brief キャプチャするフレームを割り当てるレーンを選び、その空きフレーム
+ *        を待つ.
+ *
+ * フレームが戻る度に選び直す.結果を遅らせるレーンは、次のフレームを受け
+ * 取るまで出力ステージを止めるため、他のレーンの空きフレームだけを待つと
+ * 止まってしまう.
+ *
+ * \param index フレームの番号
+ * \return レーンの番号.閉じられた場合はレーンの数
+ */
+size_t Pipeline::select(uint64_t index) {
+  std::unique_lock<std::mutex> lock(free_mutex_);
+  size_t selected = 0;
+  free_returned_.wait(lock, [&] {
+    selected = choose(index);
+    const Lane& lane = *lanes_[selected];
+    return is_closed_ || lane.taken.load() < lane.depth;
+  });
+  return (is_closed_)? lanes_.size() : selected;
+}
+/*!
+ * \brief キャプチャするフレームを割り当てるレーンを決める.
+ *
+ * 結果を待っているフレームがあり、空きフレームのあるレーンを優先する.
+ *
+ * \param index フレームの番号
+ * \return レーンの番号
+ */
+size_t Pipeline::choose(uint64_t index) const {
+  const size_t first = index % lanes_.size();
+  if (dispatch_ == Dispatch::ROUND_ROBIN) { return first; }
+
+  for (size_t i = 0; i < lanes_.size(); ++i) {
+    const Lane& lane = *lanes_[(first + i) % lanes_.size()];
+    if (lane.holding.load() > 0 && lane.taken.load() < lane.depth)
+      { return (first + i) % lanes_.size(); }
+  }
+
+  // 処理待ちが同じであれば順番に割り当てる
+  size_t selected = first;
+  for (size_t i = 1; i < lanes_.size(); ++i) {
+    const size_t l = (first + i) % lanes_.size();
+    if (lanes_[l]->in_flight.load() < lanes_[selected]->in_flight.load())
+      { selected = l; }
+  }
+  return selected;
+}
+/*!
+ * \brief フレームをレーンの空きフレームへ戻し、キャプチャステージへ伝え
+ *        る.
+ * \param lane レーン
+ * \param frame フレーム
+ */
+void Pipeline::release(Lane& lane, Frame* frame) {
+  --lane.taken;
+  lane.free.push(frame);
+  { std::lock_guard<std::mutex> lock(free_mutex_); }
+  free_returned_.notify_one();
+}
+/*!
+ * \brief 全てのキューを閉じ、各ステージを停止させる.
+ */
+void Pipeline::close() {
+  for (auto& lane : lanes_) {
+    lane->free.close();
+    lane->captured.close();
+  }
+  filtered_.close();
+
+  {
+    std::lock_guard<std::mutex> lock(free_mutex_);
+    is_closed_ = true;
+  }
+  free_returned_.notify_all();
+}
+/*!
+ * \brief フレームの割り当て方の名前を返す.
+ * \param dispatch 割り当て方
+ * \return 名前
+ */
+std::string ToString(Dispatch dispatch) {
+  switch (dispatch) {
+    case Dispatch::ROUND_ROBIN: return "round-robin";
+    case Dispatch::LEAST_LOADED: return "least-loaded";
+  }
+  return "";
+}
+}  // namespace filter_core
@@ -5,12 +5,19 @@
  * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
  */
 #include "filter_core/program_options.h"
+#include "filter_core/stream_set.h"
 
 #include <boost/program_options.hpp>
 #include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <functional>
 #include <limits>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 
 
 #define nullopt boost::none;
@@ -32,10 +39,27 @@ namespace filter_core {
 namespace program_options_detail {
 
 boost::program_options::options_description GetDescription();
+filter_core::EmulatorOptions GetEmulatorOptions(
+    const boost::program_options::variables_map& vm);
+filter_core::RecordOptions GetRecordOptions(
+    const boost::program_options::variables_map& vm);
 filter_core::ImageOptions GetImageOptions(
     const boost::program_options::variables_map& vm);
-cv::Size GetImageSize(const std::string& size) noexcept;
 int GetInterpolation(const std::string& i) noexcept;
+cv::Size GetRoiSize(const boost::program_options::variables_map& vm);
+boost::optional<cv::Point> GetRoiOrigin(
+    const boost::program_options::variables_map& vm);
+filter_core::Dispatch GetDispatch(const std::string& s);
+filter_core::ColorLayout GetColorLayout(
+    const boost::program_options::variables_map& vm);
+filter_core::ComposeLayout GetComposeLayout(
+    const boost::program_options::variables_map& vm);
+size_t GetEncoderCount(const boost::program_options::variables_map& vm);
+size_t GetConvertThreadCount(const boost::program_options::variables_map& vm);
+boost::optional<filter_core::ReferenceFilter> GetHybridFilter(
+    const boost::program_options::variables_map& vm);
+size_t GetHybridThreadCount(const boost::program_options::variables_map& vm);
+std::string JoinInputs(const std::vector<std::string>& inputs);
 boost::program_options::variables_map GetVariablesMap(int argc, char** argv);
 void ShowHelp();
 }  // namespace program_options_detail
@@ -52,45 +76,222 @@ options_description GetDescription() {
     ("filename,i", value<string>(), "bit filename")
     ("output-directory", value<string>()->default_value("."),
      "directory for image output")
-    ("show-source", "show with a captured frame")
+    ("show-source", "show with a captured frame, same as --layout=side-by-side")
+    ("layout", value<string>(),
+     "show the filtered frame only or with a captured frame as 'filtered', "
+     "'side-by-side', 'stacked' or 'difference'")
     ("frequency", value<double>()->default_value(40.0),
      "set circuit operating frequency")
     ("image-size", value<string>()->default_value(string("middle")),
-     "set image size")
+     "set image size: small, middle, large or WxH")
     ("interpolation", value<string>()->default_value(string("linear")),
      "set interpolation")
     ("colored", "colored image")
-    ("debug", "show debug info");
+    ("color-layout", value<string>()->default_value(string("planar")),
+     "arrange a colored image in SRAM as planar or interleaved")
+    ("debug", "show debug info")
+    ("pipeline", value<size_t>()->implicit_value(3),
+     "run capture, transfer and display in parallel with N frames in flight")
+    ("ping-pong", "alternate between two input/output bank pairs")
+    ("emulator", "use a software emulator instead of the board")
+    ("emulator-filter", value<string>()->default_value(string("copy")),
+     "filter run by the emulator")
+    ("emulator-latency", value<unsigned int>()->default_value(0),
+     "minimum microseconds the emulator takes to filter a frame")
+    ("emulator-bandwidth", value<double>()->default_value(0.0),
+     "emulated DMA bandwidth in MB/s, 0 for unlimited")
+    ("wait", value<string>()->default_value(string("adaptive")),
+     "how to wait for the finish signal")
+    ("wait-timeout", value<unsigned int>()->default_value(250),
+     "give up waiting for the finish signal after this many milliseconds")
+    ("refresh-ack", "wait for the bitstream to acknowledge the refresh signal")
+    ("roi", value<string>(),
+     "filter only a WxH region around the clicked point")
+    ("roi-origin", value<string>(),
+     "fix the top-left corner of the region at X,Y")
+    ("trace", value<string>(),
+     "write a timeline of the frames to a trace event JSON file")
+    ("trace-capacity", value<size_t>()->default_value(65536),
+     "number of trace events kept per thread")
+    ("input", value<std::vector<string>>()->default_value(
+                std::vector<string>(1, "0"), "0"),
+     "camera index, video file or image file pattern such as 'dir/*.png'; "
+     "repeat to pack several streams into one frame for the board")
+    ("prefetch", value<size_t>()->implicit_value(4),
+     "read and convert N frames ahead on a separate thread")
+    ("as-fast-as-possible",
+     "read files as fast as possible instead of at their frame rate")
+    ("batch", value<string>(),
+     "filter every input image without a display and write them to a directory")
+    ("encoders", value<size_t>()->default_value(0),
+     "number of threads encoding output images in batch mode or a recorded "
+     "image sequence, 0 for all cores")
+    ("display-fps", value<double>()->default_value(0.0),
+     "show at most N frames per second, 0 for every filtered frame")
+    ("convert-threads", value<size_t>()->default_value(1),
+     "number of threads converting a captured frame, 0 for all cores")
+    ("convert-pin", "pin the conversion threads to the allowed CPUs")
+    ("image-format", value<string>()->default_value(string("png")),
+     "file extension of snapshots, recorded and batch output images")
+    ("compression", value<int>()->default_value(-1),
+     "PNG compression level 0-9 or JPEG quality 0-100, -1 for the default")
+    ("record", value<string>(),
+     "record every filtered frame to a video file (.avi, .mp4, .mkv, .mov) "
+     "or as numbered images in a directory")
+    ("record-fourcc", value<string>()->default_value(string("MJPG")),
+     "four character code of the recorded video")
+    ("record-fps", value<double>()->default_value(30.0),
+     "frame rate stored in the recorded video")
+    ("boards", value<size_t>()->default_value(1),
+     "number of boards from card 0 filtering frames in parallel")
+    ("dispatch", value<string>()->default_value(string("least-loaded")),
+     "how to assign frames to the boards: round-robin or least-loaded")
+    ("hybrid", value<string>(),
+     "filter the lower rows of each frame on the CPU with the given reference "
+     "filter of the bitstream, balancing the split every frame")
+    ("hybrid-threads", value<size_t>()->default_value(0),
+     "number of threads in hybrid filtering, 0 for all cores")
+    ("passes", value<size_t>()->default_value(1),
+     "filter N times on the board, swapping the input and output banks "
+     "between passes")
+    ("history", value<size_t>()->default_value(0),
+     "keep the last N frames in the spare SRAM banks for a temporal filter, "
+     "0 for none");
 
   return move(description);
 }
 
-Size GetImageSize(const string& size) noexcept {
-  if (size == "small")
-    { return {320, 240}; }
-  else if (size == "middle")
-    { return {640, 480}; }
-  else if (size == "large")
-    { return {800, 600}; }
-  else { return {640, 480}; }
-}
-
 int GetInterpolation(const string& i) noexcept {
   if (i == "nearest" ) { return cv::INTER_NEAREST; }
   else if (i == "linear") { return cv::INTER_LINEAR; }
   else { return cv::INTER_LINEAR; }
 }
 
+Size GetRoiSize(const variables_map& vm) {
+  if (vm.count("roi") == 0) { return Size(); }
+
+  int width = 0, height = 0;
+  const string roi = vm["roi"].as<string>();
+  if (std::sscanf(roi.c_str(), "%dx%d", &width, &height) != 2 ||
+      width <= 0 || height <= 0)
+    { throw std::invalid_argument("invalid region of interest: " + roi); }
+
+  return Size(width, height);
+}
+
+optional<cv::Point> GetRoiOrigin(const variables_map& vm) {
+  if (vm.count("roi-origin") == 0) { return nullopt; }
+
+  int x = 0, y = 0;
+  const string origin = vm["roi-origin"].as<string>();
+  if (std::sscanf(origin.c_str(), "%d,%d", &x, &y) != 2 || x < 0 || y < 0)
+    { throw std::invalid_argument("invalid origin of the region: " + origin); }
+
+  return cv::Point(x, y);
+}
+
+Dispatch GetDispatch(const string& s) {
+  if (s == "round-robin") { return Dispatch::ROUND_ROBIN; }
+  else if (s == "least-loaded") { return Dispatch::LEAST_LOADED; }
+  else { throw std::invalid_argument("unknown dispatch: " + s); }
+}
+
+ColorLayout GetColorLayout(const variables_map& vm) {
+  if (vm.count("colored") == 0) { return ColorLayout::MONOCHROME; }
+
+  return filter_core::GetColorLayout(vm["color-layout"].as<string>());
+}
+
+ComposeLayout GetComposeLayout(const variables_map& vm) {
+  if (vm.count("layout") == 0) {
+    return (vm.count("show-source") > 0)?
+      ComposeLayout::SIDE_BY_SIDE : ComposeLayout::FILTERED;
+  }
+
+  const ComposeLayout layout =
+    filter_core::GetComposeLayout(vm["layout"].as<string>());
+  if (vm.count("show-source") > 0 && layout != ComposeLayout::SIDE_BY_SIDE)
+    { throw std::invalid_argument("--show-source conflicts with --layout"); }
+  return layout;
+}
+
+EmulatorOptions GetEmulatorOptions(const variables_map& vm) {
+  return EmulatorOptions(
+      GetReferenceFilter(vm["emulator-filter"].as<string>()),
+      std::chrono::microseconds(vm["emulator-latency"].as<unsigned int>()),
+      vm["emulator-bandwidth"].as<double>() * 1000.0 * 1000.0);
+}
+
+RecordOptions GetRecordOptions(const variables_map& vm) {
+  const string format = vm["image-format"].as<string>();
+  const int compression = vm["compression"].as<int>();
+  const int maximum = (format == "png")? 9 :
+                      (format == "jpg" || format == "jpeg")? 100 : -1;
+  if (compression < -1 || compression > maximum) {
+    throw std::invalid_argument(
+        "invalid compression for " + format + ": " +
+        std::to_string(compression));
+  }
+
+  const string fourcc = vm["record-fourcc"].as<string>();
+  if (fourcc.size() != 4)
+    { throw std::invalid_argument("invalid four character code: " + fourcc); }
+
+  return RecordOptions(
+      format,
+      compression,
+      (vm.count("record") > 0)? vm["record"].as<string>() : string(),
+      fourcc,
+      vm["record-fps"].as<double>());
+}
+
 ImageOptions GetImageOptions(const variables_map& vm) {
   int is_colored = vm.count("colored") > 0;
+  // 複数の入力は間に行を挟んで縦に詰め、1枚の画像としてフィルタする
+  const Size size = GetImageSize(vm["image-size"].as<string>());
+  const size_t count = vm["input"].as<std::vector<string>>().size();
 
   return ImageOptions(
-      GetImageSize(vm["image-size"].as<string>()),
+      GetPackedSize(size, count),
       (is_colored)? CV_8UC3 : CV_8UC1,
       GetInterpolation(vm["interpolation"].as<string>()),
       (is_colored)? 3 : 1);
 }
 
+size_t GetEncoderCount(const variables_map& vm) {
+  const size_t count = vm["encoders"].as<size_t>();
+  if (count > 0) { return count; }
+
+  return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+size_t GetConvertThreadCount(const variables_map& vm) {
+  const size_t count = vm["convert-threads"].as<size_t>();
+  if (count > 0) { return count; }
+
+  return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+optional<ReferenceFilter> GetHybridFilter(const variables_map& vm) {
+  if (vm.count("hybrid") == 0) { return nullopt; }
+
+  return GetReferenceFilter(vm["hybrid"].as<string>());
+}
+
+size_t GetHybridThreadCount(const variables_map& vm) {
+  const size_t count = vm["hybrid-threads"].as<size_t>();
+  if (count > 0) { return count; }
+
+  return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+string JoinInputs(const std::vector<string>& inputs) {
+  string joined;
+  for (const auto& input : inputs)
+    { joined += ((joined.empty())? "" : ", ") + input; }
+  return joined;
+}
+
 variables_map GetVariablesMap(int argc, char** argv) {
   variables_map vm;
   store(parse_command_line(argc, argv, GetDescription()), vm);
@@ -119,7 +320,8 @@ optional<Options> GetOptions(int argc, char** argv) noexcept {
   try {
     auto vm = detail::GetVariablesMap(argc, argv);
 
-    if (vm.count("help") > 0 || vm.count("filename") == 0) {
+    if (vm.count("help") > 0 ||
+        (vm.count("filename") == 0 && vm.count("emulator") == 0)) {
       detail::ShowHelp();
       return nullopt;
     } else if(
@@ -127,14 +329,134 @@ optional<Options> GetOptions(int argc, char** argv) noexcept {
         vm["frequency"].as<double>() < MINIMUN_FREQUENCY) {
       std::cerr << "the frequency was out of ragne" << std::endl;
       return nullopt;
+    } else if (vm.count("ping-pong") > 0 &&
+               detail::GetColorLayout(vm) == ColorLayout::PLANAR) {
+      std::cerr << "ping-pong mode does not support planar colored images" <<
+        std::endl;
+      return nullopt;
+    } else if (vm.count("roi") > 0 && vm.count("ping-pong") > 0) {
+      std::cerr << "ping-pong mode does not support a region of interest" <<
+        std::endl;
+      return nullopt;
+    } else if (vm.count("roi-origin") > 0 && vm.count("roi") == 0) {
+      std::cerr << "--roi-origin needs --roi" << std::endl;
+      return nullopt;
+    } else if (vm.count("batch") > 0 && vm.count("pipeline") > 0 &&
+               vm["pipeline"].as<size_t>() == 0) {
+      std::cerr << "batch processing needs at least one frame in flight" <<
+        std::endl;
+      return nullopt;
+    } else if (vm["display-fps"].as<double>() < 0.0) {
+      std::cerr << "--display-fps must not be negative" << std::endl;
+      return nullopt;
+    } else if (vm["record-fps"].as<double>() <= 0.0) {
+      std::cerr << "--record-fps must be positive" << std::endl;
+      return nullopt;
+    } else if (vm.count("record") > 0 && vm.count("batch") > 0) {
+      std::cerr << "batch processing does not support recording" << std::endl;
+      return nullopt;
+    } else if (vm["boards"].as<size_t>() == 0) {
+      std::cerr << "--boards must be positive" << std::endl;
+      return nullopt;
+    } else if (vm["boards"].as<size_t>() > 1 && vm.count("batch") == 0 &&
+               (vm.count("pipeline") == 0 ||
+                vm["pipeline"].as<size_t>() == 0)) {
+      std::cerr << "several boards need --pipeline or --batch" << std::endl;
+      return nullopt;
+    } else if (vm["boards"].as<size_t>() > 1 && vm.count("ping-pong") > 0) {
+      std::cerr << "ping-pong mode does not support several boards" <<
+        std::endl;
+      return nullopt;
+    } else if (vm.count("hybrid") > 0 &&
+               (vm.count("roi") > 0 || vm.count("ping-pong") > 0)) {
+      std::cerr << "hybrid filtering does not support a region of interest " <<
+        "or ping-pong mode" << std::endl;
+      return nullopt;
+    } else if (vm.count("hybrid") > 0 &&
+               detail::GetColorLayout(vm) == ColorLayout::PLANAR) {
+      std::cerr << "hybrid filtering does not support planar colored images" <<
+        std::endl;
+      return nullopt;
+    } else if (vm.count("hybrid") > 0 &&
+               GetReferenceFilter(vm["hybrid"].as<string>()) ==
+                 ReferenceFilter::DIFFERENCE) {
+      std::cerr << "hybrid filtering does not support a temporal filter" <<
+        std::endl;
+      return nullopt;
+    } else if (vm.count("hybrid") > 0 && vm.count("emulator") > 0 &&
+               vm["hybrid"].as<string>() !=
+                 vm["emulator-filter"].as<string>()) {
+      std::cerr << "--hybrid differs from --emulator-filter" << std::endl;
+      return nullopt;
+    } else if (vm["passes"].as<size_t>() == 0) {
+      std::cerr << "--passes must be positive" << std::endl;
+      return nullopt;
+    } else if (vm["passes"].as<size_t>() > 1 &&
+               (vm.count("roi") > 0 || vm.count("ping-pong") > 0 ||
+                vm.count("hybrid") > 0)) {
+      std::cerr << "several passes do not support a region of interest, " <<
+        "ping-pong mode or hybrid filtering" << std::endl;
+      return nullopt;
+    } else if (vm["history"].as<size_t>() > MAX_HISTORY_LENGTH) {
+      std::cerr << "--history must not exceed " << MAX_HISTORY_LENGTH <<
+        std::endl;
+      return nullopt;
+    } else if (vm["history"].as<size_t>() > 0 &&
+               (vm.count("roi") > 0 || vm.count("ping-pong") > 0 ||
+                vm.count("hybrid") > 0 || vm["passes"].as<size_t>() > 1)) {
+      std::cerr << "frame history does not support a region of interest, " <<
+        "ping-pong mode, hybrid filtering or several passes" << std::endl;
+      return nullopt;
+    } else if (vm["history"].as<size_t>() > 0 &&
+               vm["boards"].as<size_t>() > 1) {
+      std::cerr << "frame history does not support several boards" <<
+        std::endl;
+      return nullopt;
+    } else if (vm["trace-capacity"].as<size_t>() == 0) {
+      std::cerr << "--trace-capacity must be positive" << std::endl;
+      return nullopt;
     } else {
-      return Options(vm["filename"].as<string>(),
+      return Options((vm.count("filename") > 0)?
+                       vm["filename"].as<string>() : string(),
                      vm["output-directory"].as<string>(),
                      vm["frequency"].as<double>(),
                      vm.count("colored") > 0,
                      detail::GetImageOptions(vm),
-                     vm.count("show-source") > 0,
-                     vm.count("debug") > 0);
+                     detail::GetComposeLayout(vm),
+                     vm.count("debug") > 0,
+                     (vm.count("pipeline") > 0)?
+                       vm["pipeline"].as<size_t>() :
+                     (vm.count("batch") > 0)? 3 : 0,
+                     vm.count("ping-pong") > 0,
+                     vm.count("emulator") > 0,
+                     detail::GetEmulatorOptions(vm),
+                     GetWaitStrategy(vm["wait"].as<string>()),
+                     std::chrono::milliseconds(
+                       vm["wait-timeout"].as<unsigned int>()),
+                     detail::GetColorLayout(vm),
+                     vm.count("refresh-ack") > 0,
+                     detail::GetRoiSize(vm),
+                     detail::GetRoiOrigin(vm),
+                     (vm.count("trace") > 0)?
+                       vm["trace"].as<string>() : string(),
+                     vm["trace-capacity"].as<size_t>(),
+                     vm["input"].as<std::vector<string>>(),
+                     (vm.count("prefetch") > 0)?
+                       vm["prefetch"].as<size_t>() : 0,
+                     vm.count("as-fast-as-possible") == 0,
+                     (vm.count("batch") > 0)?
+                       vm["batch"].as<string>() : string(),
+                     detail::GetEncoderCount(vm),
+                     vm["display-fps"].as<double>(),
+                     detail::GetConvertThreadCount(vm),
+                     vm.count("convert-pin") > 0,
+                     detail::GetRecordOptions(vm),
+                     vm["boards"].as<size_t>(),
+                     detail::GetDispatch(vm["dispatch"].as<string>()),
+                     detail::GetHybridFilter(vm),
+                     detail::GetHybridThreadCount(vm),
+                     vm["passes"].as<size_t>(),
+                     vm["history"].as<size_t>());
     }
   } catch (std::exception& e) {
     std::cerr << "invalid program options: " << e.what() << std::endl;
@@ -144,16 +466,82 @@ optional<Options> GetOptions(int argc, char** argv) noexcept {
     return nullopt;
   }
 }
+/*!
+ * \brief 画像サイズの名前か、幅x高さの形式の文字列から画像サイズを得る.
+ * \param size 'small'、'middle'、'large'またはWxH
+ * \return 画像サイズ
+ */
+Size GetImageSize(const string& size) {
+  int width = 0, height = 0;
+
+  if (size == "small") { return {320, 240}; }
+  else if (size == "middle") { return {640, 480}; }
+  else if (size == "large") { return {800, 600}; }
+  else if (std::sscanf(size.c_str(), "%dx%d", &width, &height) == 2 &&
+           width > 0 && height > 0) { return {width, height}; }
+  else { throw std::invalid_argument("unknown image size: " + size); }
+}
+/*!
+ * \brief カラー画像のSRAM上の配置を名前から得る.
+ * \param layout 'planar'または'interleaved'
+ * \return 配置
+ */
+ColorLayout GetColorLayout(const string& layout) {
+  if (layout == "planar") { return ColorLayout::PLANAR; }
+  else if (layout == "interleaved") { return ColorLayout::INTERLEAVED; }
+  else { throw std::invalid_argument("unknown color layout: " + layout); }
+}
+/*!
+ * \brief 完了の待ち方を名前から得る.
+ * \param s 'adaptive'、'spin'、'sleep'または'interrupt'
+ * \return 待ち方
+ */
+WaitStrategy GetWaitStrategy(const string& s) {
+  if (s == "adaptive") { return WaitStrategy::ADAPTIVE; }
+  else if (s == "spin") { return WaitStrategy::SPIN; }
+  else if (s == "sleep") { return WaitStrategy::SLEEP; }
+  else if (s == "interrupt") { return WaitStrategy::INTERRUPT; }
+  else { throw std::invalid_argument("unknown wait strategy: " + s); }
+}
 /*!
  * \brief プログラム引数を表示する
  * \param options プログラム引数の解析結果
  */
 void ShowOptions(const Options& options) {
+  namespace detail = filter_core::program_options_detail;
+
   std::cout <<
     "filename: " << options.filename << std::endl <<
     "frequency: " << options.frequency << std::endl <<
     "size: " << options.image_options.size.height << "x" <<
-      options.image_options.size.width <<
+      options.image_options.size.width << std::endl <<
+    "pipeline: " << options.pipeline_depth << std::endl <<
+    "passes: " << options.pass_count << std::endl <<
+    "history: " << options.history_length << " frames" << std::endl <<
+    "boards: " << options.board_count << " (" <<
+      ToString(options.dispatch) << ")" << std::endl <<
+    "input: " << detail::JoinInputs(options.inputs) << " (prefetch " <<
+      options.prefetch_depth << ", " <<
+      ((options.is_paced)? "paced" : "as fast as possible") << ")" <<
+      std::endl <<
+    "display: " << options.display_fps << " fps (0 for every frame), " <<
+      ToString(options.compose_layout) << std::endl <<
+    "convert: " << options.convert_thread_count << " threads" <<
+      ((options.is_convert_pinned)? " (pinned)" : "") << std::endl <<
+    "record: " << ((options.record_options.path.empty())?
+                     "none" : options.record_options.path) << " (" <<
+      options.record_options.image_format << ", compression " <<
+      options.record_options.compression << ")" << std::endl <<
+    "hybrid: " << ((options.hybrid_filter)?
+                     ToString(*options.hybrid_filter) : "none") << " (" <<
+      options.hybrid_thread_count << " threads)" << std::endl <<
+    "emulator: " << options.is_emulated << " (" <<
+      ToString(options.emulator_options.filter) << ", " <<
+      options.emulator_options.latency.count() << " us, " <<
+      options.emulator_options.bandwidth / 1000.0 / 1000.0 << " MB/s)" <<
+      std::endl <<
+    "wait: " << ToString(options.wait_strategy) << " (timeout " <<
+      options.wait_timeout.count() << " ms)" <<
     std::endl;
 }
 }  // namespace filter_core
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/recorder.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+using std::runtime_error;
+using std::string;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::system_clock;
+
+
+namespace filter_core {
+namespace recorder {
+/*!
+ * \var SNAPSHOT_DEPTH
+ * 書き込み待ちにできるスナップショットの数
+ */
+constexpr size_t SNAPSHOT_DEPTH = 2;
+/*!
+ * \var VIDEO_DEPTH
+ * 動画へ書き込み待ちにできる画像の数
+ */
+constexpr size_t VIDEO_DEPTH = 8;
+
+std::string GetSnapshotFilename(const std::string& directory,
+                                const std::string& format);
+}  // namespace recorder
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace recorder {
+/*!
+ * \brief 現在の時刻からスナップショットのファイル名を生成する.
+ *
+ * 続けて書き込んでも上書きしないよう、ミリ秒まで含める.
+ *
+ * \param directory 出力先ディレクトリ名
+ * \param format 拡張子
+ * \return ファイル名
+ */
+string GetSnapshotFilename(const string& directory, const string& format) {
+  // TODO: gcc 4.9ではstd::put_timeが使えないため、Cの関数を使用
+  const auto now = system_clock::now();
+  const std::time_t timestamp = system_clock::to_time_t(now);
+  const auto millisecond =
+    duration_cast<milliseconds>(now.time_since_epoch()).count() % 1000;
+
+  char time[64] = "";
+  std::strftime(time, sizeof(time), "%F-%T", std::localtime(&timestamp));
+  char fraction[8] = "";
+  std::snprintf(fraction, sizeof(fraction), ".%03d",
+                static_cast<int>(millisecond));
+
+  return directory + "/" + time + fraction + "." + format;
+}
+}  // namespace recorder
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief コンストラクタ.書き込むスレッドを起動し、録画先を開く.
+ *
+ * 録画先が動画ファイルでなければ、ディレクトリとして連番の画像を書き込む.
+ * 録画は直ちに始まる.
+ *
+ * \param options スナップショットと録画の設定
+ * \param directory スナップショットの出力先ディレクトリ名
+ * \param size 画像サイズ
+ * \param type 画像の型
+ * \param thread_count 連番の画像を符号化するスレッドの数
+ */
+Recorder::Recorder(const RecordOptions& options,
+                   const string& directory,
+                   cv::Size size, int type, size_t thread_count)
+  : directory_(directory),
+    image_format_(options.image_format),
+    snapshots_(),
+    recording_(),
+    recording_directory_(),
+    is_recording_(!options.path.empty()),
+    recorded_(0) {
+  namespace detail = recorder;
+
+  const auto parameters =
+    GetImageParameters(options.image_format, options.compression);
+  snapshots_.reset(
+      new ImageWriter(1, detail::SNAPSHOT_DEPTH, size, type, parameters));
+
+  if (options.path.empty()) {
+    return;
+  } else if (IsVideoFile(options.path)) {
+    const auto& f = options.fourcc;
+    auto video = std::make_shared<cv::VideoWriter>(
+        options.path, CV_FOURCC(f[0], f[1], f[2], f[3]), options.fps, size,
+        CV_MAT_CN(type) != 1);
+    if (!video->isOpened())
+      { throw runtime_error("failed to open " + options.path); }
+
+    // 動画は順に書き込む必要があるため、スレッドは1つ
+    recording_.reset(new ImageWriter(
+        1, detail::VIDEO_DEPTH, size, type,
+        [video](const cv::Mat& image, const string&) { video->write(image); }));
+  } else {
+    recording_directory_ = options.path;
+    recording_.reset(new ImageWriter(
+        thread_count, thread_count * 2, size, type, parameters));
+  }
+}
+/*!
+ * \brief スナップショットの書き込みを依頼する.ファイル名は現在の時刻.
+ *
+ * 前のスナップショットを書き込み中で領域が空いていなければ、書き込まない.
+ *
+ * \param image 画像
+ */
+void Recorder::snapshot(cv::Mat image) {
+  namespace detail = recorder;
+
+  if (!snapshots_->try_write(
+          image, detail::GetSnapshotFilename(directory_, image_format_)))
+    { std::cout << "\rsnapshot skipped: still writing the previous one"; }
+}
+/*!
+ * \brief 録画中であれば画像の書き込みを依頼する.ブロックしない.
+ *
+ * 全ての領域が書き込み待ちであれば画像を捨てる.連番は書き込んだ画像だけ
+ * に振る.
+ *
+ * \param image 画像
+ */
+void Recorder::record(cv::Mat image) {
+  if (!recording_ || !is_recording_.load()) { return; }
+
+  string filename;
+  if (!recording_directory_.empty()) {
+    char name[32] = "";
+    std::snprintf(name, sizeof(name), "/%08llu.",
+                  static_cast<unsigned long long>(recorded_));
+    filename = recording_directory_ + name + image_format_;
+  }
+  if (recording_->try_write(image, filename)) { ++recorded_; }
+}
+/*!
+ * \brief 録画を一時停止、または再開する.
+ * \return 録画中になった場合は真.録画先がない場合は常に偽
+ */
+bool Recorder::toggle() {
+  if (!recording_) { return false; }
+
+  return !is_recording_.exchange(!is_recording_.load());
+}
+/*!
+ * \brief 書き込み待ちの画像を全て書き込む.
+ *
+ * 書き込みで送出された例外は、ここで再送出される.
+ */
+void Recorder::close() {
+  snapshots_->close();
+  if (recording_) { recording_->close(); }
+}
+/*!
+ * \brief 録画した画像と捨てた画像の数を返す.
+ * \return 録画の結果.録画先がない場合は空
+ */
+string Recorder::report() const {
+  if (!recording_) { return string(); }
+
+  return "recording: " + std::to_string(recording_->written()) +
+    " written, " + std::to_string(recording_->skipped()) + " skipped";
+}
+/*!
+ * \brief cv::imwriteに渡す、形式毎の圧縮のパラメータを返す.
+ * \param format 拡張子
+ * \param compression PNGの圧縮レベルかJPEGの品質.負の場合は既定値
+ * \return パラメータ
+ */
+std::vector<int> GetImageParameters(const string& format, int compression) {
+  if (compression < 0) { return std::vector<int>(); }
+
+  if (format == "png") {
+    return std::vector<int>{CV_IMWRITE_PNG_COMPRESSION, compression};
+  } else if (format == "jpg" || format == "jpeg") {
+    return std::vector<int>{CV_IMWRITE_JPEG_QUALITY, compression};
+  } else {
+    return std::vector<int>();
+  }
+}
+/*!
+ * \brief 拡張子から動画ファイルであるかを返す.
+ * \param path パス
+ * \return '.avi'、'.mp4'、'.mkv'、'.mov'のいずれかで終わる場合は真
+ */
+bool IsVideoFile(const string& path) {
+  const auto dot = path.rfind('.');
+  if (dot == string::npos) { return false; }
+
+  string extension = path.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return extension == "avi" || extension == "mp4" ||
+    extension == "mkv" || extension == "mov";
+}
+}  // namespace filter_core
@@ -0,0 +1,499 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/reference_filter.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "filter_core/channels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_CORE_HAS_X86_KERNELS
+#endif
+
+
+using std::string;
+using cv::Mat;
+
+
+namespace filter_core {
+namespace reference_filter {
+
+/*!
+ * \var VECTOR_WIDTH
+ * SSSE3で一度に処理するバイト数.AVX2はこの2倍
+ */
+constexpr int VECTOR_WIDTH = 16;
+/*!
+ * \var DIVIDE_BY_9
+ * 16ビットの乗算の上位で9で割る定数.9x255+4以下の値では割り算と一致する
+ */
+constexpr int DIVIDE_BY_9 = 7282;
+
+/*!
+ * \class Neighborhood
+ * \brief 3x3の近傍.画像の外側は端の画素で補う
+ */
+class Neighborhood {
+ private:
+  const uint8_t* rows_[3];
+  int offsets_[3];
+ public:
+  Neighborhood(const cv::Mat& src, int x, int y) {
+    const int channel = src.channels();
+    rows_[0] = src.ptr<uint8_t>(std::max(y - 1, 0));
+    rows_[1] = src.ptr<uint8_t>(y);
+    rows_[2] = src.ptr<uint8_t>(std::min(y + 1, src.rows - 1));
+    offsets_[0] = std::max(x - 1, 0) * channel;
+    offsets_[1] = x * channel;
+    offsets_[2] = std::min(x + 1, src.cols - 1) * channel;
+  }
+ public:
+  /*!
+   * \brief 近傍の画素値
+   * \param i 行(0から2)
+   * \param j 列(0から2)
+   * \param c チャネル
+   */
+  int operator()(int i, int j, int c) const
+    { return rows_[i][offsets_[j] + c]; }
+};
+
+int Blur(const Neighborhood& n, int c);
+int Sobel(const Neighborhood& n, int c);
+void BlurRow(const uint8_t* const* rows, uint8_t* d, int length, int channel,
+             int16_t* buffer);
+void SobelRow(const uint8_t* const* rows, uint8_t* d, int length, int channel,
+              int16_t* buffer);
+#ifdef FILTER_CORE_HAS_X86_KERNELS
+int BlurRowSSSE3(const uint8_t* const* rows, uint8_t* d, int length,
+                 int channel);
+int BlurRowAVX2(const uint8_t* const* rows, uint8_t* d, int length,
+                int channel);
+int SobelRowSSSE3(const uint8_t* const* rows, uint8_t* d, int length,
+                  int channel);
+int SobelRowAVX2(const uint8_t* const* rows, uint8_t* d, int length,
+                 int channel);
+#endif
+template <typename F, typename R>
+void Apply3x3(const cv::Mat& src, cv::Mat& dst, cv::Range rows, F f, R row);
+}  // namespace reference_filter
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace reference_filter {
+
+int Blur(const Neighborhood& n, int c) {
+  int sum = 0;
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) { sum += n(i, j, c); }
+  }
+  return (sum + 4) / 9;
+}
+
+int Sobel(const Neighborhood& n, int c) {
+  const int gx =
+    (n(0, 2, c) + 2 * n(1, 2, c) + n(2, 2, c)) -
+    (n(0, 0, c) + 2 * n(1, 0, c) + n(2, 0, c));
+  const int gy =
+    (n(2, 0, c) + 2 * n(2, 1, c) + n(2, 2, c)) -
+    (n(0, 0, c) + 2 * n(0, 1, c) + n(0, 2, c));
+  return std::min(std::abs(gx) + std::abs(gy), 255);
+}
+
+/*!
+ * \brief 1行の左右の端を除く画素に3x3の平均をかける.
+ *
+ * AVX2かSSSE3が使える場合はそれを使い、残りの画素は先に縦の和を求めてか
+ * ら横の和を取る.
+ *
+ * \param rows 上、中央、下の行
+ * \param d 出力する行
+ * \param length 行のバイト数
+ * \param channel チャネル数
+ * \param buffer 作業領域.lengthの2倍の要素数
+ */
+void BlurRow(const uint8_t* const* rows, uint8_t* d, int length, int channel,
+             int16_t* buffer) {
+  int begin = channel;
+#ifdef FILTER_CORE_HAS_X86_KERNELS
+  if (channels::HasAVX2()) {
+    begin = BlurRowAVX2(rows, d, length, channel);
+  } else if (channels::HasSSSE3()) {
+    begin = BlurRowSSSE3(rows, d, length, channel);
+  }
+#endif
+
+  int16_t* v = buffer;
+  for (int i = begin - channel; i < length; ++i)
+    { v[i] = rows[0][i] + rows[1][i] + rows[2][i]; }
+  for (int i = begin; i < length - channel; ++i) {
+    d[i] = static_cast<uint8_t>(
+        (v[i - channel] + v[i] + v[i + channel] + 4) / 9);
+  }
+}
+/*!
+ * \brief 1行の左右の端を除く画素に3x3のSobelフィルタをかける.
+ *
+ * AVX2かSSSE3が使える場合はそれを使い、残りの画素は縦方向の平滑化と差分
+ * を先に求め、横方向に組み合わせる.
+ *
+ * \param rows 上、中央、下の行
+ * \param d 出力する行
+ * \param length 行のバイト数
+ * \param channel チャネル数
+ * \param buffer 作業領域.lengthの2倍の要素数
+ */
+void SobelRow(const uint8_t* const* rows, uint8_t* d, int length, int channel,
+              int16_t* buffer) {
+  int begin = channel;
+#ifdef FILTER_CORE_HAS_X86_KERNELS
+  if (channels::HasAVX2()) {
+    begin = SobelRowAVX2(rows, d, length, channel);
+  } else if (channels::HasSSSE3()) {
+    begin = SobelRowSSSE3(rows, d, length, channel);
+  }
+#endif
+
+  int16_t* smoothed = buffer;
+  int16_t* difference = buffer + length;
+  for (int i = begin - channel; i < length; ++i) {
+    smoothed[i] = rows[0][i] + 2 * rows[1][i] + rows[2][i];
+    difference[i] = rows[2][i] - rows[0][i];
+  }
+  for (int i = begin; i < length - channel; ++i) {
+    const int gx = smoothed[i + channel] - smoothed[i - channel];
+    const int gy =
+      difference[i - channel] + 2 * difference[i] + difference[i + channel];
+    d[i] = static_cast<uint8_t>(std::min(std::abs(gx) + std::abs(gy), 255));
+  }
+}
+#ifdef FILTER_CORE_HAS_X86_KERNELS
+/*!
+ * \brief 8バイトを読み込み、16ビットに広げる
+ */
+__attribute__((target("ssse3")))
+inline __m128i Widen8(const uint8_t* p) {
+  return _mm_unpacklo_epi8(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+      _mm_setzero_si128());
+}
+
+/*!
+ * \brief a + 2b + cを求める
+ */
+__attribute__((target("ssse3")))
+inline __m128i Weight121(__m128i a, __m128i b, __m128i c) {
+  return _mm_add_epi16(_mm_add_epi16(a, c), _mm_slli_epi16(b, 1));
+}
+
+/*!
+ * \brief i番目から8バイトの3x3の平均を16ビットで求める
+ */
+__attribute__((target("ssse3")))
+inline __m128i Blur8(const uint8_t* const* rows, int i, int channel) {
+  __m128i sum = _mm_set1_epi16(4);
+  for (int r = 0; r < 3; ++r) {
+    sum = _mm_add_epi16(sum, Widen8(rows[r] + i - channel));
+    sum = _mm_add_epi16(sum, Widen8(rows[r] + i));
+    sum = _mm_add_epi16(sum, Widen8(rows[r] + i + channel));
+  }
+  return _mm_mulhi_epu16(sum, _mm_set1_epi16(DIVIDE_BY_9));
+}
+
+/*!
+ * \brief i番目から8バイトのSobelフィルタの絶対値の和を16ビットで求める.
+ *        255を超える値はpackusで飽和させる
+ */
+__attribute__((target("ssse3")))
+inline __m128i Sobel8(const uint8_t* const* rows, int i, int channel) {
+  const int l = i - channel;
+  const int r = i + channel;
+  const __m128i gx = _mm_sub_epi16(
+      Weight121(Widen8(rows[0] + r), Widen8(rows[1] + r), Widen8(rows[2] + r)),
+      Weight121(Widen8(rows[0] + l), Widen8(rows[1] + l), Widen8(rows[2] + l)));
+  const __m128i gy = _mm_sub_epi16(
+      Weight121(Widen8(rows[2] + l), Widen8(rows[2] + i), Widen8(rows[2] + r)),
+      Weight121(Widen8(rows[0] + l), Widen8(rows[0] + i), Widen8(rows[0] + r)));
+  return _mm_add_epi16(_mm_abs_epi16(gx), _mm_abs_epi16(gy));
+}
+
+/*!
+ * \brief 16バイトずつ平均をかける.
+ * \return 処理しなかった最初の位置
+ */
+__attribute__((target("ssse3")))
+int BlurRowSSSE3(const uint8_t* const* rows, uint8_t* d, int length,
+                 int channel) {
+  int i = channel;
+  for (; i + VECTOR_WIDTH + channel <= length; i += VECTOR_WIDTH) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i),
+                     _mm_packus_epi16(
+                         Blur8(rows, i, channel),
+                         Blur8(rows, i + VECTOR_WIDTH / 2, channel)));
+  }
+  return i;
+}
+
+/*!
+ * \brief 16バイトずつSobelフィルタをかける.
+ * \return 処理しなかった最初の位置
+ */
+__attribute__((target("ssse3")))
+int SobelRowSSSE3(const uint8_t* const* rows, uint8_t* d, int length,
+                  int channel) {
+  int i = channel;
+  for (; i + VECTOR_WIDTH + channel <= length; i += VECTOR_WIDTH) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i),
+                     _mm_packus_epi16(
+                         Sobel8(rows, i, channel),
+                         Sobel8(rows, i + VECTOR_WIDTH / 2, channel)));
+  }
+  return i;
+}
+
+/*!
+ * \brief 16バイトを読み込み、16ビットに広げる
+ */
+__attribute__((target("avx2")))
+inline __m256i Widen16(const uint8_t* p) {
+  return _mm256_cvtepu8_epi16(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+/*!
+ * \brief Weight121のAVX2版
+ */
+__attribute__((target("avx2")))
+inline __m256i Weight121x2(__m256i a, __m256i b, __m256i c) {
+  return _mm256_add_epi16(_mm256_add_epi16(a, c), _mm256_slli_epi16(b, 1));
+}
+
+/*!
+ * \brief Blur8のAVX2版.i番目から16バイトを求める
+ */
+__attribute__((target("avx2")))
+inline __m256i Blur16(const uint8_t* const* rows, int i, int channel) {
+  __m256i sum = _mm256_set1_epi16(4);
+  for (int r = 0; r < 3; ++r) {
+    sum = _mm256_add_epi16(sum, Widen16(rows[r] + i - channel));
+    sum = _mm256_add_epi16(sum, Widen16(rows[r] + i));
+    sum = _mm256_add_epi16(sum, Widen16(rows[r] + i + channel));
+  }
+  return _mm256_mulhi_epu16(sum, _mm256_set1_epi16(DIVIDE_BY_9));
+}
+
+/*!
+ * \brief Sobel8のAVX2版.i番目から16バイトを求める
+ */
+__attribute__((target("avx2")))
+inline __m256i Sobel16(const uint8_t* const* rows, int i, int channel) {
+  const int l = i - channel;
+  const int r = i + channel;
+  const __m256i gx = _mm256_sub_epi16(
+      Weight121x2(Widen16(rows[0] + r), Widen16(rows[1] + r),
+                  Widen16(rows[2] + r)),
+      Weight121x2(Widen16(rows[0] + l), Widen16(rows[1] + l),
+                  Widen16(rows[2] + l)));
+  const __m256i gy = _mm256_sub_epi16(
+      Weight121x2(Widen16(rows[2] + l), Widen16(rows[2] + i),
+                  Widen16(rows[2] + r)),
+      Weight121x2(Widen16(rows[0] + l), Widen16(rows[0] + i),
+                  Widen16(rows[0] + r)));
+  return _mm256_add_epi16(_mm256_abs_epi16(gx), _mm256_abs_epi16(gy));
+}
+
+/*!
+ * \brief 16ビットの2組をバイトへ詰めて32バイトを書き込む.
+ *
+ * packusはレーン毎に詰めるため、64ビット単位で並べ替えて順序を戻す.
+ */
+__attribute__((target("avx2")))
+inline void Store32(uint8_t* d, __m256i first, __m256i second) {
+  _mm256_storeu_si256(
+      reinterpret_cast<__m256i*>(d),
+      _mm256_permute4x64_epi64(_mm256_packus_epi16(first, second), 0xD8));
+}
+
+/*!
+ * \brief 32バイトずつ平均をかける.
+ * \return 処理しなかった最初の位置
+ */
+__attribute__((target("avx2")))
+int BlurRowAVX2(const uint8_t* const* rows, uint8_t* d, int length,
+                int channel) {
+  int i = channel;
+  for (; i + VECTOR_WIDTH * 2 + channel <= length; i += VECTOR_WIDTH * 2) {
+    Store32(d + i, Blur16(rows, i, channel),
+            Blur16(rows, i + VECTOR_WIDTH, channel));
+  }
+  return i;
+}
+
+/*!
+ * \brief 32バイトずつSobelフィルタをかける.
+ * \return 処理しなかった最初の位置
+ */
+__attribute__((target("avx2")))
+int SobelRowAVX2(const uint8_t* const* rows, uint8_t* d, int length,
+                 int channel) {
+  int i = channel;
+  for (; i + VECTOR_WIDTH * 2 + channel <= length; i += VECTOR_WIDTH * 2) {
+    Store32(d + i, Sobel16(rows, i, channel),
+            Sobel16(rows, i + VECTOR_WIDTH, channel));
+  }
+  return i;
+}
+#endif
+
+/*!
+ * \brief 指定した行に3x3のフィルタをかける.
+ *
+ * 行の内側はrowでまとめて計算し、画像の外側を補う必要のある左右の端の画
+ * 素だけをfで1画素ずつ計算する.上下の隣の行は範囲の外側でも画像の内側で
+ * あれば参照する.
+ *
+ * \param src 入力画像
+ * \param dst 出力画像
+ * \param rows フィルタをかける行
+ * \param f 1画素を計算する関数
+ * \param row 1行の内側を計算する関数
+ */
+template <typename F, typename R>
+void Apply3x3(const Mat& src, Mat& dst, cv::Range rows, F f, R row) {
+  const int channel = src.channels();
+  const int length = src.cols * channel;
+  std::vector<int16_t> buffer(length * 2);
+  for (int y = rows.start; y < rows.end; ++y) {
+    const uint8_t* const neighbors[3] = {
+      src.ptr<uint8_t>(std::max(y - 1, 0)),
+      src.ptr<uint8_t>(y),
+      src.ptr<uint8_t>(std::min(y + 1, src.rows - 1))
+    };
+    uint8_t* d = dst.ptr<uint8_t>(y);
+    row(neighbors, d, length, channel, buffer.data());
+
+    for (int x : {0, src.cols - 1}) {
+      const Neighborhood n(src, x, y);
+      for (int c = 0; c < channel; ++c)
+        { d[x * channel + c] = static_cast<uint8_t>(f(n, c)); }
+    }
+  }
+}
+}  // namespace reference_filter
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief 参照用の空間フィルタをかける.
+ *
+ * 各チャネルに独立にかける.入力画像と出力画像は同じサイズ、同じ型で、
+ * 互いに重ならないこと.
+ *
+ * \param filter フィルタ
+ * \param src 入力画像(CV_8UC1またはCV_8UC3)
+ * \param dst 出力画像
+ */
+void ApplyReferenceFilter(ReferenceFilter filter, Mat src, Mat dst) {
+  ApplyReferenceFilter(filter, src, dst, cv::Range(0, src.rows));
+}
+/*!
+ * \brief 画像の一部の行だけに参照用の空間フィルタをかける.
+ *
+ * 範囲の上下の隣の行も入力画像から参照するため、結果は画像全体にかけた
+ * 場合の同じ行と一致する.行の範囲を分ければ、複数のスレッドから同じ画像
+ * に対して呼び出せる.
+ *
+ * \param filter フィルタ
+ * \param src 入力画像(CV_8UC1またはCV_8UC3)
+ * \param dst 出力画像
+ * \param rows フィルタをかける行
+ */
+void ApplyReferenceFilter(ReferenceFilter filter, Mat src, Mat dst,
+                          cv::Range rows) {
+  namespace detail = reference_filter;
+
+  const size_t row_size = src.cols * src.elemSize();
+  switch (filter) {
+    case ReferenceFilter::COPY:
+      src.rowRange(rows.start, rows.end).copyTo(
+          dst.rowRange(rows.start, rows.end));
+      break;
+    case ReferenceFilter::INVERT:
+      for (int y = rows.start; y < rows.end; ++y) {
+        const uint8_t* s = src.ptr<uint8_t>(y);
+        uint8_t* d = dst.ptr<uint8_t>(y);
+        for (size_t x = 0; x < row_size; ++x) { d[x] = 255 - s[x]; }
+      }
+      break;
+    case ReferenceFilter::BLUR:
+      detail::Apply3x3(src, dst, rows, &detail::Blur, &detail::BlurRow);
+      break;
+    case ReferenceFilter::SOBEL:
+      detail::Apply3x3(src, dst, rows, &detail::Sobel, &detail::SobelRow);
+      break;
+    case ReferenceFilter::DIFFERENCE:
+      // 前回のフレームがない
+      dst.rowRange(rows.start, rows.end).setTo(cv::Scalar::all(0));
+      break;
+  }
+}
+/*!
+ * \brief 今回と前回のフレームから参照用のフィルタの結果を求める.
+ *
+ * DIFFERENCEは2つのフレームの差の絶対値を求める.前回のフレームが空の
+ * 場合と、その他のフィルタでは、今回のフレームだけにかける.
+ *
+ * \param filter フィルタ
+ * \param current 今回のフレーム(CV_8UC1またはCV_8UC3)
+ * \param previous 前回のフレーム.ない場合は空
+ * \param dst 出力画像
+ */
+void ApplyTemporalReferenceFilter(ReferenceFilter filter,
+                                  Mat current, Mat previous, Mat dst) {
+  if (filter == ReferenceFilter::DIFFERENCE && !previous.empty()) {
+    cv::absdiff(current, previous, dst);
+  } else {
+    ApplyReferenceFilter(filter, current, dst);
+  }
+}
+/*!
+ * \brief 名前から参照用のフィルタを返す.
+ * \param name 'copy'、'invert'、'blur'、'sobel'、'difference'のいずれか
+ * \return フィルタ
+ */
+ReferenceFilter GetReferenceFilter(const string& name) {
+  if (name == "copy") { return ReferenceFilter::COPY; }
+  else if (name == "invert") { return ReferenceFilter::INVERT; }
+  else if (name == "blur") { return ReferenceFilter::BLUR; }
+  else if (name == "sobel") { return ReferenceFilter::SOBEL; }
+  else if (name == "difference") { return ReferenceFilter::DIFFERENCE; }
+  else { throw std::invalid_argument("unknown reference filter: " + name); }
+}
+/*!
+ * \brief 参照用のフィルタの名前を返す.
+ * \param filter フィルタ
+ * \return 名前
+ */
+string ToString(ReferenceFilter filter) {
+  switch (filter) {
+    case ReferenceFilter::COPY: return "copy";
+    case ReferenceFilter::INVERT: return "invert";
+    case ReferenceFilter::BLUR: return "blur";
+    case ReferenceFilter::SOBEL: return "sobel";
+    case ReferenceFilter::DIFFERENCE: return "difference";
+  }
+  return "";
+}
+}  // namespace filter_core
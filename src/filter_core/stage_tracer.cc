@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/stage_tracer.h"
+
+#include "filter_core/timeline.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+using std::vector;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+
+
+namespace filter_core {
+namespace stage_tracer {
+
+nanoseconds Percentile(const std::vector<uint64_t>& sorted, double p);
+void Print(std::ostream& os, nanoseconds d);
+}  // namespace stage_tracer
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace stage_tracer {
+/*!
+ * \brief 整列済みの記録から百分位数を求める(最近傍順位法).
+ * \param sorted 整列済みの記録
+ * \param p 百分率
+ * \return 百分位数
+ */
+nanoseconds Percentile(const vector<uint64_t>& sorted, double p) {
+  if (sorted.empty()) { return nanoseconds::zero(); }
+
+  const size_t rank = static_cast<size_t>(p / 100.0 * sorted.size() + 0.5);
+  return nanoseconds(sorted[std::min(std::max<size_t>(rank, 1),
+                                     sorted.size()) - 1]);
+}
+/*!
+ * \brief 時間をマイクロ秒単位で出力する.
+ */
+void Print(std::ostream& os, nanoseconds d) {
+  os << std::setw(10) << std::fixed << std::setprecision(1) <<
+    d.count() / 1000.0;
+}
+}  // namespace stage_tracer
+}  // namespace filter_core
+
+
+namespace filter_core {
+
+constexpr size_t StageRing::CAPACITY;
+
+/*!
+ * \brief コンストラクタ.
+ */
+StageRing::StageRing() : samples_(), head_(0) {
+  for (auto& sample : samples_) { sample.store(0, std::memory_order_relaxed); }
+}
+/*!
+ * \brief 記録を段階毎に取り出す.
+ *
+ * 取り出している間に書き込まれた記録は、含まれないか、古い記録の代わりに
+ * 含まれる.
+ *
+ * \param samples 段階毎の所要時間(ナノ秒)の追加先
+ */
+void StageRing::collect(
+    std::array<std::vector<uint64_t>, STAGE_COUNT>& samples) const {
+  const uint64_t head = head_.load(std::memory_order_acquire);
+  const uint64_t count = std::min<uint64_t>(head, CAPACITY);
+
+  for (uint64_t i = head - count; i < head; ++i) {
+    const uint64_t sample =
+      samples_[i % CAPACITY].load(std::memory_order_relaxed);
+    const size_t stage = static_cast<size_t>(sample >> STAGE_SHIFT);
+    if (stage < STAGE_COUNT)
+      { samples[stage].push_back(sample & DURATION_MASK); }
+  }
+}
+
+/*!
+ * \brief プロセスで共有するトレーサを返す.
+ * \return トレーサ
+ */
+StageTracer& StageTracer::instance() {
+  static StageTracer tracer;
+  return tracer;
+}
+/*!
+ * \brief 所要時間を記録する.
+ * \param stage 段階
+ * \param start 開始時刻
+ * \param end 終了時刻
+ */
+void StageTracer::record(Stage stage,
+                         clock_type::time_point start,
+                         clock_type::time_point end) noexcept {
+  const auto ns = duration_cast<nanoseconds>(end - start).count();
+  ring().push(stage, (ns > 0)? static_cast<uint64_t>(ns) : 0);
+
+  Timeline::instance().add(GetName(stage), start, end);
+}
+/*!
+ * \brief 段階毎の所要時間の分布を求める.
+ * \return 段階毎の分布
+ */
+StageReport StageTracer::report() const {
+  std::array<vector<uint64_t>, STAGE_COUNT> samples;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& ring : rings_) { ring->collect(samples); }
+  }
+
+  StageReport report;
+  for (size_t i = 0; i < STAGE_COUNT; ++i)
+    { report[i] = Summarize(samples[i]); }
+
+  return report;
+}
+/*!
+ * \brief 全てのスレッドの記録を捨てる.
+ *
+ * 条件毎に分布を求める場合に、条件の間で呼び出す.記録している最中のス
+ * レッドがあってはならない.
+ */
+void StageTracer::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& ring : rings_) { ring->clear(); }
+}
+/*!
+ * \brief 呼び出したスレッドのリングバッファを返す.初回に確保する.
+ * \return リングバッファ
+ */
+StageRing& StageTracer::ring() {
+  static thread_local StageRing* ring = nullptr;
+
+  if (ring == nullptr) {
+    std::unique_ptr<StageRing> r(new StageRing());
+    std::lock_guard<std::mutex> lock(mutex_);
+    rings_.push_back(std::move(r));
+    ring = rings_.back().get();
+  }
+  return *ring;
+}
+
+/*!
+ * \brief 前回からの出力間隔を記録する.
+ * \return 出力間隔
+ */
+FrameMeter::clock_type::duration FrameMeter::tick() {
+  const auto now = clock_type::now();
+  const auto interval = now - previous_;
+
+  StageTracer::instance().record(Stage::FRAME, previous_, now);
+  previous_ = now;
+  return interval;
+}
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief 所要時間の分布を求める.
+ * \param samples 所要時間(ナノ秒).整列される
+ * \return 分布
+ */
+StageSummary Summarize(vector<uint64_t>& samples) {
+  namespace detail = stage_tracer;
+
+  StageSummary summary;
+  if (samples.empty()) { return summary; }
+
+  std::sort(samples.begin(), samples.end());
+  summary.count = samples.size();
+  summary.p50 = detail::Percentile(samples, 50.0);
+  summary.p95 = detail::Percentile(samples, 95.0);
+  summary.p99 = detail::Percentile(samples, 99.0);
+  summary.max = nanoseconds(samples.back());
+
+  return summary;
+}
+/*!
+ * \brief 出力間隔からフレームレートを求めて表示する.
+ * \param interval 出力間隔
+ */
+void ShowFramerate(std::chrono::steady_clock::duration interval) {
+  const auto us = duration_cast<std::chrono::microseconds>(interval).count();
+  if (us <= 0) { return; }
+
+  std::cout << "\r" << (1000 * 1000 / us) << "fps     " << std::flush;
+}
+/*!
+ * \brief 段階毎の所要時間の分布を表形式で出力する.
+ * \param os 出力ストリーム
+ * \param report 段階毎の分布
+ * \return 出力ストリーム
+ */
+std::ostream& operator<<(std::ostream& os, const StageReport& report) {
+  namespace detail = stage_tracer;
+
+  const auto flags = os.flags();
+  const auto precision = os.precision();
+
+  os << std::left << std::setw(12) << "stage" << std::right <<
+    std::setw(8) << "count" <<
+    std::setw(10) << "p50(us)" << std::setw(10) << "p95(us)" <<
+    std::setw(10) << "p99(us)" << std::setw(10) << "max(us)";
+  for (size_t i = 0; i < STAGE_COUNT; ++i) {
+    const auto& s = report[i];
+    if (s.count == 0) { continue; }
+
+    os << std::endl << std::left << std::setw(12) <<
+      ToString(static_cast<Stage>(i)) << std::right << std::setw(8) << s.count;
+    detail::Print(os, s.p50);
+    detail::Print(os, s.p95);
+    detail::Print(os, s.p99);
+    detail::Print(os, s.max);
+  }
+
+  os.flags(flags);
+  os.precision(precision);
+  return os;
+}
+/*!
+ * \brief 段階の名前を返す.
+ * \param stage 段階
+ * \return 名前.文字列リテラルを指す
+ */
+const char* GetName(Stage stage) noexcept {
+  switch (stage) {
+    case Stage::CAPTURE: return "capture";
+    case Stage::CONVERT: return "convert";
+    case Stage::DMA_WRITE: return "dma write";
+    case Stage::REFRESH: return "refresh";
+    case Stage::FINISH_WAIT: return "finish wait";
+    case Stage::DMA_READ: return "dma read";
+    case Stage::CPU_FILTER: return "cpu filter";
+    case Stage::COMPOSE: return "compose";
+    case Stage::DISPLAY: return "display";
+    case Stage::FRAME: return "frame";
+  }
+  return "";
+}
+/*!
+ * \brief 段階の名前を返す.
+ * \param stage 段階
+ * \return 名前
+ */
+std::string ToString(Stage stage) { return GetName(stage); }
+}  // namespace filter_core
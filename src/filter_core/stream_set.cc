@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/stream_set.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+
+using std::unique_ptr;
+using cv::Mat;
+
+
+namespace filter_core {
+namespace stream_set {
+
+void FillGuardRows(cv::Mat packed, size_t count);
+}  // namespace stream_set
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace stream_set {
+/*!
+ * \brief 帯の間の行を、隣接する帯の端の行で埋める.
+ * \param packed 詰めた画像
+ * \param count 入力の数
+ */
+void FillGuardRows(Mat packed, size_t count) {
+  const int height = GetStreamSize(packed.size(), count).height;
+  const int pitch = height + 2 * STREAM_GUARD_ROWS;
+
+  for (int i = 0; i + 1 < static_cast<int>(count); ++i) {
+    const int gap = i * pitch + height;
+    for (int n = 0; n < STREAM_GUARD_ROWS; ++n) {
+      packed.row(gap - 1).copyTo(packed.row(gap + n));
+      packed.row((i + 1) * pitch).copyTo(
+          packed.row(gap + STREAM_GUARD_ROWS + n));
+    }
+  }
+}
+}  // namespace stream_set
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief コンストラクタ.入力が複数の場合、取り込むスレッドを起動する.
+ *
+ * 呼び出し元も1つの入力を取り込むため、起動するスレッドは入力の数-1.
+ *
+ * \param cameras 入力.少なくとも1つ
+ */
+StreamSet::StreamSet(std::vector<unique_ptr<Camera>>&& cameras)
+  : cameras_(std::move(cameras)),
+    pool_(),
+    is_ready_(cameras_.size(), 0) {
+  if (cameras_.empty()) { throw std::invalid_argument("no input streams"); }
+
+  if (cameras_.size() > 1)
+    { pool_.reset(new WorkerPool(cameras_.size() - 1, false)); }
+}
+/*!
+ * \brief 全ての入力から次の画像を取得できる場合、真を返す.
+ *
+ * 先読みしない入力はここで読み込むため、各入力を並行に待つ.
+ *
+ * \return 取得できる場合は真
+ */
+bool StreamSet::isReady() {
+  if (!pool_) { return cameras_.front()->isReady(); }
+
+  pool_->run(cameras_.size(), [this](size_t i, size_t) {
+    is_ready_[i] = cameras_[i]->isReady();
+  });
+  return std::all_of(is_ready_.begin(), is_ready_.end(),
+                     [](char ready) { return ready != 0; });
+}
+/*!
+ * \brief 全ての入力の画像を並行に変換し、詰めた画像へ書き込む.
+ *
+ * 書き込んだ後、帯の間の行を帯の端の行で埋める.
+ *
+ * \param packed 出力先.大きさはGetPackedSizeの結果
+ */
+void StreamSet::get(Mat packed) {
+  if (!pool_) {
+    cameras_.front()->get(packed);
+    return;
+  }
+
+  const auto bands = SplitStreams(packed, cameras_.size());
+  pool_->run(cameras_.size(),
+             [this, &bands](size_t i, size_t) { cameras_[i]->get(bands[i]); });
+  stream_set::FillGuardRows(packed, cameras_.size());
+}
+/*!
+ * \brief 入力1つ分の大きさから、帯の間の行を含む詰めた画像の大きさを求め
+ *        る.
+ * \param stream 入力1つ分の大きさ
+ * \param count 入力の数
+ * \return 詰めた画像の大きさ
+ */
+cv::Size GetPackedSize(cv::Size stream, size_t count) {
+  const int n = static_cast<int>(count);
+  return cv::Size(stream.width,
+                  stream.height * n + (n - 1) * 2 * STREAM_GUARD_ROWS);
+}
+/*!
+ * \brief 詰めた画像の大きさから、入力1つ分の大きさを求める.
+ * \param packed 詰めた画像の大きさ
+ * \param count 入力の数
+ * \return 入力1つ分の大きさ
+ */
+cv::Size GetStreamSize(cv::Size packed, size_t count) {
+  const int n = static_cast<int>(count);
+  return cv::Size(packed.width,
+                  (packed.height - (n - 1) * 2 * STREAM_GUARD_ROWS) / n);
+}
+/*!
+ * \brief 詰めた画像を入力毎の行の帯に分ける.帯の間の行は含まない.帯は元
+ *        の画像を参照する.
+ * \param packed 詰めた画像
+ * \param count 入力の数
+ * \return 入力毎の画像
+ */
+std::vector<Mat> SplitStreams(Mat packed, size_t count) {
+  const int height = GetStreamSize(packed.size(), count).height;
+  const int pitch = height + 2 * STREAM_GUARD_ROWS;
+
+  std::vector<Mat> bands;
+  for (size_t i = 0; i < count; ++i) {
+    const int top = static_cast<int>(i) * pitch;
+    bands.push_back(packed.rowRange(top, top + height));
+  }
+  return bands;
+}
+}  // namespace filter_core
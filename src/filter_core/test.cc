@@ -6,17 +6,18 @@
  */
 #include "filter_core/camera.h"
 #include "filter_core/fpga_communicator.h"
-#include "filter_core/framerate_checker.h"
+#include "filter_core/stage_tracer.h"
 
 #include <opencv2/opencv.hpp>
 
 #include <algorithm>
+#include <chrono>
+#include <iostream>
 #include <iterator>
 #include <thread>
 
 
 using std::chrono::microseconds;
-using std::chrono::system_clock;
 using std::this_thread::sleep_for;
 using filter_core::ENABLE_REG;
 using filter_core::IMAGE_SIZE_REG;
@@ -81,11 +82,11 @@ void test2(FPGACommunicator& communicator) {
 }
 
 void testCam(cv::Size image_size, int interpolation) {
-  auto start = system_clock::now();
+  FrameMeter frame_meter;
  
     for (auto src :
          Camera(MakeConveter(false, image_size, interpolation))) {
-    FramerateChecker framerate_checker(start);
+    ShowFramerate(frame_meter.tick());
 
     cv::imshow("filter", src);
     if(cv::waitKey(10) >= 0) { break; }
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/timeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+
+using std::runtime_error;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+
+namespace filter_core {
+namespace timeline {
+
+void WriteString(std::ostream& os, const char* s);
+void WriteMicroseconds(std::ostream& os, std::chrono::nanoseconds d);
+}  // namespace timeline
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace timeline {
+/*!
+ * \brief JSONの文字列として出力する.
+ */
+void WriteString(std::ostream& os, const char* s) {
+  os << '"';
+  for (; *s != '\0'; ++s) {
+    if (*s == '"' || *s == '\\') { os << '\\'; }
+    os << *s;
+  }
+  os << '"';
+}
+/*!
+ * \brief 時間をマイクロ秒単位で出力する.Trace Event形式の時刻の単位
+ */
+void WriteMicroseconds(std::ostream& os, nanoseconds d) {
+  os << std::fixed << std::setprecision(3) << d.count() / 1000.0;
+}
+}  // namespace timeline
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief スレッド名と記録した区間を出力する.
+ * \param os 出力ストリーム
+ * \param origin 時刻の原点
+ * \param is_first まだ何も出力していない場合は真.出力すると偽になる
+ */
+void TimelineBuffer::write(std::ostream& os,
+                           steady_clock::time_point origin,
+                           bool& is_first) const {
+  namespace detail = timeline;
+
+  auto separate = [&] {
+    if (!is_first) { os << ",\n"; }
+    is_first = false;
+  };
+
+  if (const char* name = thread_name_.load(std::memory_order_relaxed)) {
+    separate();
+    os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" <<
+      thread_id_ << ",\"args\":{\"name\":";
+    detail::WriteString(os, name);
+    os << "}}";
+  }
+
+  const uint64_t head = head_.load(std::memory_order_acquire);
+  const uint64_t count = std::min<uint64_t>(head, events_.size());
+  for (uint64_t i = head - count; i < head; ++i) {
+    const TimelineEvent& e = events_[i % events_.size()];
+
+    separate();
+    os << "{\"name\":";
+    detail::WriteString(os, e.name);
+    os << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread_id_ << ",\"ts\":";
+    detail::WriteMicroseconds(os, duration_cast<nanoseconds>(e.start - origin));
+    os << ",\"dur\":";
+    detail::WriteMicroseconds(os, duration_cast<nanoseconds>(e.duration));
+    if (e.arg_name != nullptr) {
+      os << ",\"args\":{";
+      detail::WriteString(os, e.arg_name);
+      os << ":" << e.arg << "}";
+    }
+    os << "}";
+  }
+}
+
+/*!
+ * \brief プロセスで共有するタイムラインを返す.
+ * \return タイムライン
+ */
+Timeline& Timeline::instance() {
+  static Timeline timeline;
+  return timeline;
+}
+/*!
+ * \brief 記録を始める.
+ * \param capacity スレッド毎に保持する区間の数.超えると古い区間から捨てる
+ */
+void Timeline::enable(size_t capacity) {
+  if (capacity == 0)
+    { throw std::invalid_argument("the timeline needs at least one event"); }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  capacity_ = capacity;
+  origin_ = clock_type::now();
+  is_enabled_.store(true);
+}
+/*!
+ * \brief 記録した区間をTrace Event形式のJSONで出力する.
+ * \param os 出力ストリーム
+ * \return 上書きされて失われた区間の数
+ */
+uint64_t Timeline::write(std::ostream& os) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  const auto flags = os.flags();
+  const auto precision = os.precision();
+
+  uint64_t overwritten = 0;
+  bool is_first = true;
+  os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  for (const auto& buffer : buffers_) {
+    buffer->write(os, origin_, is_first);
+    overwritten += buffer->overwritten();
+  }
+  os << "\n]}\n";
+
+  os.flags(flags);
+  os.precision(precision);
+  return overwritten;
+}
+/*!
+ * \brief 呼び出したスレッドのリングバッファを返す.初回に確保する.
+ * \return リングバッファ
+ */
+TimelineBuffer& Timeline::buffer() {
+  static thread_local TimelineBuffer* buffer = nullptr;
+
+  if (buffer == nullptr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.emplace_back(
+        new TimelineBuffer(capacity_, static_cast<uint32_t>(buffers_.size())));
+    buffer = buffers_.back().get();
+  }
+  return *buffer;
+}
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief タイムラインをファイルへ出力する.
+ * \param filename ファイル名
+ */
+void WriteTimeline(const std::string& filename) {
+  std::ofstream file(filename);
+  if (!file) { throw runtime_error("failed to open " + filename); }
+
+  const uint64_t overwritten = Timeline::instance().write(file);
+  if (!file) { throw runtime_error("failed to write " + filename); }
+
+  if (overwritten > 0) {
+    std::cerr << overwritten << " early trace events were dropped" <<
+      std::endl;
+  }
+}
+}  // namespace filter_core
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/worker_pool.h"
+
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "filter_core/timeline.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace filter_core {
+namespace worker_pool {
+
+std::vector<int> GetAllowedCpus();
+void Pin(std::thread& thread, int cpu);
+}  // namespace worker_pool
+}  // namespace filter_core
+
+
+namespace filter_core {
+namespace worker_pool {
+
+/*!
+ * \brief このプロセスが実行を許されたCPUの番号を列挙する.
+ *
+ * numactlやtasksetで制限した場合は、その範囲のCPUだけを返す.
+ */
+std::vector<int> GetAllowedCpus() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      { if (CPU_ISSET(cpu, &set)) { cpus.push_back(cpu); } }
+  }
+#endif
+  return cpus;
+}
+
+void Pin(std::thread& thread, int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+  static_cast<void>(thread);
+  static_cast<void>(cpu);
+#endif
+}
+}  // namespace worker_pool
+}  // namespace filter_core
+
+
+namespace filter_core {
+/*!
+ * \brief コンストラクタ.スレッドを起動する.
+ *
+ * 固定する場合、各スレッドは許されたCPUへ1つずつ順に割り当てられる.呼び
+ * 出し元のスレッドは固定しない.
+ *
+ * \param thread_count 起動するスレッドの数.0の場合は呼び出し元だけで実行する
+ * \param is_pinned スレッドをCPUへ固定する場合は真
+ */
+WorkerPool::WorkerPool(size_t thread_count, bool is_pinned)
+  : threads_(),
+    mutex_(),
+    started_(),
+    finished_(),
+    generation_(0),
+    is_closed_(false),
+    running_(0),
+    task_(),
+    task_count_(0),
+    next_(0),
+    error_() {
+  namespace detail = worker_pool;
+
+  const auto cpus = (is_pinned)? detail::GetAllowedCpus() : std::vector<int>();
+  for (size_t i = 0; i < thread_count; ++i) {
+    threads_.emplace_back(&WorkerPool::work, this, i + 1);
+    if (!cpus.empty()) { detail::Pin(threads_.back(), cpus[i % cpus.size()]); }
+  }
+}
+/*!
+ * \brief デストラクタ.スレッドを停止させる.
+ */
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_closed_ = true;
+  }
+  started_.notify_all();
+  for (auto& t : threads_) { if (t.joinable()) { t.join(); } }
+}
+/*!
+ * \brief 全てのタスクを実行し、終わるまで待つ.
+ *
+ * タスクで送出された例外は、全てのタスクが終わった後に再送出される.
+ *
+ * \param task_count タスクの数
+ * \param task タスク
+ */
+void WorkerPool::run(size_t task_count, task_t task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = std::move(task);
+    task_count_ = task_count;
+    next_.store(0);
+    error_ = nullptr;
+    running_ = threads_.size();
+    ++generation_;
+  }
+  started_.notify_all();
+
+  drain(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  finished_.wait(lock, [this] { return running_ == 0; });
+  task_ = nullptr;
+  if (error_) { std::rethrow_exception(error_); }
+}
+/*!
+ * \brief 待機するスレッドの処理.
+ * \param worker スレッドの番号
+ */
+void WorkerPool::work(size_t worker) {
+  Timeline::instance().name_thread("worker");
+
+  uint64_t generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      started_.wait(lock, [&] {
+        return is_closed_ || generation_ != generation;
+      });
+      if (is_closed_) { return; }
+      generation = generation_;
+    }
+
+    drain(worker);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--running_ == 0) { finished_.notify_one(); }
+  }
+}
+/*!
+ * \brief 残ったタスクがなくなるまで取って実行する.
+ * \param worker スレッドの番号
+ */
+void WorkerPool::drain(size_t worker) {
+  for (size_t i = next_.fetch_add(1); i < task_count_; i = next_.fetch_add(1)) {
+    try {
+      task_(i, worker);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) { error_ = std::current_exception(); }
+    }
+  }
+}
+}  // namespace filter_core
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/emulated_device.h"
+#include "filter_core/fpga_communicator.h"
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <future>
+#include <iostream>
+#include <memory>
+
+
+using cv::Mat;
+using cv::Size;
+using filter_core::EmulatedDevice;
+using filter_core::FPGACommunicator;
+
+
+namespace async_transfer_test {
+
+bool TestRoundTrip(uint64_t offset, uint32_t bank);
+bool TestError();
+}  // namespace async_transfer_test
+
+
+namespace async_transfer_test {
+/*!
+ * \brief write_asyncで送信した画像を、続けて要求したread_asyncで受信し、
+ *        一致するかを確かめる.
+ *
+ * 2つの要求は完了を待たずに続けて出すため、転送スレッドが要求を順に処理
+ * しなければ一致しない.
+ *
+ * \param offset バンク先頭からのオフセット
+ * \param bank バンク
+ * \return 一致すれば真
+ */
+bool TestRoundTrip(uint64_t offset, uint32_t bank) {
+  const Size size(640, 480);
+  const size_t length = size.area();
+
+  FPGACommunicator com(std::make_shared<EmulatedDevice>(), length);
+  Mat src = com.write_buffer(size, CV_8UC1);
+  Mat dst = com.read_buffer(size, CV_8UC1);
+  cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+  dst.setTo(cv::Scalar::all(0));
+
+  auto written = com.write_async(src.data, offset, length, bank);
+  auto read = com.read_async(dst.data, offset, length, bank);
+  read.get();
+  written.get();
+
+  const double difference = cv::norm(src, dst, cv::NORM_INF);
+  const bool is_ok = difference == 0.0;
+  std::cout << ((is_ok)? "ok" : "NG") << ": " <<
+    "bank " << bank << ", offset " << offset << ", " << length <<
+    " bytes: max difference " << difference << std::endl;
+  return is_ok;
+}
+/*!
+ * \brief 存在しないバンクへの転送で、例外がfutureのgetで再送出され、その
+ *        後の転送が影響を受けないかを確かめる.
+ * \return 再送出され、後の転送が成功すれば真
+ */
+bool TestError() {
+  const size_t length = 4096;
+
+  FPGACommunicator com(std::make_shared<EmulatedDevice>(), length);
+  Mat dst = com.read_buffer(Size(length, 1), CV_8UC1);
+
+  bool is_thrown = false;
+  auto future = com.read_async(dst.data, 0, length, 15);
+  try {
+    future.get();
+  } catch (std::exception&) {
+    is_thrown = true;
+  }
+
+  bool is_recovered = true;
+  try {
+    com.read_async(dst.data, 0, length, 0).get();
+  } catch (std::exception&) {
+    is_recovered = false;
+  }
+
+  const bool is_ok = is_thrown && is_recovered;
+  std::cout << ((is_ok)? "ok" : "NG") << ": " <<
+    "missing bank: " << ((is_thrown)? "error rethrown" : "error lost") <<
+    ((is_recovered)? ", next transfer done" : ", next transfer failed") <<
+    std::endl;
+  return is_ok;
+}
+}  // namespace async_transfer_test
+
+
+/*!
+ * \brief エミュレータとの間で非同期転送を試し、失敗があれば失敗を返す.
+ * \return 全て成功すればEXIT_SUCCESS
+ */
+int main() {
+  namespace detail = async_transfer_test;
+
+  bool is_ok = true;
+  is_ok = detail::TestRoundTrip(0, 0) && is_ok;
+  // ページの境界をまたぐ
+  is_ok = detail::TestRoundTrip(filter_core::PAGE_SIZE - 1000, 1) && is_ok;
+  is_ok = detail::TestRoundTrip(filter_core::PAGE_SIZE, 5) && is_ok;
+  is_ok = detail::TestError() && is_ok;
+
+  return (is_ok)? EXIT_SUCCESS : EXIT_FAILURE;
+}
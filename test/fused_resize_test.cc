@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/fused_resize.h"
+#include "filter_core/worker_pool.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+
+using cv::Mat;
+using cv::Size;
+using filter_core::FusedResizer;
+using filter_core::WorkerPool;
+
+
+namespace fused_resize_test {
+
+bool TestResize(Mat src, Size size, int interpolation, bool is_gray,
+                WorkerPool& pool);
+}  // namespace fused_resize_test
+
+
+namespace fused_resize_test {
+/*!
+ * \brief FusedResizerの結果をcvtColorとresizeを続けて呼ぶ場合と比べる.
+ *
+ * 差は線形補間の丸めにより最大1まで許す.WorkerPoolで帯に分けた場合の結
+ * 果は、1スレッドの場合と一致しなければならない.
+ *
+ * \param src 入力画像.CV_8UC3
+ * \param size 出力画像のサイズ
+ * \param interpolation 補間方法
+ * \param is_gray グレースケールへ変換する場合は真
+ * \param pool 帯に分けて処理するスレッド
+ * \return 差が許容範囲であれば真
+ */
+bool TestResize(Mat src, Size size, int interpolation, bool is_gray,
+                WorkerPool& pool) {
+  Mat expected;
+  if (is_gray) {
+    Mat gray;
+    cv::cvtColor(src, gray, CV_BGR2GRAY);
+    cv::resize(gray, expected, size, 0, 0, interpolation);
+  } else {
+    cv::resize(src, expected, size, 0, 0, interpolation);
+  }
+
+  const int type = (is_gray)? CV_8UC1 : CV_8UC3;
+  FusedResizer resizer(size, interpolation, is_gray);
+  Mat actual(size, type);
+  resizer.resize(src, actual);
+  // 同じ参照表を使い、帯に分けて処理する
+  Mat banded(size, type);
+  resizer.resize(src, banded, pool);
+
+  const double difference = cv::norm(expected, actual, cv::NORM_INF);
+  const double band_difference = cv::norm(actual, banded, cv::NORM_INF);
+  const bool is_ok = difference <= 1.0 && band_difference == 0.0;
+  std::cout << ((is_ok)? "ok" : "NG") << ": " <<
+    src.cols << "x" << src.rows << " -> " <<
+    size.width << "x" << size.height << ", " <<
+    ((interpolation == cv::INTER_NEAREST)? "nearest" : "linear") << ", " <<
+    ((is_gray)? "gray" : "bgr") <<
+    ": max difference " << difference <<
+    ", " << pool.size() << " threads difference " << band_difference <<
+    std::endl;
+  return is_ok;
+}
+}  // namespace fused_resize_test
+
+
+/*!
+ * \brief FusedResizerの全ての経路を試し、不一致があれば失敗を返す.
+ * \return 全て一致すればEXIT_SUCCESS
+ */
+int main() {
+  namespace detail = fused_resize_test;
+
+  Mat src(1080, 1920, CV_8UC3);
+  cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+
+  WorkerPool pool(std::max(std::thread::hardware_concurrency(), 2u) - 1,
+                  false);
+  bool is_ok = true;
+  for (Size size : {Size(640, 480), Size(1920, 1080), Size(333, 97)}) {
+    for (int interpolation : {cv::INTER_NEAREST, cv::INTER_LINEAR}) {
+      for (bool is_gray : {true, false}) {
+        is_ok =
+          detail::TestResize(src, size, interpolation, is_gray, pool) &&
+          is_ok;
+      }
+    }
+  }
+  return (is_ok)? EXIT_SUCCESS : EXIT_FAILURE;
+}
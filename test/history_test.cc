@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/emulated_device.h"
+#include "filter_core/filter.h"
+#include "filter_core/fpga_communicator.h"
+#include "filter_core/handshake.h"
+#include "filter_core/program_options.h"
+#include "filter_core/reference_filter.h"
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+
+using std::vector;
+using std::chrono::milliseconds;
+using cv::Mat;
+using cv::Size;
+using filter_core::ColorLayout;
+using filter_core::EmulatedDevice;
+using filter_core::FPGACommunicator;
+using filter_core::Handshake;
+using filter_core::HistoryFilter;
+using filter_core::ImageOptions;
+using filter_core::ReferenceFilter;
+using filter_core::WaitStrategy;
+
+
+namespace history_test {
+
+bool TestDifference(ColorLayout layout, size_t length);
+}  // namespace history_test
+
+
+namespace history_test {
+/*!
+ * \brief 前回のフレームとの差を出力するエミュレータで、HistoryFilterが今
+ *        回と前回のフレームの置き場所を正しく通知するかを確かめる.
+ *
+ * 各フレームは一様な値で塗り、置き場所が一巡するまでフィルタする.最初の
+ * フレームは前回がないため0、以降は前回との値の差になる.
+ *
+ * \param layout SRAM上の画像の配置
+ * \param length 残すフレームの数
+ * \return 全てのフレームの結果が一致すれば真
+ */
+bool TestDifference(ColorLayout layout, size_t length) {
+  const bool is_colored = layout != ColorLayout::MONOCHROME;
+  const int type = (is_colored)? CV_8UC3 : CV_8UC1;
+  const ImageOptions options(Size(64, 48), type, cv::INTER_LINEAR,
+                             (is_colored)? 3 : 1);
+
+  FPGACommunicator com(
+      std::make_shared<EmulatedDevice>(ReferenceFilter::DIFFERENCE),
+      options.total_size * options.step);
+  Handshake handshake(WaitStrategy::INTERRUPT, milliseconds(1000), true);
+  SendImageSize(com, options.total_size, options.width);
+  SendColorLayout(com, layout);
+  HistoryFilter filter(com, options, handshake, layout, length);
+
+  Mat src(options.size, type), dst(options.size, type);
+  const vector<int> values = {10, 30, 60, 100, 150, 151, 90, 90};
+  bool is_ok = true;
+  for (size_t i = 0; i < values.size(); ++i) {
+    src.setTo(cv::Scalar::all(values[i]));
+    filter(com, src, dst);
+
+    const int expected = (i == 0)? 0 : std::abs(values[i] - values[i - 1]);
+    const double difference =
+      cv::norm(dst, Mat(options.size, type, cv::Scalar::all(expected)),
+               cv::NORM_INF);
+    is_ok = difference == 0.0 && is_ok;
+  }
+
+  std::cout << ((is_ok)? "ok" : "NG") << ": " <<
+    ((layout == ColorLayout::MONOCHROME)? "grey" :
+     (layout == ColorLayout::PLANAR)? "planar" : "interleaved") << ", " <<
+    length << " frames kept, " <<
+    values.size() << " frames" << std::endl;
+  return is_ok;
+}
+}  // namespace history_test
+
+
+/*!
+ * \brief 残すフレームの数と配置を変えてHistoryFilterを試し、不一致があれ
+ *        ば失敗を返す.
+ * \return 全て一致すればEXIT_SUCCESS
+ */
+int main() {
+  namespace detail = history_test;
+
+  bool is_ok = true;
+  for (auto layout : {ColorLayout::MONOCHROME, ColorLayout::INTERLEAVED,
+                      ColorLayout::PLANAR}) {
+    for (size_t length : {2, 3, 5})
+      { is_ok = detail::TestDifference(layout, length) && is_ok; }
+  }
+  return (is_ok)? EXIT_SUCCESS : EXIT_FAILURE;
+}
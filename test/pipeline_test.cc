@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2014 University of Tsukuba
+ * Reconfigurable computing systems laboratory
+ *
+ * Licensed under GPLv3 (http://www.gnu.org/copyleft/gpl.html)
+ */
+#include "filter_core/emulated_device.h"
+#include "filter_core/filter.h"
+#include "filter_core/fpga_communicator.h"
+#include "filter_core/handshake.h"
+#include "filter_core/pipeline.h"
+#include "filter_core/program_options.h"
+#include "filter_core/reference_filter.h"
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+
+using std::unique_ptr;
+using std::vector;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using cv::Mat;
+using cv::Size;
+using filter_core::Dispatch;
+using filter_core::EmulatedDevice;
+using filter_core::FPGACommunicator;
+using filter_core::Frame;
+using filter_core::Handshake;
+using filter_core::ImageOptions;
+using filter_core::Pipeline;
+using filter_core::ReferenceFilter;
+using filter_core::WaitStrategy;
+
+
+namespace pipeline_test {
+
+/*!
+ * \var FRAME_COUNT
+ * 1回の実行でキャプチャするフレーム数
+ */
+constexpr uint64_t FRAME_COUNT = 60;
+
+/*!
+ * \var DEPTH
+ * 1つのレーンのフレーム数
+ */
+constexpr size_t DEPTH = 2;
+
+/*!
+ * \class Boards
+ * \brief 処理時間の異なるエミュレータのボードと、各ボードのフレーム
+ */
+class Boards {
+ public:
+  const ImageOptions options;
+  vector<unique_ptr<FPGACommunicator>> communicators;
+  Handshake handshake;
+ public:
+  Boards(const vector<microseconds>& latencies, Size size);
+ public:
+  vector<vector<Frame>> lanes();
+};
+
+void SetIndex(Mat src, uint64_t index);
+uint64_t GetIndex(Mat dst);
+bool TestOrder(Dispatch dispatch);
+bool TestError();
+}  // namespace pipeline_test
+
+
+namespace pipeline_test {
+/*!
+ * \brief コンストラクタ.ボード毎に階調を反転するエミュレータを開く.
+ * \param latencies ボード毎の処理時間
+ * \param size 画像の大きさ
+ */
+Boards::Boards(const vector<microseconds>& latencies, Size size)
+  : options(size, CV_8UC1, cv::INTER_LINEAR, 1),
+    communicators(),
+    handshake(WaitStrategy::INTERRUPT, milliseconds(1000), true) {
+  for (const auto& latency : latencies) {
+    communicators.emplace_back(new FPGACommunicator(
+        std::make_shared<EmulatedDevice>(ReferenceFilter::INVERT, latency),
+        options.total_size * DEPTH));
+    SendImageSize(*communicators.back(), options.total_size, options.width);
+  }
+}
+/*!
+ * \brief ボード毎にDMAバッファ上のフレームを確保する.
+ * \return レーン毎のフレーム
+ */
+vector<vector<Frame>> Boards::lanes() {
+  vector<vector<Frame>> lanes;
+  for (auto& com : communicators) {
+    vector<Frame> frames;
+    for (size_t i = 0; i < DEPTH; ++i) {
+      const size_t offset = i * options.total_size;
+      frames.emplace_back(com->write_buffer(options.size, CV_8UC1, offset),
+                          com->read_buffer(options.size, CV_8UC1, offset));
+    }
+    lanes.push_back(std::move(frames));
+  }
+  return lanes;
+}
+
+/*!
+ * \brief 入力画像の先頭にフレームの番号を書き込む.
+ * \param src 入力画像
+ * \param index 番号
+ */
+void SetIndex(Mat src, uint64_t index) {
+  src.setTo(cv::Scalar::all(0));
+  std::memcpy(src.data, &index, sizeof(index));
+}
+/*!
+ * \brief 階調を反転した出力画像の先頭からフレームの番号を読み出す.
+ * \param dst 出力画像
+ * \return 番号
+ */
+uint64_t GetIndex(Mat dst) {
+  uint64_t inverted = 0;
+  std::memcpy(&inverted, dst.data, sizeof(inverted));
+  return ~inverted;
+}
+
+/*!
+ * \brief 処理時間の異なる3つのレーンで、出力がキャプチャした順に並ぶかを
+ *        確かめる.
+ * \param dispatch フレームの割り当て方
+ * \return 全てのフレームが順に出力されれば真
+ */
+bool TestOrder(Dispatch dispatch) {
+  Boards boards({microseconds(0), microseconds(500), microseconds(2000)},
+                Size(64, 48));
+
+  uint64_t captured = 0, expected = 0;
+  bool is_ordered = true;
+  Pipeline pipeline(boards.lanes(), dispatch);
+  pipeline.run(
+      [&](Mat src) {
+        if (captured == FRAME_COUNT) { return false; }
+
+        SetIndex(src, captured++);
+        return true;
+      },
+      [&](size_t lane, Mat src, Mat dst) {
+        Filter(*boards.communicators[lane], src, dst, boards.options,
+               boards.handshake);
+        return true;
+      },
+      [&](Mat src, Mat dst) {
+        is_ordered = GetIndex(dst) == expected && is_ordered;
+        ++expected;
+        return true;
+      });
+
+  uint64_t filtered = 0;
+  for (const auto count : pipeline.filtered()) { filtered += count; }
+
+  const bool is_ok =
+    is_ordered && expected == FRAME_COUNT && filtered == FRAME_COUNT;
+  std::cout << ((is_ok)? "ok" : "NG") << ": " <<
+    ToString(dispatch) << ", " << expected << " frames in order" << std::endl;
+  return is_ok;
+}
+/*!
+ * \brief 1つのレーンのFPGA転送ステージが例外を送出した場合に、実行が終わ
+ *        り、例外が再送出されるかを確かめる.
+ * \return 再送出されれば真
+ */
+bool TestError() {
+  Boards boards({microseconds(0), microseconds(500), microseconds(2000)},
+                Size(64, 48));
+
+  uint64_t captured = 0, outputs = 0;
+  std::atomic<uint64_t> filtered(0);
+  bool is_thrown = false;
+  Pipeline pipeline(boards.lanes(), Dispatch::LEAST_LOADED);
+  try {
+    pipeline.run(
+        [&](Mat src) {
+          if (captured == FRAME_COUNT) { return false; }
+
+          SetIndex(src, captured++);
+          return true;
+        },
+        [&](size_t lane, Mat src, Mat dst) {
+          if (filtered.fetch_add(1) == FRAME_COUNT / 4)
+            { throw std::runtime_error("filter failed"); }
+
+          Filter(*boards.communicators[lane], src, dst, boards.options,
+                 boards.handshake);
+          return true;
+        },
+        [&](Mat src, Mat dst) {
+          ++outputs;
+          return true;
+        });
+  } catch (std::runtime_error&) {
+    is_thrown = true;
+  }
+
+  const bool is_ok = is_thrown && outputs < FRAME_COUNT;
+  std::cout << ((is_ok)? "ok" : "NG") << ": " <<
+    "a throwing filter stopped the run after " << outputs << " frames" <<
+    std::endl;
+  return is_ok;
+}
+}  // namespace pipeline_test
+
+
+/*!
+ * \brief エミュレータのボードでPipelineを試し、失敗があれば失敗を返す.
+ * \return 全て成功すればEXIT_SUCCESS
+ */
+int main() {
+  namespace detail = pipeline_test;
+
+  bool is_ok = true;
+  for (auto dispatch : {Dispatch::ROUND_ROBIN, Dispatch::LEAST_LOADED})
+    { is_ok = detail::TestOrder(dispatch) && is_ok; }
+  is_ok = detail::TestError() && is_ok;
+  return (is_ok)? EXIT_SUCCESS : EXIT_FAILURE;
+}